@@ -0,0 +1,283 @@
+/*                                           >y#
+                                            ~'#o+
+                                           '~~~md~
+                '|+>#!~'':::::....        .~'~'cY#
+            .+oy+>|##!~~~''':::......     ~:'':md! .
+          #rcmory+>|#~''':::'::...::.::. :..'''Yr:...
+        'coRRaamuyb>|!~'''::::':...........  .+n|.::..
+       !maMMNMRYmuybb|!~'''':.........::::::: ro'..::..
+      .cODDMYouuurub!':::...........:::~'.. |o>::...:..
+      >BDNCYYmroyb>|#~:::::::::::::~':.:: :ob::::::::..
+      uOCCNAa#'''''||':::.                :oy':::::::::.
+    :rRDn!  :~::'y+::':  ... ...:::.     :ob':::::::::::.
+   yMYy:   :>yooCY'.':.   .:'':......    ~u+~::::::::::::.
+  >>:'. .~>yBDMo!.'': . .:'':.   .      >u|!:::::::::::::.
+    ':'~|mYu#:'~'''. :.~:':...         yy>|~:::::::::::::..
+    :!ydu>|!rDu::'. +'#~::!#'.~:     |r++>#':::::::::::::..
+    mn>>>>>YNo:'': !# >'::::...  ..:cyb++>!:::::::::..:::...
+    :ouooyodu:'': .!:.!:::.       yobbbb+>~::::::::....:....
+     'cacumo~''' .'~ :~'.::.    :aybbbbbb>':::'~''::::....
+      .mamd>'''. :~' :':'.:.   om>bbbyyyb>'.#b>|#~~~'':..
+      .yYYo''': .:~' .'::'   .ny>+++byyoao!b+|||#!~~~''''''::.
+      .#RUb:''. .:'' .:':   |a#|>>>>yBMdb #yb++b|':::::''':'::::::.
+      .'CO!'''  .:'' .'    uu~##|+mMYy>+:|yyo+:::'::.         .::::::
+      .:RB~''' ..::'.':   o>~!#uOOu>bby'|yB>.'::  '~!!!!!~':. ..  .::::
+       :Rm''': ..:~:!:  'c~~+YNnbyyybb~'mr.':  !+yoy+>||!~'::.       :::.
+      ..Oo''': .'' ~:  !+|BDCryuuuuub|#B!::  !rnYaocob|#!~'':.  ..    .::.
+      . nB''': :  .'  |dNNduroomnddnuun::.  ydNAMMOary+>#~:.:::...      .:
+       .uC~'''    :. yNRmmmadYUROMMBmm.:   bnNDDDMRBoy>|#~':....:.      .:
+                 :' ymrmnYUROMAAAAMYn::. .!oYNDDMYmub|!~'::....:..     :
+                 !'#booBRMMANDDDNNMO!:. !~#ooRNNAMMOOmuy+#!':::.......    :.
+                .!'!#>ynCMNDDDDDNMRu.. '|:!raRMNAMOOdooy+|!~:::........   .:
+                 : .'rdbcRMNNNNAMRB!:  |!:~bycmdYYBaoryy+|!~':::.::::.  ..
+                 ..~|RMADnnONAMMRdy:. .>#::yyoroccruuybb>#!~'::':...::.
+                  :'oMOMOYNMnybyuo!.  :>#::b+youuoyyy+>>|!~':.    :::::
+                  ''YMCOYYNMOCCCRdoy##~~~: !b>bb+>>>||#~:..:::     ::::.
+                  .:OMRCoRNAMOCROYYUdoy|>~:.~!!~!~~':...:'::::.   :::::.
+                  ''oNOYyMNAMMMRYnory+|!!!:.....     ::.  :'::::::::::::
+                 .:..uNabOAMMCOdcyb+|!~':::.          !!'.. :~:::::'''':.
+                  .   +Y>nOORYauyy>!!'':....           !#~..  .~:''''''':.
+
+****************  ____  _____  ______________________    ____     **************
+***************  / __ )/   \ \/ / ____/ ___/_  __/   |  / __ \   ***************
+**************  / __  / /| |\  / __/  \__ \ / / / /| | / /_/ /  ****************
+*************  / /_/ / ___ |/ / /___ ___/ // / / ___ |/ _, _/  *****************
+************  /_____/_/  |_/_/_____//____//_/ /_/  |_/_/ |_|  ******************
+*/
+
+
+/*
+ * Copyright (C) 2013  Leo Singer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with with program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA  02111-1307  USA
+ */
+
+/* Runtime dispatch between the instruction set variants of the sky map
+ * functions in bayestar_sky_map.c. This file is compiled only when the
+ * extension is built with instruction set variants, in which case
+ * BAYESTAR_HAVE_AVX2 and BAYESTAR_HAVE_AVX512 are defined for the variants
+ * that the compiler was able to build. The baseline variant is always built.
+ *
+ * The variant is chosen once, from the features of the CPU. It may be
+ * overridden by setting the environment variable BAYESTAR_ISA to "baseline",
+ * "avx2", or "avx512"; a variant that was not built or that the CPU does not
+ * support is ignored. */
+
+#include "bayestar_sky_map.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define DECLARE_VARIANTS(isa) \
+double *bayestar_sky_map_tdoa_ ## isa( \
+    long *npix, double gmst, int nifos, const double **locs, \
+    const double *toas, const double *s2_toas); \
+double *bayestar_sky_map_tdoa_snr_ ## isa( \
+    long *npix, double gmst, int nifos, float **responses, \
+    const double **locations, const double *toas, const double *snrs, \
+    const double *s2_toas, const double *horizons, double min_distance, \
+    double max_distance, bayestar_prior_t prior, \
+    const bayestar_quadrature_t *quadrature, \
+    const bayestar_warm_start_t *warm_in, bayestar_warm_start_t *warm_out, \
+    double **distmean, double **diststd); \
+int bayestar_sky_map_tdoa_snr_tiled_ ## isa( \
+    long nside, size_t max_bytes, uint32_t **ipix, double **P, long *n, \
+    double gmst, int nifos, float **responses, const double **locations, \
+    const double *toas, const double *snrs, const double *s2_toas, \
+    const double *horizons, double min_distance, double max_distance, \
+    bayestar_prior_t prior, const bayestar_quadrature_t *quadrature);
+
+DECLARE_VARIANTS(baseline)
+#ifdef BAYESTAR_HAVE_AVX2
+DECLARE_VARIANTS(avx2)
+#endif
+#ifdef BAYESTAR_HAVE_AVX512
+DECLARE_VARIANTS(avx512)
+#endif
+
+
+typedef enum {
+    ISA_BASELINE,
+    ISA_AVX2,
+    ISA_AVX512
+} isa_t;
+
+
+static int isa_supported(isa_t isa)
+{
+    switch (isa)
+    {
+#ifdef BAYESTAR_HAVE_AVX2
+        case ISA_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#ifdef BAYESTAR_HAVE_AVX512
+        case ISA_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")
+                && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq")
+                && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx2")
+                && __builtin_cpu_supports("fma");
+#endif
+        case ISA_BASELINE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+/* Choose the variant. Concurrent first calls may both do the work, but they
+ * arrive at the same answer. */
+static isa_t get_isa(void)
+{
+    static int isa = -1;
+
+    if (isa < 0)
+    {
+        const char *env = getenv("BAYESTAR_ISA");
+        int my_isa = -1;
+
+        __builtin_cpu_init();
+
+        if (env)
+        {
+            if (strcmp(env, "baseline") == 0)
+                my_isa = ISA_BASELINE;
+            else if (strcmp(env, "avx2") == 0)
+                my_isa = ISA_AVX2;
+            else if (strcmp(env, "avx512") == 0)
+                my_isa = ISA_AVX512;
+            if (my_isa >= 0 && !isa_supported(my_isa))
+                my_isa = -1;
+        }
+
+        if (my_isa < 0)
+        {
+            if (isa_supported(ISA_AVX512))
+                my_isa = ISA_AVX512;
+            else if (isa_supported(ISA_AVX2))
+                my_isa = ISA_AVX2;
+            else
+                my_isa = ISA_BASELINE;
+        }
+
+        isa = my_isa;
+    }
+
+    return isa;
+}
+
+
+const char *bayestar_isa(void)
+{
+    switch (get_isa())
+    {
+        case ISA_AVX512:
+            return "avx512";
+        case ISA_AVX2:
+            return "avx2";
+        default:
+            return "baseline";
+    }
+}
+
+
+#define DISPATCH(func, args) \
+    switch (get_isa()) \
+    { \
+        BAYESTAR_DISPATCH_AVX512(func, args) \
+        BAYESTAR_DISPATCH_AVX2(func, args) \
+        default: \
+            return func ## _baseline args; \
+    }
+
+#ifdef BAYESTAR_HAVE_AVX2
+#define BAYESTAR_DISPATCH_AVX2(func, args) case ISA_AVX2: return func ## _avx2 args;
+#else
+#define BAYESTAR_DISPATCH_AVX2(func, args)
+#endif
+
+#ifdef BAYESTAR_HAVE_AVX512
+#define BAYESTAR_DISPATCH_AVX512(func, args) case ISA_AVX512: return func ## _avx512 args;
+#else
+#define BAYESTAR_DISPATCH_AVX512(func, args)
+#endif
+
+
+double *bayestar_sky_map_tdoa(
+    long *npix,
+    double gmst,
+    int nifos,
+    const double **locs,
+    const double *toas,
+    const double *s2_toas)
+{
+    DISPATCH(bayestar_sky_map_tdoa,
+        (npix, gmst, nifos, locs, toas, s2_toas))
+}
+
+
+double *bayestar_sky_map_tdoa_snr(
+    long *npix,
+    double gmst,
+    int nifos,
+    float **responses,
+    const double **locations,
+    const double *toas,
+    const double *snrs,
+    const double *s2_toas,
+    const double *horizons,
+    double min_distance,
+    double max_distance,
+    bayestar_prior_t prior,
+    const bayestar_quadrature_t *quadrature,
+    const bayestar_warm_start_t *warm_in,
+    bayestar_warm_start_t *warm_out,
+    double **distmean,
+    double **diststd)
+{
+    DISPATCH(bayestar_sky_map_tdoa_snr,
+        (npix, gmst, nifos, responses, locations, toas, snrs, s2_toas,
+        horizons, min_distance, max_distance, prior, quadrature, warm_in,
+        warm_out, distmean, diststd))
+}
+
+
+int bayestar_sky_map_tdoa_snr_tiled(
+    long nside,
+    size_t max_bytes,
+    uint32_t **ipix,
+    double **P,
+    long *n,
+    double gmst,
+    int nifos,
+    float **responses,
+    const double **locations,
+    const double *toas,
+    const double *snrs,
+    const double *s2_toas,
+    const double *horizons,
+    double min_distance,
+    double max_distance,
+    bayestar_prior_t prior,
+    const bayestar_quadrature_t *quadrature)
+{
+    DISPATCH(bayestar_sky_map_tdoa_snr_tiled,
+        (nside, max_bytes, ipix, P, n, gmst, nifos, responses, locations,
+        toas, snrs, s2_toas, horizons, min_distance, max_distance, prior,
+        quadrature))
+}
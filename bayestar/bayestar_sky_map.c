@@ -65,6 +65,20 @@
  * MA  02111-1307  USA
  */
 
+/* When the extension is built with instruction set variants (see
+ * misc/setuptools_tuning.py), this file is compiled once for each variant
+ * with BAYESTAR_ISA defined to the name of the variant. The public functions
+ * are then suffixed with that name, and bayestar_dispatch.c provides the
+ * unsuffixed functions, which call the best variant for the CPU. */
+#ifdef BAYESTAR_ISA
+#define BAYESTAR_ISA_NAME(name) BAYESTAR_ISA_NAME_(name, BAYESTAR_ISA)
+#define BAYESTAR_ISA_NAME_(name, isa) BAYESTAR_ISA_NAME__(name, isa)
+#define BAYESTAR_ISA_NAME__(name, isa) name ## _ ## isa
+#define bayestar_sky_map_tdoa BAYESTAR_ISA_NAME(bayestar_sky_map_tdoa)
+#define bayestar_sky_map_tdoa_snr BAYESTAR_ISA_NAME(bayestar_sky_map_tdoa_snr)
+#define bayestar_sky_map_tdoa_snr_tiled BAYESTAR_ISA_NAME(bayestar_sky_map_tdoa_snr_tiled)
+#endif
+
 #include "bayestar_sky_map.h"
 
 #include <float.h>
@@ -80,6 +94,7 @@
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_integration.h>
 #include <gsl/gsl_sf_bessel.h>
+#include <gsl/gsl_sort_double.h>
 #include <gsl/gsl_sort_vector_double.h>
 #include <gsl/gsl_statistics_double.h>
 #include <gsl/gsl_vector.h>
@@ -101,6 +116,81 @@ static gsl_permutation *get_pixel_ranks(long npix, double *P)
 }
 
 
+/* Sort the first n entries of a permutation by decreasing value of P,
+ * leaving the remaining entries untouched. */
+static int sort_pixel_ranks_head(gsl_permutation *pix_perm, size_t n, const double *P)
+{
+    size_t i;
+    size_t *head = gsl_permutation_data(pix_perm);
+    double *values = malloc(n * sizeof(double));
+    size_t *order = malloc(n * sizeof(size_t));
+    size_t *old_head = malloc(n * sizeof(size_t));
+
+    if (!values || !order || !old_head)
+    {
+        free(values);
+        free(order);
+        free(old_head);
+        GSL_ERROR("failed to allocate space for pixel ranks", GSL_ENOMEM);
+    }
+
+    for (i = 0; i < n; i ++)
+    {
+        old_head[i] = head[i];
+        values[i] = P[head[i]];
+    }
+    gsl_sort_index(order, values, 1, n);
+    for (i = 0; i < n; i ++)
+        head[i] = old_head[order[n - 1 - i]];
+
+    free(values);
+    free(order);
+    free(old_head);
+    return GSL_SUCCESS;
+}
+
+
+/* Return indices of sorted pixels from greatest to smallest, given that only
+ * the nselected pixels listed in selected can have finite values. The
+ * remaining pixels are placed after them in an arbitrary order. */
+static gsl_permutation *get_pixel_ranks_subset(long npix, double *P, long nselected, const long *selected)
+{
+    long i, j;
+    size_t *data;
+    unsigned char *is_selected;
+    gsl_permutation *pix_perm;
+
+    is_selected = calloc(npix, sizeof(unsigned char));
+    if (!is_selected)
+        GSL_ERROR_NULL("failed to allocate space for pixel ranks", GSL_ENOMEM);
+
+    pix_perm = gsl_permutation_alloc(npix);
+    if (!pix_perm)
+    {
+        free(is_selected);
+        return NULL;
+    }
+    data = gsl_permutation_data(pix_perm);
+
+    for (i = 0; i < nselected; i ++)
+    {
+        data[i] = selected[i];
+        is_selected[selected[i]] = 1;
+    }
+    for (j = 0; j < npix; j ++)
+        if (!is_selected[j])
+            data[i ++] = j;
+    free(is_selected);
+
+    if (sort_pixel_ranks_head(pix_perm, nselected, P) != GSL_SUCCESS)
+    {
+        gsl_permutation_free(pix_perm);
+        return NULL;
+    }
+    return pix_perm;
+}
+
+
 /* Exponentiate and normalize a log probability sky map. */
 static void exp_normalize(long npix, double *P, gsl_permutation *pix_perm)
 {
@@ -140,10 +230,235 @@ static long indexof_confidence_level(long npix, double *P, double level, gsl_per
 }
 
 
-/* Perform sky localization based on TDOAs alone. Returns log probability; not normalized. */
+/* Evaluate the (un-normalized) Gaussian TDOA log likelihood for one pixel. */
+static double tdoa_log_likelihood(
+    long nside, /* Input: HEALPix lateral resolution. */
+    long ipix, /* Input: pixel index in the RING scheme. */
+    double gmst, /* Greenwich mean sidereal time in radians. */
+    int nifos, /* Input: number of detectors. */
+    const double **locs, /* Input: array of detector positions. */
+    const double *t, /* Input: times of arrival relative to the zeroth TOA. */
+    const double *w /* Input: reciprocals of measurement variances. */
+) {
+    int j;
+
+    /* Determine polar coordinates of this pixel. */
+    double theta, phi;
+    pix2ang_ring(nside, ipix, &theta, &phi);
+
+    /* Convert from equatorial to geographic coordinates. */
+    phi -= gmst;
+
+    /* Convert to Cartesian coordinates. */
+    double n[3];
+    ang2vec(theta, phi, n);
+
+    /* Loop over detectors. */
+    double dt[nifos];
+    for (j = 0; j < nifos; j ++)
+        dt[j] = t[j] + cblas_ddot(3, n, 1, locs[j], 1) / LAL_C_SI;
+
+    /* Evaluate the (un-normalized) Gaussian log likelihood. */
+    return -0.5 * gsl_stats_wtss(w, 1, dt, 1, nifos);
+}
+
+
+/*
+ * Geometric index of the time-delay rings.
+ *
+ * For each pair of detectors i and j, a source in the direction n produces a
+ * time delay n . (locs[j] - locs[i]) / c = -(t[j] - t[i]), so the sky
+ * positions that are consistent with the measured TOAs lie on a ring about
+ * the baseline. The weighted sum of squares that appears in the TDOA
+ * likelihood is no smaller than the contribution of any pair of detectors, so
+ * a pixel that is more than k standard deviations from any one of the rings
+ * has a log likelihood below -k^2/2. We find the pixels that lie within this
+ * band of all of the rings by descending the NESTED pixel hierarchy and
+ * discarding any pixel whose bounding cap misses a band.
+ */
+
+
+/* We choose k so that the pixels that we skip can hold at most a fraction
+ * exp(-tdoa_ring_log_tolerance) of the probability of a pixel with a
+ * likelihood of unity, even if every pixel on the sky were to sit right at
+ * the floor. */
+static const double tdoa_ring_log_tolerance = 20;
+
+/* If the best pixel that we evaluate has a log likelihood below this value,
+ * then the bound above is not useful, and we evaluate every pixel instead. */
+static const double tdoa_ring_min_log_likelihood = -10;
+
+
+typedef struct {
+    double axis[3]; /* Unit vector along baseline, in equatorial coordinates. */
+    double min_angle; /* Smallest angle from axis that lies within the band. */
+    double max_angle; /* Largest angle from axis that lies within the band. */
+} tdoa_ring;
+
+
+/* Upper bound on the angular radius of any pixel at a given resolution. The
+ * true maximum pixel radius is about 0.87 / nside; we leave a safety factor
+ * of more than 2. */
+static double max_pixrad(long nside)
+{
+    return 2 * sqrt(M_PI / 3) / nside;
+}
+
+
+/* Find the band about each baseline in which the TDOA likelihood can exceed
+ * exp(-nsigma^2 / 2). Returns the number of rings, or -1 if any band is empty
+ * (i.e., the TOAs are inconsistent with any sky position). */
+static int tdoa_rings_init(
+    tdoa_ring *rings, /* Output: array of length nifos * (nifos - 1) / 2. */
+    double nsigma, /* Input: half-width of bands in standard deviations. */
+    double gmst, /* Greenwich mean sidereal time in radians. */
+    int nifos, /* Input: number of detectors. */
+    const double **locs, /* Input: array of detector positions. */
+    const double *toas, /* Input: array of times of arrival. */
+    const double *s2_toas /* Input: uncertainties in times of arrival. */
+) {
+    int i, j, k, nrings = 0;
+    const double cosgmst = cos(gmst), singmst = sin(gmst);
+
+    for (i = 0; i < nifos; i ++)
+    {
+        for (j = i + 1; j < nifos; j ++)
+        {
+            tdoa_ring *ring = &rings[nrings ++];
+            double baseline[3], length, cosangle, halfwidth;
+
+            for (k = 0; k < 3; k ++)
+                baseline[k] = locs[j][k] - locs[i][k];
+            length = cblas_dnrm2(3, baseline, 1);
+            if (!(length > 0))
+                return -1;
+
+            /* Rotate baseline from geographic to equatorial coordinates. */
+            ring->axis[0] = (baseline[0] * cosgmst - baseline[1] * singmst) / length;
+            ring->axis[1] = (baseline[0] * singmst + baseline[1] * cosgmst) / length;
+            ring->axis[2] = baseline[2] / length;
+
+            cosangle = -LAL_C_SI * (toas[j] - toas[i]) / length;
+            halfwidth = nsigma * LAL_C_SI * sqrt(s2_toas[i] + s2_toas[j]) / length;
+            if (cosangle - halfwidth > 1 || cosangle + halfwidth < -1)
+                return -1;
+
+            ring->min_angle = acos(GSL_MIN_DBL(cosangle + halfwidth, 1));
+            ring->max_angle = acos(GSL_MAX_DBL(cosangle - halfwidth, -1));
+        }
+    }
+
+    return nrings;
+}
+
+
+/* Return nonzero if the bounding cap of a NESTED pixel misses the band of any
+ * of the rings, so that none of the pixel's descendants need be evaluated. */
+static int tdoa_rings_miss(
+    long nside, /* Input: HEALPix lateral resolution. */
+    long ipix, /* Input: pixel index in the NESTED scheme. */
+    int nrings, /* Input: number of rings. */
+    const tdoa_ring *rings /* Input: array of rings. */
+) {
+    const double pixrad = max_pixrad(nside);
+    double vec[3];
+    int iring;
+
+    pix2vec_nest(nside, ipix, vec);
+
+    for (iring = 0; iring < nrings; iring ++)
+    {
+        const double angle = acos(GSL_MAX_DBL(-1, GSL_MIN_DBL(1,
+            cblas_ddot(3, vec, 1, rings[iring].axis, 1))));
+        if (angle + pixrad < rings[iring].min_angle
+            || angle - pixrad > rings[iring].max_angle)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* Find all pixels that lie within the bands of all of the rings. Returns a
+ * newly allocated array of RING-scheme pixel indices, or NULL on failure. */
+static long *tdoa_rings_query(
+    long nside, /* Input: HEALPix lateral resolution. */
+    int nrings, /* Input: number of rings. */
+    const tdoa_ring *rings, /* Input: array of rings. */
+    long *nselected /* Output: number of pixels found. */
+) {
+    /* Depth-first traversal of the NESTED hierarchy. Each step pops one pixel
+     * and pushes at most four, so the stack never holds more than
+     * 12 + 3 * order entries. */
+    long stack_ipix[12 + 3 * 30];
+    int stack_order[12 + 3 * 30];
+    int nstack = 0;
+    int order = 0;
+    long n = 0, capacity = 1024;
+    long *selected;
+
+    while ((1L << order) < nside)
+        order ++;
+
+    selected = malloc(capacity * sizeof(long));
+    if (!selected)
+        GSL_ERROR_NULL("failed to allocate space for pixel index", GSL_ENOMEM);
+
+    for (nstack = 0; nstack < 12; nstack ++)
+    {
+        stack_ipix[nstack] = 11 - nstack;
+        stack_order[nstack] = 0;
+    }
+
+    while (nstack > 0)
+    {
+        const long ipix = stack_ipix[-- nstack];
+        const int this_order = stack_order[nstack];
+
+        /* If this pixel missed one of the bands, discard it. */
+        if (tdoa_rings_miss(1L << this_order, ipix, nrings, rings))
+            continue;
+
+        if (this_order < order)
+        {
+            int ichild;
+            for (ichild = 3; ichild >= 0; ichild --)
+            {
+                stack_ipix[nstack] = 4 * ipix + ichild;
+                stack_order[nstack] = this_order + 1;
+                nstack ++;
+            }
+        } else {
+            if (n == capacity)
+            {
+                long *new_selected;
+                capacity *= 2;
+                new_selected = realloc(selected, capacity * sizeof(long));
+                if (!new_selected)
+                {
+                    free(selected);
+                    GSL_ERROR_NULL("failed to allocate space for pixel index", GSL_ENOMEM);
+                }
+                selected = new_selected;
+            }
+            nest2ring(nside, ipix, &selected[n ++]);
+        }
+    }
+
+    *nselected = n;
+    return selected;
+}
+
+
+/* Perform sky localization based on TDOAs alone. Returns log probability; not normalized.
+ * If *selected is set to a non-NULL array on return, then only the *nselected
+ * pixels that it lists were evaluated, and all other pixels are set to
+ * -INFINITY; the caller is responsible for freeing the array. */
 static int bayestar_sky_map_tdoa_not_normalized_log(
     long npix, /* Input: number of HEALPix pixels. */
     double *P, /* Output: pre-allocated array of length npix to store posterior map. */
+    long *nselected, /* Output: number of pixels evaluated. */
+    long **selected, /* Output: list of pixels evaluated, or NULL if all were. */
     double gmst, /* Greenwich mean sidereal time in radians. */
     int nifos, /* Input: number of detectors. */
     const double **locs, /* Input: array of detector positions. */
@@ -154,6 +469,9 @@ static int bayestar_sky_map_tdoa_not_normalized_log(
     long nside;
     long i;
 
+    *nselected = npix;
+    *selected = NULL;
+
     /* Determine the lateral HEALPix resolution. */
     nside = npix2nside(npix);
     if (nside < 0)
@@ -170,108 +488,211 @@ static int bayestar_sky_map_tdoa_not_normalized_log(
     for (i = 0; i < nifos; i ++)
         t[i] = toas[i] - toas[0];
 
-    /* Loop over pixels. */
-    for (i = 0; i < npix; i ++)
+    /* With three or more detectors, the likelihood is concentrated near the
+     * intersections of the time-delay rings. Evaluate only the pixels that
+     * are near all of the rings, if we can find any. */
+    if (nifos >= 3)
     {
-        int j;
+        const double nsigma = sqrt(2 * (log(npix) + tdoa_ring_log_tolerance));
+        tdoa_ring rings[nifos * (nifos - 1) / 2];
+        const int nrings = tdoa_rings_init(rings, nsigma, gmst, nifos, locs, t, s2_toas);
 
-        /* Determine polar coordinates of this pixel. */
-        double theta, phi;
-        pix2ang_ring(nside, i, &theta, &phi);
+        if (nrings > 0)
+        {
+            long n;
+            long *pix = tdoa_rings_query(nside, nrings, rings, &n);
+            if (!pix)
+                return GSL_ENOMEM;
+
+            if (n > 0)
+            {
+                double max_log_p = -INFINITY;
 
-        /* Convert from equatorial to geographic coordinates. */
-        phi -= gmst;
+                for (i = 0; i < npix; i ++)
+                    P[i] = -INFINITY;
 
-        /* Convert to Cartesian coordinates. */
-        double n[3];
-        ang2vec(theta, phi, n);
+                for (i = 0; i < n; i ++)
+                {
+                    const long ipix = pix[i];
+                    P[ipix] = tdoa_log_likelihood(nside, ipix, gmst, nifos, locs, t, w);
+                    if (P[ipix] > max_log_p)
+                        max_log_p = P[ipix];
+                }
 
-        /* Loop over detectors. */
-        double dt[nifos];
-        for (j = 0; j < nifos; j ++)
-            dt[j] = t[j] + cblas_ddot(3, n, 1, locs[j], 1) / LAL_C_SI;
+                if (max_log_p >= tdoa_ring_min_log_likelihood)
+                {
+                    *nselected = n;
+                    *selected = pix;
+                    return GSL_SUCCESS;
+                }
+            }
 
-        /* Evaluate the (un-normalized) Gaussian log likelihood. */
-        P[i] = -0.5 * gsl_stats_wtss(w, 1, dt, 1, nifos);
+            free(pix);
+        }
     }
 
+    /* Loop over pixels. */
+    for (i = 0; i < npix; i ++)
+        P[i] = tdoa_log_likelihood(nside, i, gmst, nifos, locs, t, w);
+
     /* Done! */
     return GSL_SUCCESS;
 }
 
 
+/* Evaluate the TDOA log likelihood, rank the pixels, and exponentiate and
+ * normalize the sky map. */
+static int bayestar_sky_map_tdoa_ranked(
+    gsl_permutation **pix_perm, /* Output: ranks of pixels. */
+    long npix, /* Input: number of HEALPix pixels. */
+    double *P, /* Output: pre-allocated array of length npix to store posterior map. */
+    double gmst, /* Greenwich mean sidereal time in radians. */
+    int nifos, /* Input: number of detectors. */
+    const double **locs, /* Input: array of detector positions. */
+    const double *toas, /* Input: array of times of arrival. */
+    const double *s2_toas /* Input: uncertainties in times of arrival. */
+) {
+    long nselected;
+    long *selected;
+    int ret = bayestar_sky_map_tdoa_not_normalized_log(npix, P, &nselected, &selected, gmst, nifos, locs, toas, s2_toas);
+    if (ret != GSL_SUCCESS)
+        return ret;
+
+    if (selected)
+    {
+        *pix_perm = get_pixel_ranks_subset(npix, P, nselected, selected);
+        free(selected);
+    } else {
+        *pix_perm = get_pixel_ranks(npix, P);
+    }
+    if (!*pix_perm)
+        return GSL_ENOMEM;
+
+    exp_normalize(npix, P, *pix_perm);
+    return GSL_SUCCESS;
+}
+
+
 static const double autoresolution_confidence_level = 0.9999;
 static const long autoresolution_count_pix = 3072;
 
 
+/* Evaluate the TDOA sky map at one resolution. If maxpix is not NULL, then
+ * also find the number of pixels in the credible region. */
+static double *bayestar_sky_map_tdoa_level(
+    gsl_permutation **pix_perm,
+    long *maxpix,
+    long npix, /* Input: number of HEALPix pixels. */
+    double gmst, /* Greenwich mean sidereal time in radians. */
+    int nifos, /* Input: number of detectors. */
+    const double **locs, /* Input: array of detector positions. */
+    const double *toas, /* Input: array of times of arrival. */
+    const double *s2_toas /* Input: uncertainties in times of arrival. */
+) {
+    double *P = malloc(npix * sizeof(double));
+    if (!P)
+        GSL_ERROR_NULL("failed to allocate output array", GSL_ENOMEM);
+    if (bayestar_sky_map_tdoa_ranked(pix_perm, npix, P, gmst, nifos, locs, toas, s2_toas) != GSL_SUCCESS)
+    {
+        free(P);
+        return NULL;
+    }
+    if (maxpix)
+        *maxpix = indexof_confidence_level(npix, P, autoresolution_confidence_level, *pix_perm);
+    return P;
+}
+
+
 /* Perform sky localization based on TDOAs alone. */
 static double *bayestar_sky_map_tdoa_adapt_resolution(
     gsl_permutation **pix_perm,
     long *maxpix,
     long *npix, /* In/out: number of HEALPix pixels. */
+    long hint_npix, /* Input: resolution to try first, or 0. */
     double gmst, /* Greenwich mean sidereal time in radians. */
     int nifos, /* Input: number of detectors. */
     const double **locs, /* Input: array of detector positions. */
     const double *toas, /* Input: array of times of arrival. */
     const double *s2_toas /* Input: uncertainties in times of arrival. */
 ) {
-    int ret;
     double *P = NULL;
     long my_npix = *npix;
     long my_maxpix = *npix;
     gsl_permutation *my_pix_perm = NULL;
 
-    if (my_npix == -1)
+    /* If we are given the resolution that was selected for a previous run,
+     * then try it first. The search below stops at the first resolution,
+     * from coarsest to finest, at which enough pixels pass the cut. Keep the
+     * hint if enough pixels pass at the hint and too few pass at the next
+     * coarser resolution. This is the resolution that the search would
+     * select unless the count of pixels that pass the cut shrinks somewhere
+     * between the coarsest resolution and the hint as the resolution is
+     * refined; in that case the search would stop at a coarser resolution
+     * than the hint. */
+    if (my_npix == -1 && hint_npix > 0)
     {
-        my_npix = autoresolution_count_pix / 4;
-        do {
-            my_npix *= 4;
+        const long hint_nside = npix2nside(hint_npix);
+        long coarse_maxpix = 0;
+
+        if (hint_nside < 0 || (hint_nside & (hint_nside - 1)))
+            GSL_ERROR_NULL("invalid warm-start resolution", GSL_EINVAL);
 
+        if (hint_npix > autoresolution_count_pix)
+        {
+            P = bayestar_sky_map_tdoa_level(&my_pix_perm, &coarse_maxpix,
+                hint_npix / 4, gmst, nifos, locs, toas, s2_toas);
+            if (!P)
+                goto fail;
             free(P);
+            P = NULL;
             gsl_permutation_free(my_pix_perm);
+            my_pix_perm = NULL;
+        }
 
-            P = malloc(my_npix * sizeof(double));
+        if (hint_npix >= autoresolution_count_pix
+            && coarse_maxpix < autoresolution_count_pix)
+        {
+            P = bayestar_sky_map_tdoa_level(&my_pix_perm, &my_maxpix,
+                hint_npix, gmst, nifos, locs, toas, s2_toas);
             if (!P)
-                GSL_ERROR_NULL("failed to allocate output array", GSL_ENOMEM);
-            ret = bayestar_sky_map_tdoa_not_normalized_log(my_npix, P, gmst, nifos, locs, toas, s2_toas);
-            if (ret != GSL_SUCCESS)
-            {
-                free(P);
-                P = NULL;
                 goto fail;
-            }
-            my_pix_perm = get_pixel_ranks(my_npix, P);
-            if (!my_pix_perm)
+            if (my_maxpix >= autoresolution_count_pix)
             {
-                free(P);
-                P = NULL;
-                goto fail;
+                my_npix = hint_npix;
+                goto done;
             }
-            exp_normalize(my_npix, P, my_pix_perm);
 
-            my_maxpix = indexof_confidence_level(my_npix, P, autoresolution_confidence_level, my_pix_perm);
-        } while (my_maxpix < autoresolution_count_pix);
-    } else {
-        P = malloc(my_npix * sizeof(double));
-        if (!P)
-            GSL_ERROR_NULL("failed to allocate output array", GSL_ENOMEM);
-        ret = bayestar_sky_map_tdoa_not_normalized_log(my_npix, P, gmst, nifos, locs, toas, s2_toas);
-        if (ret != GSL_SUCCESS)
-        {
+            /* The inputs changed too much; start over. */
             free(P);
             P = NULL;
-            goto fail;
+            gsl_permutation_free(my_pix_perm);
+            my_pix_perm = NULL;
         }
-        my_pix_perm = get_pixel_ranks(my_npix, P);
-        if (!my_pix_perm)
-        {
+    }
+
+    if (my_npix == -1)
+    {
+        my_npix = autoresolution_count_pix / 4;
+        do {
+            my_npix *= 4;
+
             free(P);
-            P = NULL;
+            gsl_permutation_free(my_pix_perm);
+            my_pix_perm = NULL;
+
+            P = bayestar_sky_map_tdoa_level(&my_pix_perm, &my_maxpix,
+                my_npix, gmst, nifos, locs, toas, s2_toas);
+            if (!P)
+                goto fail;
+        } while (my_maxpix < autoresolution_count_pix);
+    } else {
+        P = bayestar_sky_map_tdoa_level(&my_pix_perm, NULL,
+            my_npix, gmst, nifos, locs, toas, s2_toas);
+        if (!P)
             goto fail;
-        }
-        exp_normalize(my_npix, P, my_pix_perm);
     }
 
+done:
     *npix = my_npix;
     *pix_perm = my_pix_perm;
     *maxpix = my_maxpix;
@@ -291,7 +712,7 @@ double *bayestar_sky_map_tdoa(
 ) {
     long maxpix;
     gsl_permutation *pix_perm = NULL;
-    double *ret = bayestar_sky_map_tdoa_adapt_resolution(&pix_perm, &maxpix, npix, gmst, nifos, locs, toas, s2_toas);
+    double *ret = bayestar_sky_map_tdoa_adapt_resolution(&pix_perm, &maxpix, npix, 0, gmst, nifos, locs, toas, s2_toas);
     gsl_permutation_free(pix_perm);
     return ret;
 }
@@ -326,94 +747,780 @@ static double radial_integrand_uniform_in_volume(double r, void *params)
 }
 
 
-double *bayestar_sky_map_tdoa_snr(
-    long *npix, /* Input: number of HEALPix pixels. */
-    double gmst, /* Greenwich mean sidereal time in radians. */
-    int nifos, /* Input: number of detectors. */
-    /* FIXME: make const; change XLALComputeDetAMResponse prototype */
-    /* const */ float **responses, /* Pointers to detector responses. */
-    const double **locations, /* Pointers to locations of detectors in Cartesian geographic coordinates. */
-    const double *toas, /* Input: array of times of arrival with arbitrary relative offset. (Make toas[0] == 0.) */
-    const double *snrs, /* Input: array of SNRs. */
-    const double *s2_toas, /* Measurement variance of TOAs. */
-    const double *horizons, /* Distances at which a source would produce an SNR of 1 in each detector. */
+/* Data is defined only once, by the baseline variant. */
+#if !defined(BAYESTAR_ISA) || defined(BAYESTAR_ISA_BASELINE)
+const bayestar_quadrature_t bayestar_quadrature_default = {
+    16, /* ntwopsi */
+    16, /* nu */
+    0.05, /* epsrel */
+    0 /* split_tolerance */
+};
+#endif
+
+
+/* Inputs to the integral over the amplitude parameters that are the same for
+ * every pixel. */
+typedef struct {
+    double gmst; /* Greenwich mean sidereal time in radians. */
+    int nifos; /* Number of detectors. */
+    /* const */ float **responses; /* Pointers to detector responses. */
+    const double *d1; /* Horizon distances, rescaled so that the furthest is 1. */
+    const double *snrs; /* SNRs. */
+    double min_distance; /* Minimum distance, rescaled like d1. */
+    double max_distance; /* Maximum distance, rescaled like d1. */
+    double (* radial_integrand) (double x, void *params);
+    int ntwopsi; /* Number of integration steps in 2*psi. */
+    int nu; /* Number of integration steps in cos(inclination). */
+    double epsrel; /* Relative accuracy of the radial integral. */
+    double split_tolerance; /* Tolerance for coarse evaluation, or 0. */
+    double distance_scale; /* Factor to convert rescaled distances back. */
+    const gsl_integration_glfixed_table *moments_table; /* Rule for distance moments, or NULL. */
+    const double **antenna; /* Antenna factors of each detector at every pixel at resolution antenna_nside, or NULL. */
+    long antenna_nside; /* Resolution of the tabulated antenna factors. */
+} amplitude_params;
+
+
+/* Maximum number of subdivisions for adaptive integration. */
+static const size_t amplitude_subdivision_limit = 64;
+
+/* Subdivide radial integral where likelihood is this fraction of the maximum,
+ * will be used in solving the quadratic to find the breakpoints */
+static const double amplitude_eta = 0.01;
+
+/* Number of Gauss-Legendre nodes per interval between breakpoints for the
+ * distance moments. */
+static const size_t amplitude_moments_nodes = 16;
+
+
+/* Validate the settings for the amplitude integral and fill in params.
+ * d1 must point to storage for nifos doubles that outlives params. */
+static int amplitude_params_init(
+    amplitude_params *params,
+    double *d1,
+    double gmst,
+    int nifos,
+    float **responses,
+    const double *snrs,
+    const double *horizons,
     double min_distance,
     double max_distance,
-    bayestar_prior_t prior)
+    bayestar_prior_t prior,
+    const bayestar_quadrature_t *quadrature)
 {
-    long nside;
-    long maxpix;
-    long i;
-    double d1[nifos];
-    double *P;
-    gsl_permutation *pix_perm;
-
-    /* Function pointer to hold radial integrand. */
-    double (* radial_integrand) (double x, void *params);
-
-    /* Will point to memory for storing GSL return values for each thread. */
-    int *gsl_errnos;
+    int i;
+    double d1max;
 
-    /* Storage for old GSL error handler. */
-    gsl_error_handler_t *old_handler;
-
-    /* Maximum number of subdivisions for adaptive integration. */
-    static const size_t subdivision_limit = 64;
-
-    /* Subdivide radial integral where likelihood is this fraction of the maximum,
-     * will be used in solving the quadratic to find the breakpoints */
-    static const double eta = 0.01;
-
-    /* Use this many integration steps in 2*psi  */
-    static const int ntwopsi = 16;
-
-    /* Number of integration steps in cos(inclination) */
-    static const int nu = 16;
+    if (!quadrature)
+        quadrature = &bayestar_quadrature_default;
+    if (quadrature->ntwopsi < 1 || quadrature->nu < 1 || !(quadrature->epsrel > 0) || !(quadrature->split_tolerance >= 0))
+        GSL_ERROR("invalid quadrature settings", GSL_EINVAL);
 
     /* Choose radial integrand function based on selected prior. */
     switch (prior)
     {
         case BAYESTAR_PRIOR_UNIFORM_IN_LOG_DISTANCE:
-            radial_integrand = radial_integrand_uniform_in_log_distance;
+            params->radial_integrand = radial_integrand_uniform_in_log_distance;
             break;
         case BAYESTAR_PRIOR_UNIFORM_IN_VOLUME:
-            radial_integrand = radial_integrand_uniform_in_volume;
+            params->radial_integrand = radial_integrand_uniform_in_volume;
             break;
         default:
-            GSL_ERROR_NULL("unrecognized choice of prior", GSL_EINVAL);
+            GSL_ERROR("unrecognized choice of prior", GSL_EINVAL);
             break;
     }
 
     /* Rescale distances so that furthest horizon distance is 1. */
+    memcpy(d1, horizons, nifos * sizeof(double));
+    for (d1max = d1[0], i = 1; i < nifos; i ++)
+        if (d1[i] > d1max)
+            d1max = d1[i];
+    for (i = 0; i < nifos; i ++)
+        d1[i] /= d1max;
+
+    params->gmst = gmst;
+    params->nifos = nifos;
+    params->responses = responses;
+    params->d1 = d1;
+    params->snrs = snrs;
+    params->min_distance = min_distance / d1max;
+    params->max_distance = max_distance / d1max;
+    params->ntwopsi = quadrature->ntwopsi;
+    params->nu = quadrature->nu;
+    params->epsrel = quadrature->epsrel;
+    params->split_tolerance = quadrature->split_tolerance;
+    params->distance_scale = d1max;
+    params->moments_table = NULL;
+    params->antenna = NULL;
+    params->antenna_nside = 0;
+    return GSL_SUCCESS;
+}
+
+
+/* Find the plus and cross antenna factors of one detector at every pixel,
+ * interleaved. Returns NULL on failure. */
+static double *antenna_factors(
+    long nside, /* Input: HEALPix lateral resolution. */
+    /* const */ float *response, /* Input: detector response. */
+    double gmst) /* Input: Greenwich mean sidereal time in radians. */
+{
+    const long npix = nside2npix(nside);
+    long ipix;
+    double *F = malloc(2 * npix * sizeof(double));
+    if (!F)
+        GSL_ERROR_NULL("failed to allocate space for antenna factors", GSL_ENOMEM);
+
+    #pragma omp parallel for
+    for (ipix = 0; ipix < npix; ipix ++)
     {
-        double d1max;
-        memcpy(d1, horizons, sizeof(d1));
-        for (d1max = d1[0], i = 1; i < nifos; i ++)
-            if (d1[i] > d1max)
-                d1max = d1[i];
-        for (i = 0; i < nifos; i ++)
-            d1[i] /= d1max;
-        min_distance /= d1max;
-        max_distance /= d1max;
+        double theta, phi;
+        pix2ang_ring(nside, ipix, &theta, &phi);
+        XLALComputeDetAMResponse(&F[2 * ipix], &F[2 * ipix + 1], (float (*)[3])response, phi, M_PI_2 - theta, 0, gmst);
     }
 
-    /* Evaluate posterior term only first. */
-    P = bayestar_sky_map_tdoa_adapt_resolution(&pix_perm, &maxpix, npix, gmst, nifos, locations, toas, s2_toas);
-    if (!P)
-        return NULL;
+    return F;
+}
 
-    /* Determine the lateral HEALPix resolution. */
-    nside = npix2nside(*npix);
 
-    /* Zero pixels that didn't meet the TDOA cut. */
-    for (i = 0; i < maxpix; i ++)
+/* Free the antenna factors that were computed in this run. */
+static void antenna_factors_free(int nifos, double **antenna)
+{
+    int i;
+    for (i = 0; i < nifos; i ++)
     {
-        long ipix = gsl_permutation_get(pix_perm, i);
-        P[ipix] = log(P[ipix]);
+        free(antenna[i]);
+        antenna[i] = NULL;
     }
-    for (; i < *npix; i ++)
-    {
-        long ipix = gsl_permutation_get(pix_perm, i);
+}
+
+
+/* Evaluate the log of the integral over the amplitude parameters for one
+ * pixel. Returns a GSL error code rather than calling the error handler, so
+ * that it can be called from a parallel section.
+ *
+ * If params->moments_table is set and distmean is not NULL, then also find
+ * the posterior mean and standard deviation of the distance in this pixel.
+ * For each sample in (psi, u), the first and second moments of the radial
+ * integrand are found with a fixed Gauss-Legendre rule between the same
+ * breakpoints as the adaptive integral, and are then averaged over samples
+ * with the weights given by the adaptive integral. This costs one extra pass
+ * of a fixed number of integrand evaluations per sample, instead of two more
+ * adaptive integrals. */
+static int amplitude_log_likelihood(
+    double *log_amplitude, /* Output: log of the integral. */
+    double *distmean, /* Output: posterior mean distance, or NULL. */
+    double *diststd, /* Output: posterior standard deviation of distance. */
+    const amplitude_params *params,
+    long nside, /* Input: HEALPix lateral resolution. */
+    long ipix, /* Input: pixel index in the RING scheme. */
+    gsl_integration_workspace *workspace)
+{
+    const int nifos = params->nifos;
+    const int ntwopsi = params->ntwopsi;
+    const int nu = params->nu;
+    const double min_distance = params->min_distance;
+    const double max_distance = params->max_distance;
+    const gsl_integration_glfixed_table *moments_table = distmean ? params->moments_table : NULL;
+    double F[nifos][2];
+    double theta, phi;
+    int itwopsi, iu, iifo;
+    double accum = -INFINITY;
+
+    /* Running sums of the weights and of the first and second moments of
+     * distance, relative to exp(accum). */
+    double sum0 = 0, sum1 = 0, sum2 = 0;
+
+    /* Look up polar coordinates of this pixel */
+    pix2ang_ring(nside, ipix, &theta, &phi);
+
+    /* Look up antenna factors */
+    for (iifo = 0; iifo < nifos; iifo ++)
+    {
+        if (params->antenna && nside == params->antenna_nside)
+        {
+            F[iifo][0] = params->antenna[iifo][2 * ipix];
+            F[iifo][1] = params->antenna[iifo][2 * ipix + 1];
+        } else {
+            XLALComputeDetAMResponse(&F[iifo][0], &F[iifo][1], (float (*)[3])params->responses[iifo], phi, M_PI_2 - theta, 0, params->gmst);
+        }
+        F[iifo][0] *= params->d1[iifo];
+        F[iifo][1] *= params->d1[iifo];
+    }
+
+    /* Integrate over 2*psi */
+    for (itwopsi = 0; itwopsi < ntwopsi; itwopsi++)
+    {
+        const double twopsi = (2 * M_PI / ntwopsi) * itwopsi;
+        const double costwopsi = cos(twopsi);
+        const double sintwopsi = sin(twopsi);
+
+        /* Integrate over u; since integrand only depends on u^2 we only
+         * have to go from u=0 to u=1. We want to include u=1, so the upper
+         * limit has to be <= */
+        for (iu = 0; iu <= nu; iu++)
+        {
+            const double u = (double)iu / nu;
+            const double u2 = gsl_pow_2(u);
+            const double u4 = gsl_pow_2(u2);
+
+            double A = 0, B = 0;
+            double breakpoints[5];
+            int num_breakpoints = 0;
+
+            /* The log-likelihood is quadratic in the estimated and true
+             * values of the SNR, and in 1/r. It is of the form A/r^2 + B/r,
+             * where A depends only on the true values of the SNR and is
+             * strictly negative and B depends on both the true values and
+             * the estimates and is strictly positive.
+             *
+             * The middle breakpoint is at the maximum of the log-likelihood,
+             * occurring at 1/r=-B/2A. The lower and upper breakpoints occur
+             * when the likelihood becomes eta times its maximum value. This
+             * occurs when
+             *
+             *   A/r^2 + B/r = log(eta) - B^2/4A.
+             *
+             */
+
+            /* Loop over detectors */
+            for (iifo = 0; iifo < nifos; iifo++)
+            {
+                const double Fp = F[iifo][0]; /* `plus' antenna factor times r */
+                const double Fx = F[iifo][1]; /* `cross' antenna factor times r */
+                const double FpFp = gsl_pow_2(Fp);
+                const double FxFx = gsl_pow_2(Fx);
+                const double FpFx = Fp * Fx;
+                const double rhotimesr2 = 0.125 * ((FpFp + FxFx) * (1 + 6*u2 + u4) + gsl_pow_2(1 - u2) * ((FpFp - FxFx) * costwopsi + 2 * FpFx * sintwopsi));
+                const double rhotimesr = sqrt(rhotimesr2);
+
+                /* FIXME: due to roundoff, rhotimesr2 can be very small and
+                 * negative rather than simply zero. If this happens, don't
+                 accumulate the log-likelihood terms for this detector. */
+                if (rhotimesr2 > 0)
+                {
+                    A += rhotimesr2;
+                    B += rhotimesr * params->snrs[iifo];
+                }
+            }
+            A *= -0.5;
+
+            {
+                const double middle_breakpoint = -2 * A / B;
+                const double lower_breakpoint = 1 / (1 / middle_breakpoint + sqrt(log(amplitude_eta) / A));
+                const double upper_breakpoint = 1 / (1 / middle_breakpoint - sqrt(log(amplitude_eta) / A));
+                breakpoints[num_breakpoints++] = min_distance;
+                if(lower_breakpoint > breakpoints[num_breakpoints-1] && lower_breakpoint < max_distance)
+                    breakpoints[num_breakpoints++] = lower_breakpoint;
+                if(middle_breakpoint > breakpoints[num_breakpoints-1] && middle_breakpoint < max_distance)
+                    breakpoints[num_breakpoints++] = middle_breakpoint;
+                if(upper_breakpoint > breakpoints[num_breakpoints-1] && upper_breakpoint < max_distance)
+                    breakpoints[num_breakpoints++] = upper_breakpoint;
+                breakpoints[num_breakpoints++] = max_distance;
+            }
+
+            {
+                /* Perform adaptive integration. Stop when a relative
+                 * accuracy of epsrel has been reached. */
+                inner_integrand_params integrand_params = {A, B, -0.25 * gsl_pow_2(B) / A};
+                const gsl_function func = {params->radial_integrand, &integrand_params};
+                double result, abserr;
+                int ret = gsl_integration_qagp(&func, &breakpoints[0], num_breakpoints, DBL_MIN, params->epsrel, amplitude_subdivision_limit, workspace, &result, &abserr);
+
+                /* If the integrator failed, then report the GSL error
+                 * value to the caller. */
+                if (ret != GSL_SUCCESS)
+                    return ret;
+
+                /* Take the logarithm and put the log-normalization back in. */
+                result = log(result) + integrand_params.log_offset;
+
+                if (moments_table)
+                {
+                    /* Moments of the radial integrand by a fixed rule. */
+                    double z = 0, m1 = 0, m2 = 0;
+                    int ibreakpoint;
+                    size_t inode;
+                    for (ibreakpoint = 0; ibreakpoint < num_breakpoints - 1; ibreakpoint ++)
+                    {
+                        for (inode = 0; inode < moments_table->n; inode ++)
+                        {
+                            double r, weight;
+                            gsl_integration_glfixed_point(
+                                breakpoints[ibreakpoint],
+                                breakpoints[ibreakpoint + 1],
+                                inode, &r, &weight, moments_table);
+                            weight *= GSL_FN_EVAL(&func, r);
+                            z += weight;
+                            m1 += weight * r;
+                            m2 += weight * r * r;
+                        }
+                    }
+
+                    /* Rescale the running sums to the new normalization and
+                     * add this sample. Skip samples while the likelihood
+                     * has underflowed, because then both exponents below
+                     * would be -inf - -inf = NaN. */
+                    {
+                        const double new_accum = logaddexp(accum, result);
+                        if (new_accum > -INFINITY)
+                        {
+                            const double scale = exp(accum - new_accum);
+                            sum0 *= scale;
+                            sum1 *= scale;
+                            sum2 *= scale;
+                        }
+                        if (new_accum > -INFINITY && z > 0)
+                        {
+                            const double weight = exp(result - new_accum);
+                            sum0 += weight;
+                            sum1 += weight * m1 / z;
+                            sum2 += weight * m2 / z;
+                        }
+                    }
+                }
+
+                /* Accumulate result. */
+                accum = logaddexp(accum, result);
+            }
+        }
+    }
+
+    if (moments_table)
+    {
+        if (sum0 > 0)
+        {
+            const double mean = sum1 / sum0;
+            *distmean = params->distance_scale * mean;
+            *diststd = params->distance_scale * sqrt(GSL_MAX_DBL(sum2 / sum0 - gsl_pow_2(mean), 0));
+        } else {
+            *distmean = *diststd = NAN;
+        }
+    }
+
+    *log_amplitude = accum;
+    return GSL_SUCCESS;
+}
+
+
+/*
+ * Split-resolution evaluation of the amplitude term.
+ *
+ * The amplitude term depends on the sky position only through the antenna
+ * patterns, which vary over tens of degrees, whereas the TDOA term varies on
+ * much finer scales. So instead of integrating over the amplitude parameters
+ * at every pixel in the support, we can integrate at the pixels of a coarser
+ * grid and interpolate bilinearly. The coarse resolution is the coarsest one
+ * at which the interpolated log amplitude agrees with the exact value to
+ * within a tolerance at a sample of pixels that is spread over the support.
+ */
+
+
+/* Coarsest resolution that is considered. */
+static const long amplitude_split_min_nside = 16;
+
+/* Largest base-2 logarithm of the ratio of the fine to the coarse nside that
+ * is considered. */
+static const int amplitude_split_max_order = 3;
+
+/* Number of pixels at which the interpolation is checked. */
+static const long amplitude_split_ncheck = 64;
+
+
+/* Geometry of one isolatitude ring of a HEALPix grid. */
+typedef struct {
+    long startpix; /* RING index of the first pixel in the ring. */
+    long ringpix; /* Number of pixels in the ring. */
+    double theta; /* Colatitude of the ring. */
+    int shifted; /* Nonzero if the first pixel is half a pixel east of phi=0. */
+} healpix_ring;
+
+
+/* Look up the geometry of ring number iring, where 1 <= iring < 4 * nside. */
+static void healpix_ring_info(long nside, long iring, healpix_ring *ring)
+{
+    const long npix = nside2npix(nside);
+    const long northring = (iring > 2 * nside) ? 4 * nside - iring : iring;
+
+    if (northring < nside)
+    {
+        /* Polar cap */
+        const double tmp = gsl_pow_2(northring) * 4. / npix;
+        ring->theta = atan2(sqrt(tmp * (2 - tmp)), 1 - tmp);
+        ring->ringpix = 4 * northring;
+        ring->shifted = 1;
+        ring->startpix = 2 * northring * (northring - 1);
+    } else {
+        /* Equatorial belt */
+        ring->theta = acos((2 * nside - northring) * 2. / (3 * nside));
+        ring->ringpix = 4 * nside;
+        ring->shifted = ((northring - nside) & 1) == 0;
+        ring->startpix = 2 * nside * (nside - 1) + (northring - nside) * ring->ringpix;
+    }
+
+    /* Reflect into the southern hemisphere. */
+    if (northring != iring)
+    {
+        ring->theta = M_PI - ring->theta;
+        ring->startpix = npix - ring->startpix - ring->ringpix;
+    }
+}
+
+
+/* Return the number of the last ring that lies north of z = cos(theta), or 0
+ * if there is none. */
+static long healpix_ring_above(long nside, double z)
+{
+    const double az = fabs(z);
+    long iring;
+
+    if (az <= 2. / 3)
+        return (long) (nside * (2 - 1.5 * z));
+    iring = (long) (nside * sqrt(3 * (1 - az)));
+    return (z > 0) ? iring : 4 * nside - iring - 1;
+}
+
+
+/* Find the two pixels of a ring that bracket longitude phi, and their
+ * weights for linear interpolation in longitude. */
+static void healpix_ring_bracket(
+    const healpix_ring *ring, double phi, long *pix, double *wgt)
+{
+    const double dphi = 2 * M_PI / ring->ringpix;
+    const double tmp = phi / dphi - 0.5 * ring->shifted;
+    long i1 = (long) floor(tmp);
+    long i2 = i1 + 1;
+    const double w1 = (phi - (i1 + 0.5 * ring->shifted) * dphi) / dphi;
+
+    if (i1 < 0)
+        i1 += ring->ringpix;
+    if (i2 >= ring->ringpix)
+        i2 -= ring->ringpix;
+    pix[0] = ring->startpix + i1;
+    pix[1] = ring->startpix + i2;
+    wgt[0] = 1 - w1;
+    wgt[1] = w1;
+}
+
+
+/* Find the four RING pixels and weights for bilinear interpolation of a
+ * HEALPix map at (theta, phi), with phi in [0, 2 pi). This is the same
+ * scheme as healpy.get_interp_weights. */
+static void healpix_interp_weights(
+    long nside, double theta, double phi, long *pix, double *wgt)
+{
+    const long npix = nside2npix(nside);
+    const long ir1 = healpix_ring_above(nside, cos(theta));
+    const long ir2 = ir1 + 1;
+    healpix_ring ring1, ring2;
+    double wtheta, fac;
+    int i;
+
+    if (ir1 > 0)
+    {
+        healpix_ring_info(nside, ir1, &ring1);
+        healpix_ring_bracket(&ring1, phi, &pix[0], &wgt[0]);
+    }
+    if (ir2 < 4 * nside)
+    {
+        healpix_ring_info(nside, ir2, &ring2);
+        healpix_ring_bracket(&ring2, phi, &pix[2], &wgt[2]);
+    }
+
+    if (ir1 == 0)
+    {
+        /* North of the first ring: blend with the four polar pixels. */
+        wtheta = theta / ring2.theta;
+        fac = 0.25 * (1 - wtheta);
+        for (i = 2; i < 4; i ++)
+            wgt[i] = wgt[i] * wtheta + fac;
+        wgt[0] = wgt[1] = fac;
+        pix[0] = (pix[2] + 2) & 3;
+        pix[1] = (pix[3] + 2) & 3;
+    } else if (ir2 == 4 * nside) {
+        /* South of the last ring: blend with the four polar pixels. */
+        wtheta = (theta - ring1.theta) / (M_PI - ring1.theta);
+        fac = 0.25 * wtheta;
+        for (i = 0; i < 2; i ++)
+            wgt[i] = wgt[i] * (1 - wtheta) + fac;
+        wgt[2] = wgt[3] = fac;
+        pix[2] = ((pix[0] + 2) & 3) + npix - 4;
+        pix[3] = ((pix[1] + 2) & 3) + npix - 4;
+    } else {
+        wtheta = (theta - ring1.theta) / (ring2.theta - ring1.theta);
+        wgt[0] *= 1 - wtheta;
+        wgt[1] *= 1 - wtheta;
+        wgt[2] *= wtheta;
+        wgt[3] *= wtheta;
+    }
+}
+
+
+/* Interpolate a coarse RING map at the center of a fine RING pixel. */
+static double healpix_interp(
+    long nside_coarse, const double *coarse, long nside, long ipix)
+{
+    double theta, phi, wgt[4], result = 0;
+    long pix[4];
+    int i;
+
+    pix2ang_ring(nside, ipix, &theta, &phi);
+    healpix_interp_weights(nside_coarse, theta, phi, pix, wgt);
+    for (i = 0; i < 4; i ++)
+        result += wgt[i] * coarse[pix[i]];
+    return result;
+}
+
+
+/* Evaluate the log amplitude term at a list of RING pixels in parallel.
+ * Returns a GSL error code. The caller must turn off the GSL error handler. */
+static int amplitude_log_likelihood_pixels(
+    double *log_amplitude, /* Output: log amplitude at each pixel. */
+    const amplitude_params *params,
+    long nside, /* Input: HEALPix lateral resolution. */
+    long n, /* Input: number of pixels. */
+    const long *ipix) /* Input: RING indices of pixels. */
+{
+    long i;
+    int status = GSL_SUCCESS;
+
+    #pragma omp parallel for
+    for (i = 0; i < n; i ++)
+    {
+        int ret = GSL_ENOMEM;
+        gsl_integration_workspace *workspace = gsl_integration_workspace_alloc(amplitude_subdivision_limit);
+        if (workspace)
+        {
+            ret = amplitude_log_likelihood(&log_amplitude[i], NULL, NULL,
+                params, nside, ipix[i], workspace);
+            gsl_integration_workspace_free(workspace);
+        }
+        if (ret != GSL_SUCCESS)
+        {
+            #pragma omp critical
+            status = ret;
+        }
+    }
+
+    return status;
+}
+
+
+/* Fill in the log amplitude term of the pixels in the support by
+ * interpolation from the coarsest grid that meets the tolerance. Pixels that
+ * were evaluated exactly along the way are filled in too. If no grid is
+ * coarse enough to save work while meeting the tolerance, then the remaining
+ * pixels are left as NaN for the caller to evaluate. Returns a GSL error
+ * code. */
+static int amplitude_split(
+    double *known, /* In/out: log amplitude by RING index, or NaN if unknown. */
+    const amplitude_params *params,
+    long nside, /* Input: HEALPix lateral resolution. */
+    const gsl_permutation *pix_perm, /* Input: pixels, support first. */
+    long maxpix, /* Input: number of pixels in the support. */
+    double tolerance) /* Input: largest acceptable error in log amplitude. */
+{
+    const long ncheck = GSL_MIN(maxpix, amplitude_split_ncheck);
+    long *check_ipix = NULL, *coarse_ipix = NULL;
+    double *check_exact = NULL, *coarse = NULL, *coarse_values = NULL;
+    gsl_error_handler_t *old_handler;
+    int status = GSL_SUCCESS;
+    int order;
+    long i;
+
+    if (ncheck == 0)
+        return GSL_SUCCESS;
+
+    old_handler = gsl_set_error_handler_off();
+
+    /* Evaluate the amplitude term exactly at a sample of pixels that is
+     * spread over the support. */
+    check_ipix = malloc(ncheck * sizeof(long));
+    check_exact = malloc(ncheck * sizeof(double));
+    if (!check_ipix || !check_exact)
+    {
+        status = GSL_ENOMEM;
+        goto done;
+    }
+    for (i = 0; i < ncheck; i ++)
+        check_ipix[i] = gsl_permutation_get(pix_perm, i * (maxpix / ncheck));
+    status = amplitude_log_likelihood_pixels(check_exact, params, nside,
+        ncheck, check_ipix);
+    if (status != GSL_SUCCESS)
+        goto done;
+    for (i = 0; i < ncheck; i ++)
+        known[check_ipix[i]] = check_exact[i];
+
+    /* Try each coarse resolution, coarsest first. */
+    for (order = amplitude_split_max_order; order > 0; order --)
+    {
+        const long nside_coarse = nside >> order;
+        long npix_coarse, ncoarse = 0;
+        double max_error = 0;
+
+        if (nside_coarse < amplitude_split_min_nside)
+            continue;
+        npix_coarse = nside2npix(nside_coarse);
+
+        /* Find the coarse pixels that are needed to interpolate to the
+         * support. */
+        coarse = calloc(npix_coarse, sizeof(double));
+        coarse_ipix = malloc(npix_coarse * sizeof(long));
+        if (!coarse || !coarse_ipix)
+        {
+            status = GSL_ENOMEM;
+            goto done;
+        }
+        for (i = 0; i < maxpix; i ++)
+        {
+            double theta, phi, wgt[4];
+            long pix[4];
+            int j;
+            pix2ang_ring(nside, gsl_permutation_get(pix_perm, i), &theta, &phi);
+            healpix_interp_weights(nside_coarse, theta, phi, pix, wgt);
+            for (j = 0; j < 4; j ++)
+                coarse[pix[j]] = 1;
+        }
+        for (i = 0; i < npix_coarse; i ++)
+            if (coarse[i])
+                coarse_ipix[ncoarse ++] = i;
+
+        /* If the coarse grid would not cut the work by a good margin, then
+         * neither would any finer one. */
+        if (ncoarse + ncheck > maxpix / 4)
+            break;
+
+        /* Evaluate the amplitude term on the coarse grid. */
+        coarse_values = malloc(ncoarse * sizeof(double));
+        if (!coarse_values)
+        {
+            status = GSL_ENOMEM;
+            goto done;
+        }
+        status = amplitude_log_likelihood_pixels(coarse_values, params,
+            nside_coarse, ncoarse, coarse_ipix);
+        if (status != GSL_SUCCESS)
+            goto done;
+        for (i = 0; i < ncoarse; i ++)
+            coarse[coarse_ipix[i]] = coarse_values[i];
+
+        /* Estimate the error of interpolation from the sample. */
+        for (i = 0; i < ncheck; i ++)
+        {
+            const double error = fabs(healpix_interp(nside_coarse, coarse,
+                nside, check_ipix[i]) - check_exact[i]);
+            if (!(error <= max_error))
+                max_error = error;
+        }
+
+        if (max_error <= tolerance)
+        {
+            for (i = 0; i < maxpix; i ++)
+            {
+                const long ipix = gsl_permutation_get(pix_perm, i);
+                if (isnan(known[ipix]))
+                    known[ipix] = healpix_interp(nside_coarse, coarse, nside, ipix);
+            }
+            goto done;
+        }
+
+        free(coarse);
+        free(coarse_ipix);
+        free(coarse_values);
+        coarse = coarse_values = NULL;
+        coarse_ipix = NULL;
+    }
+
+done:
+    gsl_set_error_handler(old_handler);
+    free(check_ipix);
+    free(check_exact);
+    free(coarse);
+    free(coarse_ipix);
+    free(coarse_values);
+    return status;
+}
+
+
+#ifndef BAYESTAR_ISA
+const char *bayestar_isa(void)
+{
+    return "none";
+}
+#endif
+
+
+double *bayestar_sky_map_tdoa_snr(
+    long *npix, /* Input: number of HEALPix pixels. */
+    double gmst, /* Greenwich mean sidereal time in radians. */
+    int nifos, /* Input: number of detectors. */
+    /* FIXME: make const; change XLALComputeDetAMResponse prototype */
+    /* const */ float **responses, /* Pointers to detector responses. */
+    const double **locations, /* Pointers to locations of detectors in Cartesian geographic coordinates. */
+    const double *toas, /* Input: array of times of arrival with arbitrary relative offset. (Make toas[0] == 0.) */
+    const double *snrs, /* Input: array of SNRs. */
+    const double *s2_toas, /* Measurement variance of TOAs. */
+    const double *horizons, /* Distances at which a source would produce an SNR of 1 in each detector. */
+    double min_distance,
+    double max_distance,
+    bayestar_prior_t prior,
+    const bayestar_quadrature_t *quadrature,
+    const bayestar_warm_start_t *warm_in,
+    bayestar_warm_start_t *warm_out,
+    double **distmean_out,
+    double **diststd_out)
+{
+    long nside;
+    long maxpix;
+    long i;
+    double d1[nifos];
+    double *P;
+    gsl_permutation *pix_perm;
+    amplitude_params params;
+
+    /* Posterior mean and standard deviation of distance, if requested. */
+    double *distmean = NULL, *diststd = NULL;
+    gsl_integration_glfixed_table *moments_table = NULL;
+
+    /* Amplitude terms that are already known, from the previous run or from
+     * the coarse grid, indexed by pixel; NaN where they still have to be
+     * computed. */
+    double *cached_amplitude = NULL;
+
+    /* Amplitude terms from this run, in the order of pix_perm. */
+    double *amplitude = NULL;
+
+    /* Antenna factors of each detector at every pixel, if they are carried
+     * from run to run, and those of them that were computed in this run. */
+    const double *antenna[nifos];
+    double *new_antenna[nifos];
+
+    /* Will point to memory for storing GSL return values for each thread. */
+    int *gsl_errnos;
+
+    /* Storage for old GSL error handler. */
+    gsl_error_handler_t *old_handler;
+
+    if (amplitude_params_init(&params, d1, gmst, nifos, responses, snrs,
+        horizons, min_distance, max_distance, prior, quadrature) != GSL_SUCCESS)
+        return NULL;
+
+    /* Evaluate posterior term only first. */
+    P = bayestar_sky_map_tdoa_adapt_resolution(&pix_perm, &maxpix, npix,
+        warm_in ? warm_in->npix : 0, gmst, nifos, locations, toas, s2_toas);
+    if (!P)
+        return NULL;
+
+    /* Determine the lateral HEALPix resolution. */
+    nside = npix2nside(*npix);
+
+    /* Zero pixels that didn't meet the TDOA cut. */
+    for (i = 0; i < maxpix; i ++)
+    {
+        long ipix = gsl_permutation_get(pix_perm, i);
+        P[ipix] = log(P[ipix]);
+    }
+    for (; i < *npix; i ++)
+    {
+        long ipix = gsl_permutation_get(pix_perm, i);
         P[ipix] = -INFINITY;
     }
 
@@ -426,6 +1533,128 @@ double *bayestar_sky_map_tdoa_snr(
         GSL_ERROR_NULL("failed to allocate space for pixel error status", GSL_ENOMEM);
     }
 
+    /* If the amplitude terms of the previous run are still valid and the same
+     * resolution was selected, then unpack them so that only the pixels that
+     * have newly passed the TDOA cut have to be integrated. The distance
+     * moments are not saved, so they need every pixel to be integrated. */
+    if (warm_in && warm_in->amplitude && warm_in->npix == *npix && !distmean_out)
+    {
+        cached_amplitude = malloc(*npix * sizeof(double));
+        if (!cached_amplitude)
+        {
+            free(gsl_errnos);
+            free(P);
+            gsl_permutation_free(pix_perm);
+            GSL_ERROR_NULL("failed to allocate space for warm-start state", GSL_ENOMEM);
+        }
+        for (i = 0; i < *npix; i ++)
+            cached_amplitude[i] = NAN;
+        for (i = 0; i < warm_in->nsupport; i ++)
+        {
+            long ipix = warm_in->support[i];
+            if (ipix >= 0 && ipix < *npix)
+                cached_amplitude[ipix] = warm_in->amplitude[i];
+        }
+    }
+
+    if (warm_out)
+    {
+        amplitude = malloc(maxpix * sizeof(double));
+        if (!amplitude)
+        {
+            free(cached_amplitude);
+            free(gsl_errnos);
+            free(P);
+            gsl_permutation_free(pix_perm);
+            GSL_ERROR_NULL("failed to allocate space for warm-start state", GSL_ENOMEM);
+        }
+    }
+
+    if (distmean_out)
+    {
+        distmean = malloc(*npix * sizeof(double));
+        diststd = malloc(*npix * sizeof(double));
+        moments_table = gsl_integration_glfixed_table_alloc(amplitude_moments_nodes);
+        if (!distmean || !diststd || !moments_table)
+        {
+            free(distmean);
+            free(diststd);
+            if (moments_table)
+                gsl_integration_glfixed_table_free(moments_table);
+            free(amplitude);
+            free(cached_amplitude);
+            free(gsl_errnos);
+            free(P);
+            gsl_permutation_free(pix_perm);
+            GSL_ERROR_NULL("failed to allocate space for distance moments", GSL_ENOMEM);
+        }
+        for (i = 0; i < *npix; i ++)
+            distmean[i] = diststd[i] = NAN;
+        params.moments_table = moments_table;
+    }
+
+    /* Optionally find the amplitude terms from a coarser grid. Distance
+     * moments and warm starts need the amplitude terms at every pixel, so
+     * this is skipped for them. */
+    if (params.split_tolerance > 0 && !cached_amplitude && !distmean_out)
+    {
+        int status;
+
+        cached_amplitude = malloc(*npix * sizeof(double));
+        if (!cached_amplitude)
+        {
+            free(amplitude);
+            free(gsl_errnos);
+            free(P);
+            gsl_permutation_free(pix_perm);
+            GSL_ERROR_NULL("failed to allocate space for amplitude terms", GSL_ENOMEM);
+        }
+        for (i = 0; i < *npix; i ++)
+            cached_amplitude[i] = NAN;
+
+        status = amplitude_split(cached_amplitude, &params, nside, pix_perm,
+            maxpix, params.split_tolerance);
+        if (status != GSL_SUCCESS)
+        {
+            free(cached_amplitude);
+            free(amplitude);
+            free(gsl_errnos);
+            free(P);
+            gsl_permutation_free(pix_perm);
+            GSL_ERROR_NULL(gsl_strerror(status), status);
+        }
+    }
+
+    /* Tabulate the antenna factors of each detector if they are carried from
+     * run to run, reusing those from the previous run where it gave them at
+     * this resolution. */
+    for (i = 0; i < nifos; i ++)
+        new_antenna[i] = NULL;
+    if (warm_out || (warm_in && warm_in->antenna && warm_in->npix == *npix))
+    {
+        for (i = 0; i < nifos; i ++)
+        {
+            if (warm_in && warm_in->antenna && warm_in->antenna[i] && warm_in->npix == *npix)
+                antenna[i] = warm_in->antenna[i];
+            else if (!(antenna[i] = new_antenna[i] = antenna_factors(nside, responses[i], gmst)))
+            {
+                antenna_factors_free(nifos, new_antenna);
+                free(distmean);
+                free(diststd);
+                if (moments_table)
+                    gsl_integration_glfixed_table_free(moments_table);
+                free(cached_amplitude);
+                free(amplitude);
+                free(gsl_errnos);
+                free(P);
+                gsl_permutation_free(pix_perm);
+                return NULL;
+            }
+        }
+        params.antenna = antenna;
+        params.antenna_nside = nside;
+    }
+
     /* Turn off error handler while in parallel section to avoid concurrent
      * calls to the GSL error handler, which if provided by the user may not
      * be threadsafe. */
@@ -436,13 +1665,21 @@ double *bayestar_sky_map_tdoa_snr(
     for (i = 0; i < maxpix; i ++)
     {
         long ipix = gsl_permutation_get(pix_perm, i);
-        double F[nifos][2];
-        double theta, phi;
-        int itwopsi, iu, iifo;
         double accum = -INFINITY;
+        gsl_integration_workspace *workspace;
+
+        /* Reuse the amplitude term if it is already known. */
+        if (cached_amplitude && !isnan(cached_amplitude[ipix]))
+        {
+            accum = cached_amplitude[ipix];
+            if (amplitude)
+                amplitude[i] = accum;
+            P[ipix] += accum;
+            continue;
+        }
 
         /* Prepare workspace for adaptive integrator. */
-        gsl_integration_workspace *workspace = gsl_integration_workspace_alloc(subdivision_limit);
+        workspace = gsl_integration_workspace_alloc(amplitude_subdivision_limit);
 
         /* If the workspace could not be allocated, then record the GSL
          * error value for later reporting when we leave the parallel
@@ -453,116 +1690,19 @@ double *bayestar_sky_map_tdoa_snr(
             continue;
         }
 
-        /* Look up polar coordinates of this pixel */
-        pix2ang_ring(nside, ipix, &theta, &phi);
-
-        /* Look up antenna factors */
-        for (iifo = 0; iifo < nifos; iifo ++)
-        {
-            XLALComputeDetAMResponse(&F[iifo][0], &F[iifo][1], (float (*)[3])responses[iifo], phi, M_PI_2 - theta, 0, gmst);
-            F[iifo][0] *= d1[iifo];
-            F[iifo][1] *= d1[iifo];
-        }
-
-        /* Integrate over 2*psi */
-        for (itwopsi = 0; itwopsi < ntwopsi; itwopsi++)
-        {
-            const double twopsi = (2 * M_PI / ntwopsi) * itwopsi;
-            const double costwopsi = cos(twopsi);
-            const double sintwopsi = sin(twopsi);
-
-            /* Integrate over u; since integrand only depends on u^2 we only
-             * have to go from u=0 to u=1. We want to include u=1, so the upper
-             * limit has to be <= */
-            for (iu = 0; iu <= nu; iu++)
-            {
-                const double u = (double)iu / nu;
-                const double u2 = gsl_pow_2(u);
-                const double u4 = gsl_pow_2(u2);
-
-                double A = 0, B = 0;
-                double breakpoints[5];
-                int num_breakpoints = 0;
-
-                /* The log-likelihood is quadratic in the estimated and true
-                 * values of the SNR, and in 1/r. It is of the form A/r^2 + B/r,
-                 * where A depends only on the true values of the SNR and is
-                 * strictly negative and B depends on both the true values and
-                 * the estimates and is strictly positive.
-                 *
-                 * The middle breakpoint is at the maximum of the log-likelihood,
-                 * occurring at 1/r=-B/2A. The lower and upper breakpoints occur
-                 * when the likelihood becomes eta times its maximum value. This
-                 * occurs when
-                 *
-                 *   A/r^2 + B/r = log(eta) - B^2/4A.
-                 *
-                 */
-
-                /* Loop over detectors */
-                for (iifo = 0; iifo < nifos; iifo++)
-                {
-                    const double Fp = F[iifo][0]; /* `plus' antenna factor times r */
-                    const double Fx = F[iifo][1]; /* `cross' antenna factor times r */
-                    const double FpFp = gsl_pow_2(Fp);
-                    const double FxFx = gsl_pow_2(Fx);
-                    const double FpFx = Fp * Fx;
-                    const double rhotimesr2 = 0.125 * ((FpFp + FxFx) * (1 + 6*u2 + u4) + gsl_pow_2(1 - u2) * ((FpFp - FxFx) * costwopsi + 2 * FpFx * sintwopsi));
-                    const double rhotimesr = sqrt(rhotimesr2);
-
-                    /* FIXME: due to roundoff, rhotimesr2 can be very small and
-                     * negative rather than simply zero. If this happens, don't
-                     accumulate the log-likelihood terms for this detector. */
-                    if (rhotimesr2 > 0)
-                    {
-                        A += rhotimesr2;
-                        B += rhotimesr * snrs[iifo];
-                    }
-                }
-                A *= -0.5;
+        /* If the integrator fails, then record the GSL error value for
+         * later reporting when we leave the parallel section. */
+        gsl_errnos[i] = amplitude_log_likelihood(&accum,
+            distmean ? &distmean[ipix] : NULL,
+            diststd ? &diststd[ipix] : NULL,
+            &params, nside, ipix, workspace);
 
-                {
-                    const double middle_breakpoint = -2 * A / B;
-                    const double lower_breakpoint = 1 / (1 / middle_breakpoint + sqrt(log(eta) / A));
-                    const double upper_breakpoint = 1 / (1 / middle_breakpoint - sqrt(log(eta) / A));
-                    breakpoints[num_breakpoints++] = min_distance;
-                    if(lower_breakpoint > breakpoints[num_breakpoints-1] && lower_breakpoint < max_distance)
-                        breakpoints[num_breakpoints++] = lower_breakpoint;
-                    if(middle_breakpoint > breakpoints[num_breakpoints-1] && middle_breakpoint < max_distance)
-                        breakpoints[num_breakpoints++] = middle_breakpoint;
-                    if(upper_breakpoint > breakpoints[num_breakpoints-1] && upper_breakpoint < max_distance)
-                        breakpoints[num_breakpoints++] = upper_breakpoint;
-                    breakpoints[num_breakpoints++] = max_distance;
-                }
-
-                {
-                    /* Perform adaptive integration. Stop when a relative
-                     * accuracy of 0.05 has been reached. */
-                    inner_integrand_params integrand_params = {A, B, -0.25 * gsl_pow_2(B) / A};
-                    const gsl_function func = {radial_integrand, &integrand_params};
-                    double result, abserr;
-                    int ret = gsl_integration_qagp(&func, &breakpoints[0], num_breakpoints, DBL_MIN, 0.05, subdivision_limit, workspace, &result, &abserr);
-
-                    /* If the integrator failed, then record the GSL error
-                     * value for later reporting when we leave the parallel
-                     * section. Then, break out of the inner loop. */
-                    if (ret != GSL_SUCCESS)
-                    {
-                        gsl_errnos[i] = ret;
-                        break;
-                    }
-
-                    /* Take the logarithm and put the log-normalization back in. */
-                    result = log(result) + integrand_params.log_offset;
-
-                    /* Accumulate result. */
-                    accum = logaddexp(accum, result);
-                }
-            }
-        }
         /* Discard workspace for adaptive integrator. */
         gsl_integration_workspace_free(workspace);
 
+        if (amplitude)
+            amplitude[i] = accum;
+
         /* Accumulate (log) posterior terms for SNR and TDOA. */
         P[ipix] += accum;
     }
@@ -570,8 +1710,12 @@ double *bayestar_sky_map_tdoa_snr(
     /* Restore old error handler. */
     gsl_set_error_handler(old_handler);
 
-    /* Free permutation. */
-    gsl_permutation_free(pix_perm);
+    /* Discard the known amplitude terms. */
+    free(cached_amplitude);
+
+    /* Discard the quadrature rule for the distance moments. */
+    if (moments_table)
+        gsl_integration_glfixed_table_free(moments_table);
 
     /* Check if there was an error in any thread evaluating any pixel. If there
      * was, raise the error and return. */
@@ -580,8 +1724,13 @@ double *bayestar_sky_map_tdoa_snr(
         int gsl_errno = gsl_errnos[i];
         if (gsl_errno != GSL_SUCCESS)
         {
+            antenna_factors_free(nifos, new_antenna);
+            free(distmean);
+            free(diststd);
+            free(amplitude);
             free(gsl_errnos);
             free(P);
+            gsl_permutation_free(pix_perm);
             GSL_ERROR_NULL(gsl_strerror(gsl_errno), gsl_errno);
         }
     }
@@ -589,15 +1738,346 @@ double *bayestar_sky_map_tdoa_snr(
     /* Discard array of GSL error values. */
     free(gsl_errnos);
 
-    /* Exponentiate and normalize posterior. */
-    pix_perm = get_pixel_ranks(*npix, P);
-    if (!pix_perm)
+    /* Record the state of this run. The support is saved in the order of the
+     * TDOA ranking, before it is re-ranked below. */
+    if (warm_out)
     {
+        long *support = malloc(maxpix * sizeof(long));
+        double **antenna_out = malloc(nifos * sizeof(double *));
+        if (!support || !antenna_out)
+        {
+            free(support);
+            free(antenna_out);
+            antenna_factors_free(nifos, new_antenna);
+            free(distmean);
+            free(diststd);
+            free(amplitude);
+            free(P);
+            gsl_permutation_free(pix_perm);
+            GSL_ERROR_NULL("failed to allocate space for warm-start state", GSL_ENOMEM);
+        }
+        for (i = 0; i < maxpix; i ++)
+            support[i] = gsl_permutation_get(pix_perm, i);
+        for (i = 0; i < nifos; i ++)
+            antenna_out[i] = new_antenna[i];
+        warm_out->npix = *npix;
+        warm_out->nsupport = maxpix;
+        warm_out->support = support;
+        warm_out->amplitude = amplitude;
+        warm_out->antenna = antenna_out;
+    } else {
+        antenna_factors_free(nifos, new_antenna);
+    }
+
+    /* Exponentiate and normalize posterior. Only the pixels that met the TDOA
+     * cut can be nonzero, so we only have to re-rank those. */
+    if (sort_pixel_ranks_head(pix_perm, maxpix, P) != GSL_SUCCESS)
+    {
+        free(distmean);
+        free(diststd);
         free(P);
+        gsl_permutation_free(pix_perm);
         return NULL;
     }
     exp_normalize(*npix, P, pix_perm);
     gsl_permutation_free(pix_perm);
 
+    if (distmean_out)
+    {
+        *distmean_out = distmean;
+        *diststd_out = diststd;
+    }
+
     return P;
 }
+
+
+/*
+ * Tiled evaluation at very high resolution.
+ *
+ * At nside of several thousand, a dense sky map and a permutation of all of
+ * its pixels take several GB. Instead, we evaluate the TDOA likelihood one
+ * tile (a NESTED subtree) at a time, keep a running normalization, and keep
+ * only the most probable pixels in a bounded min-heap. Once the whole sky
+ * has been seen, the heap holds the TDOA credible region, and only those
+ * pixels get the amplitude integral.
+ */
+
+
+/* One pixel of a sparse sky map. */
+typedef struct {
+    double value;
+    uint32_t ipix;
+} sparse_pixel;
+
+
+/* Bytes of the memory budget that are spent on each pixel in the support:
+ * the heap entry, then the per-pixel error status and the two output
+ * arrays. */
+static const size_t tiled_bytes_per_support_pixel =
+    sizeof(sparse_pixel) + sizeof(int) + sizeof(uint32_t) + sizeof(double);
+
+
+static int sparse_pixel_compare_value_descending(const void *a, const void *b)
+{
+    const double x = ((const sparse_pixel *) a)->value;
+    const double y = ((const sparse_pixel *) b)->value;
+    return (x < y) - (x > y);
+}
+
+
+static int sparse_pixel_compare_ipix(const void *a, const void *b)
+{
+    const uint32_t x = ((const sparse_pixel *) a)->ipix;
+    const uint32_t y = ((const sparse_pixel *) b)->ipix;
+    return (x > y) - (x < y);
+}
+
+
+/* Offer a pixel to a min-heap of at most capacity pixels, which then keeps
+ * the capacity most probable pixels that it has been offered. */
+static void sparse_heap_push(
+    sparse_pixel *heap, long *nheap, long capacity, double value, uint32_t ipix)
+{
+    long i;
+
+    if (*nheap < capacity)
+    {
+        /* Sift up. */
+        for (i = (*nheap) ++; i > 0 && heap[(i - 1) / 2].value > value; i = (i - 1) / 2)
+            heap[i] = heap[(i - 1) / 2];
+    } else if (value > heap[0].value) {
+        /* Replace the least probable pixel and sift down. */
+        i = 0;
+        for (;;)
+        {
+            long child = 2 * i + 1;
+            if (child >= *nheap)
+                break;
+            if (child + 1 < *nheap && heap[child + 1].value < heap[child].value)
+                child ++;
+            if (heap[child].value >= value)
+                break;
+            heap[i] = heap[child];
+            i = child;
+        }
+    } else {
+        return;
+    }
+
+    heap[i].value = value;
+    heap[i].ipix = ipix;
+}
+
+
+#define TILED_ERROR(reason, gsl_errno) do { \
+    gsl_error(reason, __FILE__, __LINE__, gsl_errno); \
+    status = gsl_errno; \
+    goto done; \
+} while (0)
+
+
+int bayestar_sky_map_tdoa_snr_tiled(
+    long nside,
+    size_t max_bytes,
+    uint32_t **ipix,
+    double **P,
+    long *n,
+    double gmst,
+    int nifos,
+    float **responses,
+    const double **locations,
+    const double *toas,
+    const double *snrs,
+    const double *s2_toas,
+    const double *horizons,
+    double min_distance,
+    double max_distance,
+    bayestar_prior_t prior,
+    const bayestar_quadrature_t *quadrature)
+{
+    int status = GSL_SUCCESS;
+    long npix, order, depth, tile_npix, ntiles, itile, capacity, nheap, maxpix, i;
+    double t[nifos], w[nifos], d1[nifos];
+    double log_norm, max_log_p, accum;
+    tdoa_ring rings[nifos * (nifos - 1) / 2 + 1];
+    int nrings = 0, use_rings;
+    amplitude_params params;
+    gsl_error_handler_t *old_handler;
+    sparse_pixel *heap = NULL;
+    double *tile = NULL;
+    int *gsl_errnos = NULL;
+    uint32_t *out_ipix = NULL;
+    double *out_P = NULL;
+
+    *ipix = NULL;
+    *P = NULL;
+    *n = 0;
+
+    status = amplitude_params_init(&params, d1, gmst, nifos, responses, snrs,
+        horizons, min_distance, max_distance, prior, quadrature);
+    if (status != GSL_SUCCESS)
+        return status;
+
+    npix = nside2npix(nside);
+    if (npix < 0)
+        GSL_ERROR("nside must be a power of 2", GSL_EINVAL);
+    if ((unsigned long) (npix - 1) > UINT32_MAX)
+        GSL_ERROR("nside is too large for 32-bit pixel indices", GSL_EINVAL);
+    for (order = 0; (1L << order) < nside; order ++)
+        ; /* loop body intentionally empty */
+
+    /* Split the budget between the heap and one tile of log likelihoods.
+     * Tiles are the largest NESTED subtrees that fit in half of the budget. */
+    capacity = max_bytes / tiled_bytes_per_support_pixel;
+    for (depth = order; depth > 0 && (sizeof(double) << (2 * depth)) > max_bytes / 2; depth --)
+        ; /* loop body intentionally empty */
+    tile_npix = 1L << (2 * depth);
+    ntiles = npix / tile_npix;
+    if (capacity < 1 || tile_npix * sizeof(double) > max_bytes / 2)
+        GSL_ERROR("memory budget is too small", BAYESTAR_EBUDGET);
+
+    /* Take reciprocal of measurement variances to get sum-of-squares weights,
+     * and subtract off zeroth TOA, as in
+     * bayestar_sky_map_tdoa_not_normalized_log. */
+    for (i = 0; i < nifos; i ++)
+    {
+        w[i] = 1 / s2_toas[i];
+        t[i] = toas[i] - toas[0];
+    }
+
+    /* With three or more detectors, skip tiles that miss any of the
+     * time-delay rings. */
+    if (nifos >= 3)
+    {
+        const double nsigma = sqrt(2 * (log(npix) + tdoa_ring_log_tolerance));
+        nrings = tdoa_rings_init(rings, nsigma, gmst, nifos, locations, t, s2_toas);
+    }
+
+    heap = malloc(capacity * sizeof(sparse_pixel));
+    tile = malloc(tile_npix * sizeof(double));
+    if (!heap || !tile)
+        TILED_ERROR("failed to allocate workspace", GSL_ENOMEM);
+
+    /* Evaluate the TDOA likelihood tile by tile. If skipping tiles leaves
+     * nothing that is reasonably likely, then start over with every tile. */
+    for (use_rings = (nrings > 0); ; use_rings = 0)
+    {
+        nheap = 0;
+        log_norm = -INFINITY;
+        max_log_p = -INFINITY;
+
+        for (itile = 0; itile < ntiles; itile ++)
+        {
+            const long first = itile * tile_npix;
+            double tile_max = -INFINITY, tile_sum = 0;
+
+            if (use_rings && tdoa_rings_miss(nside >> depth, itile, nrings, rings))
+                continue;
+
+            #pragma omp parallel for
+            for (i = 0; i < tile_npix; i ++)
+            {
+                long ipix_ring;
+                nest2ring(nside, first + i, &ipix_ring);
+                tile[i] = tdoa_log_likelihood(nside, ipix_ring, gmst, nifos, locations, t, w);
+            }
+
+            for (i = 0; i < tile_npix; i ++)
+                if (tile[i] > tile_max)
+                    tile_max = tile[i];
+            for (i = 0; i < tile_npix; i ++)
+                tile_sum += exp(tile[i] - tile_max);
+            log_norm = logaddexp(log_norm, tile_max + log(tile_sum));
+            if (tile_max > max_log_p)
+                max_log_p = tile_max;
+
+            for (i = 0; i < tile_npix; i ++)
+                sparse_heap_push(heap, &nheap, capacity, tile[i], first + i);
+        }
+
+        if (!use_rings || max_log_p >= tdoa_ring_min_log_likelihood)
+            break;
+    }
+
+    free(tile);
+    tile = NULL;
+
+    /* Find the credible region among the pixels that we kept. If it is not
+     * complete and the heap is full, then pixels that belong in it may have
+     * been pushed out. */
+    qsort(heap, nheap, sizeof(sparse_pixel), sparse_pixel_compare_value_descending);
+    for (accum = 0, maxpix = 0; maxpix < nheap && accum <= autoresolution_confidence_level; maxpix ++)
+        accum += exp(heap[maxpix].value - log_norm);
+    if (accum <= autoresolution_confidence_level && nheap == capacity)
+        TILED_ERROR("credible region does not fit in memory budget", BAYESTAR_EBUDGET);
+
+    gsl_errnos = calloc(maxpix, sizeof(int));
+    if (!gsl_errnos)
+        TILED_ERROR("failed to allocate space for pixel error status", GSL_ENOMEM);
+
+    /* Turn off error handler while in parallel section to avoid concurrent
+     * calls to the GSL error handler, which if provided by the user may not
+     * be threadsafe. */
+    old_handler = gsl_set_error_handler_off();
+
+    /* Compute posterior factor for amplitude consistency. */
+    #pragma omp parallel for
+    for (i = 0; i < maxpix; i ++)
+    {
+        long ipix_ring;
+        double log_amplitude = -INFINITY;
+        gsl_integration_workspace *workspace = gsl_integration_workspace_alloc(amplitude_subdivision_limit);
+
+        if (!workspace)
+        {
+            gsl_errnos[i] = GSL_ENOMEM;
+            continue;
+        }
+
+        nest2ring(nside, heap[i].ipix, &ipix_ring);
+        gsl_errnos[i] = amplitude_log_likelihood(&log_amplitude, NULL, NULL, &params, nside, ipix_ring, workspace);
+        gsl_integration_workspace_free(workspace);
+        heap[i].value += log_amplitude;
+    }
+
+    /* Restore old error handler. */
+    gsl_set_error_handler(old_handler);
+
+    for (i = 0; i < maxpix; i ++)
+        if (gsl_errnos[i] != GSL_SUCCESS)
+            TILED_ERROR(gsl_strerror(gsl_errnos[i]), gsl_errnos[i]);
+
+    /* Exponentiate and normalize posterior. */
+    for (max_log_p = -INFINITY, i = 0; i < maxpix; i ++)
+        if (heap[i].value > max_log_p)
+            max_log_p = heap[i].value;
+    for (accum = 0, i = 0; i < maxpix; i ++)
+        accum += (heap[i].value = exp(heap[i].value - max_log_p));
+
+    /* Put the support in NESTED order and unpack it. */
+    qsort(heap, maxpix, sizeof(sparse_pixel), sparse_pixel_compare_ipix);
+    out_ipix = malloc(maxpix * sizeof(uint32_t));
+    out_P = malloc(maxpix * sizeof(double));
+    if (!out_ipix || !out_P)
+        TILED_ERROR("failed to allocate output arrays", GSL_ENOMEM);
+    for (i = 0; i < maxpix; i ++)
+    {
+        out_ipix[i] = heap[i].ipix;
+        out_P[i] = heap[i].value / accum;
+    }
+
+    *ipix = out_ipix;
+    *P = out_P;
+    *n = maxpix;
+    out_ipix = NULL;
+    out_P = NULL;
+
+done:
+    free(out_ipix);
+    free(out_P);
+    free(gsl_errnos);
+    free(tile);
+    free(heap);
+    return status;
+}
@@ -68,6 +68,9 @@
 #ifndef BAYESTAR_SKY_MAP_H
 #define BAYESTAR_SKY_MAP_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 
 typedef enum
 {
@@ -76,6 +79,42 @@ typedef enum
 } bayestar_prior_t;
 
 
+/* Accuracy settings for the integral over the amplitude parameters. Coarser
+ * settings trade accuracy for speed; see bayestar.regression for a harness
+ * that measures the trade. */
+typedef struct
+{
+    int ntwopsi; /* Number of integration steps in 2*psi. */
+    int nu; /* Number of integration steps in cos(inclination). */
+    double epsrel; /* Relative accuracy of the radial integral. */
+    double split_tolerance; /* If positive, evaluate the amplitude term on the coarsest grid from which it can be interpolated to within this error in its logarithm; if 0, evaluate it at every pixel. Ignored in tiled mode. */
+} bayestar_quadrature_t;
+
+/* The settings that are used if none are given. */
+extern const bayestar_quadrature_t bayestar_quadrature_default;
+
+
+/* State that is carried from one localization of an event to the next, so
+ * that a rerun with updated inputs can skip the work that it has in common
+ * with the previous run. The arrays are allocated with malloc() by
+ * bayestar_sky_map_tdoa_snr and must be released with free() by the caller.
+ *
+ * The antenna factors of a detector depend only on its orientation, on the
+ * GMST, and on the pixel grid, so they stay valid when the SNRs, horizon
+ * distances, or other detectors change. On input, antenna[i] holds the
+ * factors of detector i at resolution npix if they are known, or is NULL.
+ * On output, antenna[i] holds the factors of detector i if they were
+ * computed in this run, or is NULL if they were given on input. */
+typedef struct
+{
+    long npix; /* Resolution that was selected, or 0 if none. */
+    long nsupport; /* Number of pixels that passed the TDOA cut. */
+    long *support; /* RING indices of those pixels, most probable first. */
+    double *amplitude; /* Log amplitude term of each pixel in support, or NULL. */
+    double **antenna; /* For each detector, the plus and cross antenna factors at each of the npix pixels, interleaved; or NULL. */
+} bayestar_warm_start_t;
+
+
 /* Perform sky localization based on TDOAs alone. */
 double *bayestar_sky_map_tdoa(
     long *npix, /* In/out: number of HEALPix pixels. */
@@ -100,7 +139,58 @@ double *bayestar_sky_map_tdoa_snr(
     const double *horizons, /* Distances at which a source would produce an SNR of 1 in each detector. */
     double min_distance,
     double max_distance,
-    bayestar_prior_t prior
+    bayestar_prior_t prior,
+    const bayestar_quadrature_t *quadrature, /* Quadrature settings, or NULL for the default. */
+    const bayestar_warm_start_t *warm_in, /* State of a previous run, or NULL. */
+    bayestar_warm_start_t *warm_out, /* Output: state of this run, or NULL. */
+    double **distmean, /* Output: posterior mean distance of each pixel in Mpc, or NULL. */
+    double **diststd /* Output: posterior standard deviation of distance of each pixel in Mpc, or NULL. */
+);
+/* If distmean and diststd are not NULL, then the first and second moments of
+ * the distance are accumulated in the same pass as the amplitude integral.
+ * The arrays are allocated with malloc() and must be released with free() by
+ * the caller. Pixels that did not pass the TDOA cut are NaN. */
+
+/* Perform sky localization based on TDOAs and amplitude at a fixed and
+ * possibly very high resolution, without allocating any arrays of length
+ * npix. The sky is evaluated in tiles that are NESTED subtrees, and only the
+ * pixels that make up the TDOA credible region are kept, so the peak memory
+ * use is about max_bytes (plus a small integration workspace per thread) no
+ * matter what nside is. The result is a sparse sky map: the NESTED indices of
+ * the *n pixels in the support and their probabilities, in order of
+ * increasing pixel index. The arrays are allocated with malloc() and must be
+ * released with free() by the caller. Returns GSL_SUCCESS or a GSL error
+ * code; in particular, BAYESTAR_EBUDGET if max_bytes is too small for a tile
+ * or if the credible region does not fit in it. */
+int bayestar_sky_map_tdoa_snr_tiled(
+    long nside, /* Input: HEALPix lateral resolution. */
+    size_t max_bytes, /* Input: memory budget in bytes. */
+    uint32_t **ipix, /* Output: NESTED indices of pixels in the support. */
+    double **P, /* Output: probability of each pixel in the support. */
+    long *n, /* Output: number of pixels in the support. */
+    double gmst, /* Greenwich mean sidereal time in radians. */
+    int nifos, /* Input: number of detectors. */
+    /* FIXME: make const; change XLALComputeDetAMResponse prototype */
+    /* const */ float **responses, /* Pointers to detector responses. */
+    const double **locations, /* Pointers to locations of detectors in Cartesian geographic coordinates. */
+    const double *toas, /* Input: array of times of arrival with arbitrary relative offset. (Make toas[0] == 0.) */
+    const double *snrs, /* Input: array of SNRs. */
+    const double *s2_toas, /* Measurement variance of TOAs. */
+    const double *horizons, /* Distances at which a source would produce an SNR of 1 in each detector. */
+    double min_distance,
+    double max_distance,
+    bayestar_prior_t prior,
+    const bayestar_quadrature_t *quadrature /* Quadrature settings, or NULL for the default. */
 );
 
+/* Error code that bayestar_sky_map_tdoa_snr_tiled reports through the GSL
+ * error handler when the memory budget is exceeded. It is outside of the
+ * range of GSL's own error codes, so that callers can tell it apart from
+ * invalid arguments and from failures to allocate memory. */
+#define BAYESTAR_EBUDGET 1024
+
+/* Name of the instruction set variant that is in use, or "none" if the
+ * extension was built without instruction set variants. */
+const char *bayestar_isa(void);
+
 #endif /* BAYESTAR_SKY_MAP_H */
@@ -0,0 +1,361 @@
+/*                                           >y#
+                                            ~'#o+
+                                           '~~~md~
+                '|+>#!~'':::::....        .~'~'cY#
+            .+oy+>|##!~~~''':::......     ~:'':md! .
+          #rcmory+>|#~''':::'::...::.::. :..'''Yr:...
+        'coRRaamuyb>|!~'''::::':...........  .+n|.::..
+       !maMMNMRYmuybb|!~'''':.........::::::: ro'..::..
+      .cODDMYouuurub!':::...........:::~'.. |o>::...:..
+      >BDNCYYmroyb>|#~:::::::::::::~':.:: :ob::::::::..
+      uOCCNAa#'''''||':::.                :oy':::::::::.
+    :rRDn!  :~::'y+::':  ... ...:::.     :ob':::::::::::.
+   yMYy:   :>yooCY'.':.   .:'':......    ~u+~::::::::::::.
+  >>:'. .~>yBDMo!.'': . .:'':.   .      >u|!:::::::::::::.
+    ':'~|mYu#:'~'''. :.~:':...         yy>|~:::::::::::::..
+    :!ydu>|!rDu::'. +'#~::!#'.~:     |r++>#':::::::::::::..
+    mn>>>>>YNo:'': !# >'::::...  ..:cyb++>!:::::::::..:::...
+    :ouooyodu:'': .!:.!:::.       yobbbb+>~::::::::....:....
+     'cacumo~''' .'~ :~'.::.    :aybbbbbb>':::'~''::::....
+      .mamd>'''. :~' :':'.:.   om>bbbyyyb>'.#b>|#~~~'':..
+      .yYYo''': .:~' .'::'   .ny>+++byyoao!b+|||#!~~~''''''::.
+      .#RUb:''. .:'' .:':   |a#|>>>>yBMdb #yb++b|':::::''':'::::::.
+      .'CO!'''  .:'' .'    uu~##|+mMYy>+:|yyo+:::'::.         .::::::
+      .:RB~''' ..::'.':   o>~!#uOOu>bby'|yB>.'::  '~!!!!!~':. ..  .::::
+       :Rm''': ..:~:!:  'c~~+YNnbyyybb~'mr.':  !+yoy+>||!~'::.       :::.
+      ..Oo''': .'' ~:  !+|BDCryuuuuub|#B!::  !rnYaocob|#!~'':.  ..    .::.
+      . nB''': :  .'  |dNNduroomnddnuun::.  ydNAMMOary+>#~:.:::...      .:
+       .uC~'''    :. yNRmmmadYUROMMBmm.:   bnNDDDMRBoy>|#~':....:.      .:
+                 :' ymrmnYUROMAAAAMYn::. .!oYNDDMYmub|!~'::....:..     :
+                 !'#booBRMMANDDDNNMO!:. !~#ooRNNAMMOOmuy+#!':::.......    :.
+                .!'!#>ynCMNDDDDDNMRu.. '|:!raRMNAMOOdooy+|!~:::........   .:
+                 : .'rdbcRMNNNNAMRB!:  |!:~bycmdYYBaoryy+|!~':::.::::.  ..
+                 ..~|RMADnnONAMMRdy:. .>#::yyoroccruuybb>#!~'::':...::.
+                  :'oMOMOYNMnybyuo!.  :>#::b+youuoyyy+>>|!~':.    :::::
+                  ''YMCOYYNMOCCCRdoy##~~~: !b>bb+>>>||#~:..:::     ::::.
+                  .:OMRCoRNAMOCROYYUdoy|>~:.~!!~!~~':...:'::::.   :::::.
+                  ''oNOYyMNAMMMRYnory+|!!!:.....     ::.  :'::::::::::::
+                 .:..uNabOAMMCOdcyb+|!~':::.          !!'.. :~:::::'''':.
+                  .   +Y>nOORYauyy>!!'':....           !#~..  .~:''''''':.
+
+****************  ____  _____  ______________________    ____     **************
+***************  / __ )/   \ \/ / ____/ ___/_  __/   |  / __ \   ***************
+**************  / __  / /| |\  / __/  \__ \ / / / /| | / /_/ /  ****************
+*************  / /_/ / ___ |/ / /___ ___/ // / / ___ |/ _, _/  *****************
+************  /_____/_/  |_/_/_____//____//_/ /_/  |_/_/ |_|  ******************
+*/
+
+
+/*
+ * Copyright (C) 2013  Leo Singer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with with program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA  02111-1307  USA
+ */
+
+#include "bayestar_stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chealpix.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_math.h>
+
+
+/* Report an error through GSL from within
+ * bayestar_injection_stats_compute or bayestar_sky_map_pyramid, and then
+ * clean up. */
+#define STATS_ERROR(reason, gsl_errno) do { \
+    gsl_error(reason, __FILE__, __LINE__, gsl_errno); \
+    status = gsl_errno; \
+    goto done; \
+} while (0)
+
+
+static void swap(double *a, double *b)
+{
+    double tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+
+static double median3(double a, double b, double c)
+{
+    if (a < b)
+    {
+        if (b < c)
+            return b;
+        else if (a < c)
+            return c;
+        else
+            return a;
+    } else {
+        if (a < c)
+            return a;
+        else if (b < c)
+            return c;
+        else
+            return b;
+    }
+}
+
+
+/* Find the least number k of the largest elements of a[0..n) whose sum is at
+ * least target, by weighted quickselect. On entry, the elements a[0..lo) must
+ * already be no less than any of the elements a[lo..n), and *mass must be
+ * their sum. On exit, the array has been permuted so that the same holds for
+ * the elements a[0..k), and *mass is their sum. Because the invariant is
+ * preserved, a second call with lo = k and a greater target resumes where the
+ * first left off. If the whole array sums to less than target, returns n. */
+static size_t credible_count(
+    double *a, size_t lo, size_t n, double *mass, double target)
+{
+    size_t hi = n;
+
+    while (*mass < target && lo < hi)
+    {
+        const double pivot = median3(a[lo], a[lo + (hi - lo) / 2], a[hi - 1]);
+        size_t i = lo, g = lo, e = hi;
+        double mass_greater = 0;
+
+        /* Three-way partition in descending order: a[lo..g) > pivot,
+         * a[g..e) == pivot, a[e..hi) < pivot. The middle part contains at
+         * least the pivot, so every iteration shrinks the window. */
+        while (i < e)
+        {
+            if (a[i] > pivot)
+            {
+                mass_greater += a[i];
+                swap(&a[i ++], &a[g ++]);
+            } else if (a[i] < pivot) {
+                swap(&a[i], &a[-- e]);
+            } else {
+                i ++;
+            }
+        }
+
+        if (*mass + mass_greater >= target)
+        {
+            /* The answer lies among the elements greater than the pivot. */
+            hi = g;
+        } else {
+            const double mass_equal = (e - g) * pivot;
+            if (*mass + mass_greater + mass_equal >= target)
+            {
+                /* The answer lies among the elements equal to the pivot. */
+                double m = ceil((target - *mass - mass_greater) / pivot);
+                if (m > e - g)
+                    m = e - g;
+                *mass += mass_greater + m * pivot;
+                return g + (size_t) m;
+            }
+
+            /* The answer lies among the elements less than the pivot. */
+            *mass += mass_greater + mass_equal;
+            lo = e;
+        }
+    }
+
+    return lo;
+}
+
+
+int bayestar_injection_stats_compute(
+    bayestar_injection_stats *stats,
+    double *areas,
+    long npix,
+    const double *P,
+    double theta,
+    double phi,
+    size_t nlevels,
+    const double *levels)
+{
+    int status = GSL_SUCCESS;
+    double *buf = NULL;
+    size_t *order = NULL;
+    const long nside = npix2nside(npix);
+    const double pixarea = 4 * M_PI / npix * gsl_pow_2(180 / M_PI);
+    long i, true_pix, mode_pix = 0;
+    size_t j, k;
+    double p_true, mass_greater = 0, mass = 0;
+    double mode_theta, mode_phi, cos_offset;
+
+    if (nside <= 0 || nside2npix(nside) != npix)
+        STATS_ERROR("invalid number of pixels", GSL_EINVAL);
+
+    ang2pix_ring(nside, theta, phi, &true_pix);
+    p_true = P[true_pix];
+
+    /* Find the mode and the searched area in one pass. Pixels that are
+     * exactly as probable as the true location are considered to be searched
+     * after it. */
+    k = 0;
+    for (i = 0; i < npix; i ++)
+    {
+        if (!gsl_finite(P[i]))
+            STATS_ERROR("sky map contains non-finite values", GSL_EDOM);
+        if (P[i] > P[mode_pix])
+            mode_pix = i;
+        if (P[i] > p_true)
+        {
+            mass_greater += P[i];
+            k ++;
+        }
+    }
+    stats->searched_area = (k + 1) * pixarea;
+    stats->searched_prob = mass_greater + p_true;
+
+    /* Find the angular offset between the mode and true locations. */
+    pix2ang_ring(nside, mode_pix, &mode_theta, &mode_phi);
+    cos_offset = cos(phi - mode_phi) * sin(theta) * sin(mode_theta)
+               + cos(theta) * cos(mode_theta);
+    if (cos_offset > 1)
+        stats->offset = 0;
+    else if (cos_offset < -1)
+        stats->offset = 180;
+    else
+        stats->offset = acos(cos_offset) * 180 / M_PI;
+
+    if (nlevels == 0)
+        goto done;
+
+    /* Visit the credible levels in ascending order, so that each selection
+     * resumes where the previous one left off. */
+    order = malloc(nlevels * sizeof(*order));
+    buf = malloc(npix * sizeof(*buf));
+    if (!order || !buf)
+        STATS_ERROR("failed to allocate workspace", GSL_ENOMEM);
+    for (j = 0; j < nlevels; j ++)
+    {
+        size_t jj;
+        for (jj = j; jj > 0 && levels[order[jj - 1]] > levels[j]; jj --)
+            order[jj] = order[jj - 1];
+        order[jj] = j;
+    }
+    memcpy(buf, P, npix * sizeof(*buf));
+
+    k = 0;
+    for (j = 0; j < nlevels; j ++)
+    {
+        k = credible_count(buf, k, npix, &mass, levels[order[j]]);
+        areas[order[j]] = k * pixarea;
+    }
+
+done:
+    free(order);
+    free(buf);
+    return status;
+}
+
+
+/* Copy a NESTED-ordered map to one output level in RING order. */
+static void pyramid_output(
+    long nside, const double *nest, size_t ilevel,
+    double **levels, float **levels_float)
+{
+    const long npix = nside2npix(nside);
+    long i;
+
+    #pragma omp parallel for
+    for (i = 0; i < npix; i ++)
+    {
+        long j;
+        ring2nest(nside, i, &j);
+        if (levels)
+            levels[ilevel][i] = nest[j];
+        else
+            levels_float[ilevel][i] = nest[j];
+    }
+}
+
+
+int bayestar_sky_map_pyramid(
+    long npix,
+    const double *P,
+    size_t nlevels,
+    const long *nsides,
+    double **levels,
+    float **levels_float)
+{
+    int status = GSL_SUCCESS;
+    const long nside = npix2nside(npix);
+    long nside_min = nside, level_nside, i;
+    double *buf[2] = {NULL, NULL};
+    size_t j;
+    int k;
+
+    if (nside <= 0 || nside2npix(nside) != npix)
+        STATS_ERROR("invalid number of pixels", GSL_EINVAL);
+    /* ring2nest is only defined for nside that are powers of 2. */
+    if (nside & (nside - 1))
+        STATS_ERROR("input nside must be a power of 2", GSL_EINVAL);
+    if (!levels == !levels_float)
+        STATS_ERROR("exactly one of the output arrays must be given", GSL_EINVAL);
+    for (j = 0; j < nlevels; j ++)
+    {
+        if (nsides[j] < 1 || nsides[j] > nside || (nsides[j] & (nsides[j] - 1)))
+            STATS_ERROR("output nside must be a power of 2 that is no greater than the input nside", GSL_EINVAL);
+        if (nsides[j] < nside_min)
+            nside_min = nsides[j];
+    }
+    if (nlevels == 0)
+        goto done;
+
+    /* Two buffers, for alternate levels; every level after the first fits in
+     * a quarter of the space of the input. */
+    buf[0] = malloc(npix * sizeof(double));
+    buf[1] = malloc((npix / 4 + 1) * sizeof(double));
+    if (!buf[0] || !buf[1])
+        STATS_ERROR("failed to allocate workspace", GSL_ENOMEM);
+
+    /* Reorder the input map to the NESTED scheme. */
+    #pragma omp parallel for
+    for (i = 0; i < npix; i ++)
+    {
+        long ipix_nest;
+        ring2nest(nside, i, &ipix_nest);
+        buf[0][ipix_nest] = P[i];
+    }
+
+    for (k = 0, level_nside = nside; ; k = !k, level_nside /= 2)
+    {
+        for (j = 0; j < nlevels; j ++)
+            if (nsides[j] == level_nside)
+                pyramid_output(level_nside, buf[k], j, levels, levels_float);
+
+        if (level_nside == nside_min)
+            break;
+
+        /* Sum each group of four sibling pixels into their parent. */
+        {
+            const long npix_parent = nside2npix(level_nside / 2);
+            const double *child = buf[k];
+            double *parent = buf[!k];
+
+            #pragma omp parallel for
+            for (i = 0; i < npix_parent; i ++)
+                parent[i] = child[4 * i] + child[4 * i + 1]
+                          + child[4 * i + 2] + child[4 * i + 3];
+        }
+    }
+
+done:
+    free(buf[0]);
+    free(buf[1]);
+    return status;
+}
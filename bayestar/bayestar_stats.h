@@ -0,0 +1,119 @@
+/*                                           >y#
+                                            ~'#o+
+                                           '~~~md~
+                '|+>#!~'':::::....        .~'~'cY#
+            .+oy+>|##!~~~''':::......     ~:'':md! .
+          #rcmory+>|#~''':::'::...::.::. :..'''Yr:...
+        'coRRaamuyb>|!~'''::::':...........  .+n|.::..
+       !maMMNMRYmuybb|!~'''':.........::::::: ro'..::..
+      .cODDMYouuurub!':::...........:::~'.. |o>::...:..
+      >BDNCYYmroyb>|#~:::::::::::::~':.:: :ob::::::::..
+      uOCCNAa#'''''||':::.                :oy':::::::::.
+    :rRDn!  :~::'y+::':  ... ...:::.     :ob':::::::::::.
+   yMYy:   :>yooCY'.':.   .:'':......    ~u+~::::::::::::.
+  >>:'. .~>yBDMo!.'': . .:'':.   .      >u|!:::::::::::::.
+    ':'~|mYu#:'~'''. :.~:':...         yy>|~:::::::::::::..
+    :!ydu>|!rDu::'. +'#~::!#'.~:     |r++>#':::::::::::::..
+    mn>>>>>YNo:'': !# >'::::...  ..:cyb++>!:::::::::..:::...
+    :ouooyodu:'': .!:.!:::.       yobbbb+>~::::::::....:....
+     'cacumo~''' .'~ :~'.::.    :aybbbbbb>':::'~''::::....
+      .mamd>'''. :~' :':'.:.   om>bbbyyyb>'.#b>|#~~~'':..
+      .yYYo''': .:~' .'::'   .ny>+++byyoao!b+|||#!~~~''''''::.
+      .#RUb:''. .:'' .:':   |a#|>>>>yBMdb #yb++b|':::::''':'::::::.
+      .'CO!'''  .:'' .'    uu~##|+mMYy>+:|yyo+:::'::.         .::::::
+      .:RB~''' ..::'.':   o>~!#uOOu>bby'|yB>.'::  '~!!!!!~':. ..  .::::
+       :Rm''': ..:~:!:  'c~~+YNnbyyybb~'mr.':  !+yoy+>||!~'::.       :::.
+      ..Oo''': .'' ~:  !+|BDCryuuuuub|#B!::  !rnYaocob|#!~'':.  ..    .::.
+      . nB''': :  .'  |dNNduroomnddnuun::.  ydNAMMOary+>#~:.:::...      .:
+       .uC~'''    :. yNRmmmadYUROMMBmm.:   bnNDDDMRBoy>|#~':....:.      .:
+                 :' ymrmnYUROMAAAAMYn::. .!oYNDDMYmub|!~'::....:..     :
+                 !'#booBRMMANDDDNNMO!:. !~#ooRNNAMMOOmuy+#!':::.......    :.
+                .!'!#>ynCMNDDDDDNMRu.. '|:!raRMNAMOOdooy+|!~:::........   .:
+                 : .'rdbcRMNNNNAMRB!:  |!:~bycmdYYBaoryy+|!~':::.::::.  ..
+                 ..~|RMADnnONAMMRdy:. .>#::yyoroccruuybb>#!~'::':...::.
+                  :'oMOMOYNMnybyuo!.  :>#::b+youuoyyy+>>|!~':.    :::::
+                  ''YMCOYYNMOCCCRdoy##~~~: !b>bb+>>>||#~:..:::     ::::.
+                  .:OMRCoRNAMOCROYYUdoy|>~:.~!!~!~~':...:'::::.   :::::.
+                  ''oNOYyMNAMMMRYnory+|!!!:.....     ::.  :'::::::::::::
+                 .:..uNabOAMMCOdcyb+|!~':::.          !!'.. :~:::::'''':.
+                  .   +Y>nOORYauyy>!!'':....           !#~..  .~:''''''':.
+
+****************  ____  _____  ______________________    ____     **************
+***************  / __ )/   \ \/ / ____/ ___/_  __/   |  / __ \   ***************
+**************  / __  / /| |\  / __/  \__ \ / / / /| | / /_/ /  ****************
+*************  / /_/ / ___ |/ / /___ ___/ // / / ___ |/ _, _/  *****************
+************  /_____/_/  |_/_/_____//____//_/ /_/  |_/_/ |_|  ******************
+*/
+
+
+/*
+ * Copyright (C) 2013  Leo Singer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with with program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA  02111-1307  USA
+ */
+
+#ifndef BAYESTAR_STATS_H
+#define BAYESTAR_STATS_H
+
+#include <stddef.h>
+
+
+/* Summary statistics of a sky map with respect to the true location of the
+ * source, as in bayestar_aggregate_found_injections. */
+typedef struct {
+    double searched_area; /* Area in deg^2 searched before reaching the true location. */
+    double searched_prob; /* Probability enclosed by the searched area. */
+    double offset; /* Angle in degrees between the mode and the true location. */
+} bayestar_injection_stats;
+
+
+/* Compute the summary statistics of a RING-ordered HEALPix sky map P of npix
+ * pixels for a source at the spherical polar coordinates (theta, phi). Also
+ * compute, for each of the nlevels probabilities in levels, the area in deg^2
+ * of the smallest region that contains that much probability. The credible
+ * areas are found by selection in expected O(npix) time, without sorting the
+ * sky map. Returns GSL_SUCCESS, or a GSL error code on failure. */
+int bayestar_injection_stats_compute(
+    bayestar_injection_stats *stats, /* Output: summary statistics. */
+    double *areas, /* Output: credible areas in deg^2, of length nlevels. */
+    long npix, /* Input: number of pixels. */
+    const double *P, /* Input: sky map probabilities. */
+    double theta, /* Input: polar angle of the true location. */
+    double phi, /* Input: azimuthal angle of the true location. */
+    size_t nlevels, /* Input: number of credible levels. */
+    const double *levels /* Input: credible levels, each between 0 and 1. */
+);
+
+/* Down-sample a RING-ordered HEALPix sky map P of npix pixels to each of the
+ * nlevels resolutions in nsides, conserving probability: each output pixel is
+ * the sum of the input pixels that it contains. The map is reordered to the
+ * NESTED scheme once, and each halving of the resolution then sums groups of
+ * four consecutive pixels, so every level costs a single parallel pass over
+ * the level above it. The output maps are RING-ordered, and are written to
+ * the arrays in levels if it is not NULL, or else in single precision to the
+ * arrays in levels_float; the i-th array must have room for
+ * nside2npix(nsides[i]) elements. Returns GSL_SUCCESS, or a GSL error code on
+ * failure. */
+int bayestar_sky_map_pyramid(
+    long npix, /* Input: number of pixels. */
+    const double *P, /* Input: sky map probabilities. */
+    size_t nlevels, /* Input: number of output resolutions. */
+    const long *nsides, /* Input: output resolutions, each no finer than the input. */
+    double **levels, /* Output: down-sampled maps, or NULL. */
+    float **levels_float /* Output: down-sampled maps in single precision, or NULL. */
+);
+
+#endif /* BAYESTAR_STATS_H */
@@ -0,0 +1,436 @@
+/*                                           >y#
+                                            ~'#o+
+                                           '~~~md~
+                '|+>#!~'':::::....        .~'~'cY#
+            .+oy+>|##!~~~''':::......     ~:'':md! .
+          #rcmory+>|#~''':::'::...::.::. :..'''Yr:...
+        'coRRaamuyb>|!~'''::::':...........  .+n|.::..
+       !maMMNMRYmuybb|!~'''':.........::::::: ro'..::..
+      .cODDMYouuurub!':::...........:::~'.. |o>::...:..
+      >BDNCYYmroyb>|#~:::::::::::::~':.:: :ob::::::::..
+      uOCCNAa#'''''||':::.                :oy':::::::::.
+    :rRDn!  :~::'y+::':  ... ...:::.     :ob':::::::::::.
+   yMYy:   :>yooCY'.':.   .:'':......    ~u+~::::::::::::.
+  >>:'. .~>yBDMo!.'': . .:'':.   .      >u|!:::::::::::::.
+    ':'~|mYu#:'~'''. :.~:':...         yy>|~:::::::::::::..
+    :!ydu>|!rDu::'. +'#~::!#'.~:     |r++>#':::::::::::::..
+    mn>>>>>YNo:'': !# >'::::...  ..:cyb++>!:::::::::..:::...
+    :ouooyodu:'': .!:.!:::.       yobbbb+>~::::::::....:....
+     'cacumo~''' .'~ :~'.::.    :aybbbbbb>':::'~''::::....
+      .mamd>'''. :~' :':'.:.   om>bbbyyyb>'.#b>|#~~~'':..
+      .yYYo''': .:~' .'::'   .ny>+++byyoao!b+|||#!~~~''''''::.
+      .#RUb:''. .:'' .:':   |a#|>>>>yBMdb #yb++b|':::::''':'::::::.
+      .'CO!'''  .:'' .'    uu~##|+mMYy>+:|yyo+:::'::.         .::::::
+      .:RB~''' ..::'.':   o>~!#uOOu>bby'|yB>.'::  '~!!!!!~':. ..  .::::
+       :Rm''': ..:~:!:  'c~~+YNnbyyybb~'mr.':  !+yoy+>||!~'::.       :::.
+      ..Oo''': .'' ~:  !+|BDCryuuuuub|#B!::  !rnYaocob|#!~'':.  ..    .::.
+      . nB''': :  .'  |dNNduroomnddnuun::.  ydNAMMOary+>#~:.:::...      .:
+       .uC~'''    :. yNRmmmadYUROMMBmm.:   bnNDDDMRBoy>|#~':....:.      .:
+                 :' ymrmnYUROMAAAAMYn::. .!oYNDDMYmub|!~'::....:..     :
+                 !'#booBRMMANDDDNNMO!:. !~#ooRNNAMMOOmuy+#!':::.......    :.
+                .!'!#>ynCMNDDDDDNMRu.. '|:!raRMNAMOOdooy+|!~:::........   .:
+                 : .'rdbcRMNNNNAMRB!:  |!:~bycmdYYBaoryy+|!~':::.::::.  ..
+                 ..~|RMADnnONAMMRdy:. .>#::yyoroccruuybb>#!~'::':...::.
+                  :'oMOMOYNMnybyuo!.  :>#::b+youuoyyy+>>|!~':.    :::::
+                  ''YMCOYYNMOCCCRdoy##~~~: !b>bb+>>>||#~:..:::     ::::.
+                  .:OMRCoRNAMOCROYYUdoy|>~:.~!!~!~~':...:'::::.   :::::.
+                  ''oNOYyMNAMMMRYnory+|!!!:.....     ::.  :'::::::::::::
+                 .:..uNabOAMMCOdcyb+|!~':::.          !!'.. :~:::::'''':.
+                  .   +Y>nOORYauyy>!!'':....           !#~..  .~:''''''':.
+
+****************  ____  _____  ______________________    ____     **************
+***************  / __ )/   \ \/ / ____/ ___/_  __/   |  / __ \   ***************
+**************  / __  / /| |\  / __/  \__ \ / / / /| | / /_/ /  ****************
+*************  / /_/ / ___ |/ / /___ ___/ // / / ___ |/ _, _/  *****************
+************  /_____/_/  |_/_/_____//____//_/ /_/  |_/_/ |_|  ******************
+*/
+
+
+/*
+ * Copyright (C) 2013  Leo Singer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with with program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA  02111-1307  USA
+ */
+
+#include "bayestar_timing.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_linalg.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_permutation.h>
+#include <gsl/gsl_vector.h>
+
+
+/* Half-width of the lattice of test points, in lattice steps. */
+static const int brb_lattice_size = 32;
+
+/* Report an error through GSL from within bayestar_brb, and then clean up. */
+#define BRB_ERROR(reason, gsl_errno) do { \
+    gsl_error(reason, __FILE__, __LINE__, gsl_errno); \
+    status = gsl_errno; \
+    goto done; \
+} while (0)
+
+/* Number of independent partial sums for the frequency moments. A fixed
+ * number, rather than one per thread, so that the result does not depend on
+ * the number of threads. */
+#define BRB_NCHUNKS 64
+
+
+/* Compute the SNR-weighted averages of sin(w tau), cos(w tau),
+ * w sin(w tau), and w cos(w tau) for tau = k dtau, k = 0, ..., nlags - 1, in
+ * a single pass over the frequency samples. Integrals use the trapezoid rule,
+ * like np.trapz. The sines and cosines for successive lags are generated by
+ * repeated rotation, so that only one sine and cosine are evaluated per
+ * frequency sample. */
+static int brb_moments(
+    double *sin_moments, double *cos_moments,
+    double *wsin_moments, double *wcos_moments,
+    size_t nlags, double dtau,
+    size_t n, const double *w, const double *weights)
+{
+    size_t i, k;
+    long chunk;
+    double den = 0;
+    double *partial = calloc(BRB_NCHUNKS * 4 * nlags, sizeof(double));
+    if (!partial)
+        GSL_ERROR("failed to allocate space for frequency moments", GSL_ENOMEM);
+
+    #pragma omp parallel for
+    for (chunk = 0; chunk < BRB_NCHUNKS; chunk ++)
+    {
+        double *acc = &partial[chunk * 4 * nlags];
+        size_t begin = (size_t) chunk * n / BRB_NCHUNKS;
+        size_t end = (size_t) (chunk + 1) * n / BRB_NCHUNKS;
+        size_t ii, kk;
+        for (ii = begin; ii < end; ii ++)
+        {
+            const double weight = (ii == 0 || ii == n - 1) ? 0.5 * weights[ii] : weights[ii];
+            const double cos1 = cos(w[ii] * dtau), sin1 = sin(w[ii] * dtau);
+            double c = 1, s = 0;
+            for (kk = 0; kk < nlags; kk ++)
+            {
+                const double next_c = c * cos1 - s * sin1;
+                const double next_s = s * cos1 + c * sin1;
+                acc[4 * kk] += weight * s;
+                acc[4 * kk + 1] += weight * c;
+                acc[4 * kk + 2] += weight * w[ii] * s;
+                acc[4 * kk + 3] += weight * w[ii] * c;
+                c = next_c;
+                s = next_s;
+            }
+        }
+    }
+
+    for (k = 0; k < nlags; k ++)
+        sin_moments[k] = cos_moments[k] = wsin_moments[k] = wcos_moments[k] = 0;
+    for (chunk = 0; chunk < BRB_NCHUNKS; chunk ++)
+    {
+        const double *acc = &partial[chunk * 4 * nlags];
+        for (k = 0; k < nlags; k ++)
+        {
+            sin_moments[k] += acc[4 * k];
+            cos_moments[k] += acc[4 * k + 1];
+            wsin_moments[k] += acc[4 * k + 2];
+            wcos_moments[k] += acc[4 * k + 3];
+        }
+    }
+    free(partial);
+
+    for (i = 0; i < n; i ++)
+        den += (i == 0 || i == n - 1) ? 0.5 * weights[i] : weights[i];
+    for (k = 0; k < nlags; k ++)
+    {
+        sin_moments[k] /= den;
+        cos_moments[k] /= den;
+        wsin_moments[k] /= den;
+        wcos_moments[k] /= den;
+    }
+
+    return GSL_SUCCESS;
+}
+
+
+/* Fill in the matrix Delta = B - snr^2 A^T Lambda^-1 A. The exponent of each
+ * element of B is the sum of a term that depends only on the separation of
+ * the two test points on the lattice, which is looked up from a table, and
+ * one term for each of the two test points. */
+static void brb_assemble_delta(
+    double *delta, size_t m, double snr2,
+    const int *iphi, const int *itau, const double *u,
+    const double *a1, const double *a2,
+    const double *lambda_inv_a1, const double *lambda_inv_a2,
+    const double *separation_table, int table_half_width)
+{
+    const int table_width = 2 * table_half_width + 1;
+    long r;
+
+    #pragma omp parallel for
+    for (r = 0; r < (long) m; r ++)
+    {
+        size_t c;
+        double *row = &delta[r * m];
+        for (c = 0; c < m; c ++)
+        {
+            const double separation = separation_table[
+                (itau[c] - itau[r] + table_half_width) * table_width
+                + iphi[c] - iphi[r] + table_half_width];
+            row[c] = exp(snr2 * (1 + separation - u[r] - u[c]))
+                - snr2 * (a1[r] * lambda_inv_a1[c] + a2[r] * lambda_inv_a2[c]);
+        }
+    }
+}
+
+
+/* Solve the symmetric linear system Delta x = y for two right-hand sides. Try
+ * a Cholesky decomposition first; if Delta is not numerically positive
+ * definite, then reassemble it and fall back to an LU decomposition. */
+static int brb_solve(
+    double *delta, size_t m, double snr2,
+    const int *iphi, const int *itau, const double *u,
+    const double *a1, const double *a2,
+    const double *lambda_inv_a1, const double *lambda_inv_a2,
+    const double *separation_table, int table_half_width,
+    double *y1, double *y2, double *x1, double *x2)
+{
+    gsl_matrix_view delta_view = gsl_matrix_view_array(delta, m, m);
+    gsl_vector_view y1_view = gsl_vector_view_array(y1, m);
+    gsl_vector_view y2_view = gsl_vector_view_array(y2, m);
+    gsl_vector_view x1_view = gsl_vector_view_array(x1, m);
+    gsl_vector_view x2_view = gsl_vector_view_array(x2, m);
+    gsl_error_handler_t *old_handler;
+    gsl_permutation *perm;
+    int status, signum;
+
+    brb_assemble_delta(delta, m, snr2, iphi, itau, u, a1, a2,
+        lambda_inv_a1, lambda_inv_a2, separation_table, table_half_width);
+
+    old_handler = gsl_set_error_handler_off();
+    status = gsl_linalg_cholesky_decomp(&delta_view.matrix);
+    gsl_set_error_handler(old_handler);
+
+    if (status == GSL_SUCCESS)
+    {
+        status = gsl_linalg_cholesky_solve(&delta_view.matrix, &y1_view.vector, &x1_view.vector);
+        if (status != GSL_SUCCESS)
+            return status;
+        return gsl_linalg_cholesky_solve(&delta_view.matrix, &y2_view.vector, &x2_view.vector);
+    }
+
+    brb_assemble_delta(delta, m, snr2, iphi, itau, u, a1, a2,
+        lambda_inv_a1, lambda_inv_a2, separation_table, table_half_width);
+
+    perm = gsl_permutation_alloc(m);
+    if (!perm)
+        GSL_ERROR("failed to allocate permutation", GSL_ENOMEM);
+    status = gsl_linalg_LU_decomp(&delta_view.matrix, perm, &signum);
+    if (status == GSL_SUCCESS)
+        status = gsl_linalg_LU_solve(&delta_view.matrix, perm, &y1_view.vector, &x1_view.vector);
+    if (status == GSL_SUCCESS)
+        status = gsl_linalg_LU_solve(&delta_view.matrix, perm, &y2_view.vector, &x2_view.vector);
+    gsl_permutation_free(perm);
+    return status;
+}
+
+
+int bayestar_brb(
+    double *brb,
+    size_t n,
+    const double *w,
+    const double *weights,
+    double snr)
+{
+    const int nlattice = brb_lattice_size;
+    const int table_half_width = 2 * nlattice;
+    const int table_width = 2 * table_half_width + 1;
+    double w1 = 0, w2 = 0, den = 0, det, snr2, dphi, dtau, scale;
+    double lambda_inv[2][2];
+    double *moments = NULL, *points = NULL, *separation_table = NULL, *delta = NULL;
+    double *sin_moments, *cos_moments, *wsin_moments, *wcos_moments;
+    double *u, *a1, *a2, *lambda_inv_a1, *lambda_inv_a2, *y1, *y2, *x1, *x2;
+    int *lattice = NULL, *iphi, *itau;
+    int i, j, max_itau = 0;
+    size_t k, m, nlags;
+    int status;
+
+    if (n < 2)
+        GSL_ERROR("need at least two frequency samples", GSL_EINVAL);
+
+    /* First and second moments of angular frequency. */
+    for (k = 0; k < n; k ++)
+    {
+        const double weight = (k == 0 || k == n - 1) ? 0.5 * weights[k] : weights[k];
+        den += weight;
+        w1 += weight * w[k];
+        w2 += weight * gsl_pow_2(w[k]);
+    }
+    w1 /= den;
+    w2 /= den;
+
+    /* FIXME: stray factor of pi from somewhere? */
+    snr /= M_PI;
+    snr2 = gsl_pow_2(snr);
+
+    /* Inverse of the Fisher information matrix, Lambda = [[1, -w1], [-w1, w2]]
+     * (with the factor of snr^2 kept separate). */
+    det = w2 - gsl_pow_2(w1);
+    lambda_inv[0][0] = w2 / det;
+    lambda_inv[0][1] = lambda_inv[1][0] = w1 / det;
+    lambda_inv[1][1] = 1 / det;
+
+    /* Create a regular lattice of test points, restricted to lie within one
+     * standard deviation of the true parameter values according to the
+     * Cramér-Rao bound. */
+    dphi = M_SQRT2 * sqrt(lambda_inv[0][0]) / nlattice;
+    dtau = M_SQRT2 * sqrt(lambda_inv[1][1]) / nlattice;
+    lattice = malloc(8 * nlattice * nlattice * sizeof(int));
+    if (!lattice)
+    {
+        BRB_ERROR("failed to allocate lattice", GSL_ENOMEM);
+    }
+    iphi = lattice;
+    itau = lattice + 4 * nlattice * nlattice;
+    m = 0;
+    for (i = -nlattice; i <= nlattice; i ++)
+    {
+        if (i == 0)
+            continue;
+        for (j = -nlattice; j <= nlattice; j ++)
+        {
+            double phi, tau;
+            if (j == 0)
+                continue;
+            phi = j * dphi;
+            tau = i * dtau;
+            if (0.5 * (gsl_pow_2(phi) - 2 * w1 * phi * tau + w2 * gsl_pow_2(tau)) < 1)
+            {
+                iphi[m] = j;
+                itau[m] = i;
+                if (abs(i) > max_itau)
+                    max_itau = abs(i);
+                m ++;
+            }
+        }
+    }
+    scale = 8 / snr;
+    dphi *= scale;
+    dtau *= scale;
+
+    /* Frequency moments at every time lag that separates two test points. */
+    nlags = 2 * max_itau + 1;
+    moments = malloc(4 * nlags * sizeof(double));
+    if (!moments)
+    {
+        BRB_ERROR("failed to allocate frequency moments", GSL_ENOMEM);
+    }
+    sin_moments = moments;
+    cos_moments = moments + nlags;
+    wsin_moments = moments + 2 * nlags;
+    wcos_moments = moments + 3 * nlags;
+    status = brb_moments(sin_moments, cos_moments, wsin_moments, wcos_moments,
+        nlags, dtau, n, w, weights);
+    if (status != GSL_SUCCESS)
+        goto done;
+    sin_moments[0] = 0;
+    cos_moments[0] = 1;
+    wsin_moments[0] = 0;
+    wcos_moments[0] = w1;
+
+    /* Table of the part of the exponent of B that depends only on the
+     * separation between two test points. */
+    separation_table = malloc(table_width * table_width * sizeof(double));
+    if (!separation_table)
+    {
+        BRB_ERROR("failed to allocate lattice separation table", GSL_ENOMEM);
+    }
+    for (i = -table_half_width; i <= table_half_width; i ++)
+    {
+        const size_t lag = abs(i);
+        const double sign = (i >= 0) ? 1 : -1;
+        for (j = -table_half_width; j <= table_half_width; j ++)
+        {
+            double value = 0;
+            if (lag < nlags)
+                value = cos(j * dphi) * cos_moments[lag]
+                    + sin(j * dphi) * sign * sin_moments[lag];
+            separation_table[(i + table_half_width) * table_width + j + table_half_width] = value;
+        }
+    }
+
+    /* Per-point quantities. */
+    points = malloc(9 * m * sizeof(double));
+    delta = malloc(m * m * sizeof(double));
+    if (!points || !delta)
+    {
+        BRB_ERROR("failed to allocate Barankin bound workspace", GSL_ENOMEM);
+    }
+    u = points;
+    a1 = points + m;
+    a2 = points + 2 * m;
+    lambda_inv_a1 = points + 3 * m;
+    lambda_inv_a2 = points + 4 * m;
+    y1 = points + 5 * m;
+    y2 = points + 6 * m;
+    x1 = points + 7 * m;
+    x2 = points + 8 * m;
+    for (k = 0; k < m; k ++)
+    {
+        const size_t lag = abs(itau[k]);
+        const double sign = (itau[k] >= 0) ? 1 : -1;
+        const double sin_phi = sin(iphi[k] * dphi), cos_phi = cos(iphi[k] * dphi);
+        u[k] = cos_phi * cos_moments[lag] + sin_phi * sign * sin_moments[lag];
+        a1[k] = sin_phi * cos_moments[lag] - cos_phi * sign * sin_moments[lag];
+        a2[k] = -sin_phi * wcos_moments[lag] + cos_phi * sign * wsin_moments[lag];
+        lambda_inv_a1[k] = lambda_inv[0][0] * a1[k] + lambda_inv[0][1] * a2[k];
+        lambda_inv_a2[k] = lambda_inv[1][0] * a1[k] + lambda_inv[1][1] * a2[k];
+        y1[k] = iphi[k] * dphi - lambda_inv_a1[k];
+        y2[k] = itau[k] * dtau - lambda_inv_a2[k];
+    }
+
+    status = brb_solve(delta, m, snr2, iphi, itau, u, a1, a2,
+        lambda_inv_a1, lambda_inv_a2, separation_table, table_half_width,
+        y1, y2, x1, x2);
+    if (status != GSL_SUCCESS)
+        goto done;
+
+    /* BRB = Lambda^-1 / snr^2 + Y Delta^-1 Y^T */
+    for (i = 0; i < 2; i ++)
+        for (j = 0; j < 2; j ++)
+            brb[2 * i + j] = lambda_inv[i][j] / snr2;
+    for (k = 0; k < m; k ++)
+    {
+        brb[0] += y1[k] * x1[k];
+        brb[1] += y1[k] * x2[k];
+        brb[2] += y2[k] * x1[k];
+        brb[3] += y2[k] * x2[k];
+    }
+
+    /* FIXME: stray factor of pi from somewhere? */
+    for (i = 0; i < 4; i ++)
+        brb[i] /= gsl_pow_2(M_PI);
+
+done:
+    free(lattice);
+    free(moments);
+    free(separation_table);
+    free(points);
+    free(delta);
+    return status;
+}
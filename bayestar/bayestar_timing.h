@@ -0,0 +1,85 @@
+/*                                           >y#
+                                            ~'#o+
+                                           '~~~md~
+                '|+>#!~'':::::....        .~'~'cY#
+            .+oy+>|##!~~~''':::......     ~:'':md! .
+          #rcmory+>|#~''':::'::...::.::. :..'''Yr:...
+        'coRRaamuyb>|!~'''::::':...........  .+n|.::..
+       !maMMNMRYmuybb|!~'''':.........::::::: ro'..::..
+      .cODDMYouuurub!':::...........:::~'.. |o>::...:..
+      >BDNCYYmroyb>|#~:::::::::::::~':.:: :ob::::::::..
+      uOCCNAa#'''''||':::.                :oy':::::::::.
+    :rRDn!  :~::'y+::':  ... ...:::.     :ob':::::::::::.
+   yMYy:   :>yooCY'.':.   .:'':......    ~u+~::::::::::::.
+  >>:'. .~>yBDMo!.'': . .:'':.   .      >u|!:::::::::::::.
+    ':'~|mYu#:'~'''. :.~:':...         yy>|~:::::::::::::..
+    :!ydu>|!rDu::'. +'#~::!#'.~:     |r++>#':::::::::::::..
+    mn>>>>>YNo:'': !# >'::::...  ..:cyb++>!:::::::::..:::...
+    :ouooyodu:'': .!:.!:::.       yobbbb+>~::::::::....:....
+     'cacumo~''' .'~ :~'.::.    :aybbbbbb>':::'~''::::....
+      .mamd>'''. :~' :':'.:.   om>bbbyyyb>'.#b>|#~~~'':..
+      .yYYo''': .:~' .'::'   .ny>+++byyoao!b+|||#!~~~''''''::.
+      .#RUb:''. .:'' .:':   |a#|>>>>yBMdb #yb++b|':::::''':'::::::.
+      .'CO!'''  .:'' .'    uu~##|+mMYy>+:|yyo+:::'::.         .::::::
+      .:RB~''' ..::'.':   o>~!#uOOu>bby'|yB>.'::  '~!!!!!~':. ..  .::::
+       :Rm''': ..:~:!:  'c~~+YNnbyyybb~'mr.':  !+yoy+>||!~'::.       :::.
+      ..Oo''': .'' ~:  !+|BDCryuuuuub|#B!::  !rnYaocob|#!~'':.  ..    .::.
+      . nB''': :  .'  |dNNduroomnddnuun::.  ydNAMMOary+>#~:.:::...      .:
+       .uC~'''    :. yNRmmmadYUROMMBmm.:   bnNDDDMRBoy>|#~':....:.      .:
+                 :' ymrmnYUROMAAAAMYn::. .!oYNDDMYmub|!~'::....:..     :
+                 !'#booBRMMANDDDNNMO!:. !~#ooRNNAMMOOmuy+#!':::.......    :.
+                .!'!#>ynCMNDDDDDNMRu.. '|:!raRMNAMOOdooy+|!~:::........   .:
+                 : .'rdbcRMNNNNAMRB!:  |!:~bycmdYYBaoryy+|!~':::.::::.  ..
+                 ..~|RMADnnONAMMRdy:. .>#::yyoroccruuybb>#!~'::':...::.
+                  :'oMOMOYNMnybyuo!.  :>#::b+youuoyyy+>>|!~':.    :::::
+                  ''YMCOYYNMOCCCRdoy##~~~: !b>bb+>>>||#~:..:::     ::::.
+                  .:OMRCoRNAMOCROYYUdoy|>~:.~!!~!~~':...:'::::.   :::::.
+                  ''oNOYyMNAMMMRYnory+|!!!:.....     ::.  :'::::::::::::
+                 .:..uNabOAMMCOdcyb+|!~':::.          !!'.. :~:::::'''':.
+                  .   +Y>nOORYauyy>!!'':....           !#~..  .~:''''''':.
+
+****************  ____  _____  ______________________    ____     **************
+***************  / __ )/   \ \/ / ____/ ___/_  __/   |  / __ \   ***************
+**************  / __  / /| |\  / __/  \__ \ / / / /| | / /_/ /  ****************
+*************  / /_/ / ___ |/ / /___ ___/ // / / ___ |/ _, _/  *****************
+************  /_____/_/  |_/_/_____//____//_/ /_/  |_/_/ |_|  ******************
+*/
+
+
+/*
+ * Copyright (C) 2013  Leo Singer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with with program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA  02111-1307  USA
+ */
+
+#ifndef BAYESTAR_TIMING_H
+#define BAYESTAR_TIMING_H
+
+#include <stddef.h>
+
+
+/* Compute the Barankin bound on the covariance of the phase and time of
+ * arrival of a signal, as in timing.SignalModel.get_brb. Returns GSL_SUCCESS,
+ * or a GSL error code if the bound could not be computed. */
+int bayestar_brb(
+    double *brb, /* Output: 2x2 covariance matrix in row-major order. */
+    size_t n, /* Input: number of frequency samples. */
+    const double *w, /* Input: angular frequency samples. */
+    const double *weights, /* Input: SNR per unit angular frequency at each sample. */
+    double snr /* Input: signal to noise ratio. */
+);
+
+#endif /* BAYESTAR_TIMING_H */
@@ -0,0 +1,268 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+File-based work queue for running large localization campaigns with several
+worker processes, possibly on several hosts that share a file system.
+
+A campaign lives in a directory with the following layout:
+
+  pending/KEY          one empty file for each item that has not been claimed
+  claimed/KEY@HOST@PID an item that is being processed by a worker
+  done/KEY.json        the record of a finished item, successful or not
+  manifest.json        all of the records, merged when a runner finishes
+
+Workers claim items by renaming them from pending/ to claimed/, which is
+atomic, so no item is processed twice at the same time. When an item is
+finished, its record is written atomically to done/ and the claim is removed.
+If a worker is killed, its claim is left behind; the next runner that starts
+on the same host puts it back in the queue, as does any runner once the claim
+is older than a timeout. The age of a claim is that of its last modification:
+it is touched when it is made, and periodically while the item is processed,
+so that slow items are not mistaken for abandoned ones. Items with a record in
+done/ are never queued again, so an interrupted campaign resumes where it left
+off. To retry failed items, delete their records.
+"""
+from __future__ import division
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import errno
+import json
+import logging
+import multiprocessing
+import os
+import random
+import socket
+import threading
+import time
+from .psd_cache import atomic_write, makedirs
+
+
+log = logging.getLogger('BAYESTAR')
+
+
+def _pid_exists(pid):
+    try:
+        os.kill(pid, 0)
+    except OSError as e:
+        return e.errno == errno.EPERM
+    else:
+        return True
+
+
+class WorkQueue(object):
+    """A queue of string keys, stored in the directory root."""
+
+    def __init__(self, root):
+        self.root = root
+        self.pending_dir = os.path.join(root, 'pending')
+        self.claimed_dir = os.path.join(root, 'claimed')
+        self.done_dir = os.path.join(root, 'done')
+        self.manifest_path = os.path.join(root, 'manifest.json')
+        self.host = socket.gethostname()
+        for dirname in (self.pending_dir, self.claimed_dir, self.done_dir):
+            makedirs(dirname)
+        self._candidates = []
+
+    def done_keys(self):
+        return set(filename[:-5] for filename in os.listdir(self.done_dir)
+            if filename.endswith('.json') and not filename.startswith('.'))
+
+    def populate(self, keys):
+        """Queue all of the keys that are not already pending, claimed, or
+        done. Only the first runner to start on a campaign does this; later
+        runners only recover stale claims."""
+        marker = os.path.join(self.root, 'populated')
+        if os.path.exists(marker):
+            return
+        existing = self.done_keys()
+        existing.update(os.listdir(self.pending_dir))
+        existing.update(filename.split('@', 1)[0]
+            for filename in os.listdir(self.claimed_dir))
+        count = 0
+        for key in keys:
+            if key not in existing:
+                open(os.path.join(self.pending_dir, key), 'w').close()
+                count += 1
+        open(marker, 'w').close()
+        log.info('%s:queued %d items', self.root, count)
+
+    def requeue_stale(self, timeout):
+        """Return claims to the queue if they were made by a process on this
+        host that no longer exists, or if they are older than timeout
+        seconds."""
+        done = self.done_keys()
+        now = time.time()
+        for filename in os.listdir(self.claimed_dir):
+            try:
+                key, host, pid = filename.rsplit('@', 2)
+                pid = int(pid)
+            except ValueError:
+                continue
+            path = os.path.join(self.claimed_dir, filename)
+            try:
+                age = now - os.stat(path).st_mtime
+            except OSError:
+                continue
+            if key in done:
+                self._remove(path)
+            elif (host == self.host and not _pid_exists(pid)) or age > timeout:
+                log.info('%s:requeuing stale claim by %s:%d', key, host, pid)
+                try:
+                    os.rename(path, os.path.join(self.pending_dir, key))
+                except OSError:
+                    pass
+
+    def _claim_path(self, key):
+        return os.path.join(self.claimed_dir,
+            '%s@%s@%d' % (key, self.host, os.getpid()))
+
+    def claim(self):
+        """Claim a pending item and return its key, or return None if the
+        queue is empty. The pending directory is listed only when the
+        previous listing has been used up, in random order so that workers
+        seldom contend for the same items."""
+        for attempt in range(2):
+            while self._candidates:
+                key = self._candidates.pop()
+                try:
+                    os.rename(os.path.join(self.pending_dir, key),
+                        self._claim_path(key))
+                except OSError as e:
+                    if e.errno != errno.ENOENT:
+                        raise
+                else:
+                    # Renaming keeps the modification time of the pending
+                    # file, which dates from when the queue was populated.
+                    self.touch(key)
+                    return key
+            self._candidates = os.listdir(self.pending_dir)
+            random.shuffle(self._candidates)
+        return None
+
+    def touch(self, key):
+        """Mark a claimed item as still being processed."""
+        try:
+            os.utime(self._claim_path(key), None)
+        except OSError as e:
+            if e.errno != errno.ENOENT:
+                raise
+
+    def complete(self, key, record):
+        """Save the record for a claimed item, and drop the claim."""
+        atomic_write(os.path.join(self.done_dir, key + '.json'),
+            lambda f: json.dump(record, f))
+        self._remove(self._claim_path(key))
+
+    def release(self, key):
+        """Put a claimed item back in the queue."""
+        try:
+            os.rename(self._claim_path(key), os.path.join(self.pending_dir, key))
+        except OSError:
+            pass
+
+    def _remove(self, path):
+        try:
+            os.remove(path)
+        except OSError as e:
+            if e.errno != errno.ENOENT:
+                raise
+
+    def records(self):
+        """Return the records of all finished items, sorted by key."""
+        records = []
+        for key in sorted(self.done_keys()):
+            with open(os.path.join(self.done_dir, key + '.json'), 'rb') as f:
+                records.append(json.load(f))
+        return records
+
+    def write_manifest(self):
+        """Merge the records of all finished items into one file, and return
+        them."""
+        records = self.records()
+        atomic_write(self.manifest_path,
+            lambda f: json.dump(records, f, indent=1, sort_keys=True))
+        return records
+
+
+def _heartbeat(queue, key, interval, stop):
+    """Touch the claim on key every interval seconds until stop is set."""
+    while not stop.wait(interval):
+        try:
+            queue.touch(key)
+        except OSError:
+            log.exception('%s:failed to refresh claim', key)
+
+
+def _work(queue, func, claim_timeout):
+    """Process items until the queue is empty."""
+    # Make the shuffled listings differ between forked workers.
+    random.seed()
+    while True:
+        key = queue.claim()
+        if key is None:
+            break
+        record = dict(key=key, host=queue.host, pid=os.getpid(),
+            start_time=time.time())
+        # Refresh the claim several times per timeout, so that it does not
+        # look stale to other runners however long the item takes.
+        stop = threading.Event()
+        heartbeat = threading.Thread(target=_heartbeat,
+            args=(queue, key, claim_timeout / 4, stop))
+        heartbeat.daemon = True
+        heartbeat.start()
+        try:
+            record.update(func(key))
+        except Exception as e:
+            log.exception('%s:failed', key)
+            record.update(status='error', message=str(e))
+        except:
+            queue.release(key)
+            raise
+        finally:
+            stop.set()
+            heartbeat.join()
+        record['wall_time'] = time.time() - record['start_time']
+        queue.complete(key, record)
+
+
+def run(queue, func, processes=1, claim_timeout=3600):
+    """Process all of the items in the queue by calling func(key) in
+    processes worker processes, which are forked from this one. func should
+    return a dictionary that is JSON-serializable, including the key 'status'
+    ('ok' or 'error'); it is merged with the host, process ID, start time, and
+    wall time into the item's record. If func raises an exception, then the
+    item is recorded as failed. When the queue is empty, merge the records
+    into the manifest and return them."""
+    queue.requeue_stale(claim_timeout)
+    if processes > 1:
+        workers = [multiprocessing.Process(target=_work,
+            args=(queue, func, claim_timeout))
+            for _ in range(processes)]
+        for worker in workers:
+            worker.start()
+        try:
+            for worker in workers:
+                worker.join()
+        finally:
+            for worker in workers:
+                if worker.is_alive():
+                    worker.terminate()
+    else:
+        _work(queue, func, claim_timeout)
+    return queue.write_manifest()
@@ -23,6 +23,9 @@ __author__ = "Leo Singer <leo.singer@ligo.org>"
 
 
 # General imports
+import collections
+import hashlib
+import threading
 import numpy as np
 import math
 from scipy import optimize
@@ -42,11 +45,23 @@ lal.UnitInvert(unitInverseHertz, lal.lalHertzUnit)
 lal.UnitSqrt(unitInverseSqrtHertz, unitInverseHertz)
 
 
-# Memoize FFT plans
-CreateForwardCOMPLEX16FFTPlan = memoized(lal.CreateForwardCOMPLEX16FFTPlan)
-CreateForwardREAL8FFTPlan = memoized(lal.CreateForwardREAL8FFTPlan)
-CreateReverseCOMPLEX16FFTPlan = memoized(lal.CreateReverseCOMPLEX16FFTPlan)
-CreateReverseREAL8FFTPlan = memoized(lal.CreateReverseREAL8FFTPlan)
+# Memoize FFT plans. FFTW's planner is not thread safe, so plans are created
+# while holding a lock; executing an existing plan is thread safe.
+_plan_lock = threading.Lock()
+
+def _memoized_plan(func):
+    func = memoized(func)
+    def locked_func(*args):
+        with _plan_lock:
+            return func(*args)
+    locked_func.__name__ = func.__name__
+    locked_func.__doc__ = func.__doc__
+    return locked_func
+
+CreateForwardCOMPLEX16FFTPlan = _memoized_plan(lal.CreateForwardCOMPLEX16FFTPlan)
+CreateForwardREAL8FFTPlan = _memoized_plan(lal.CreateForwardREAL8FFTPlan)
+CreateReverseCOMPLEX16FFTPlan = _memoized_plan(lal.CreateReverseCOMPLEX16FFTPlan)
+CreateReverseREAL8FFTPlan = _memoized_plan(lal.CreateReverseREAL8FFTPlan)
 
 
 def ceil_pow_2(number):
@@ -60,33 +75,135 @@ def ceil_pow_2(number):
     )
 
 
-def fftfilt(b, x):
-    """Apply the FIR filter with coefficients b to the signal x, as if the filter's
-    state is initially all zeros. The output has the same length as x."""
+# FFT workspaces, one pair per transform length for each thread.
+_fft_workspaces = threading.local()
 
-    # Zero-pad by at least (len(b) - 1).
-    nfft = int(ceil_pow_2(len(x) + len(b) - 1))
 
-    # Create FFT plans.
-    forwardplan = CreateForwardCOMPLEX16FFTPlan(nfft, 0)
-    reverseplan = CreateReverseCOMPLEX16FFTPlan(nfft, 0)
+def _get_fft_workspaces(nfft):
+    try:
+        workspaces = _fft_workspaces.by_length
+    except AttributeError:
+        workspaces = _fft_workspaces.by_length = {}
+    try:
+        return workspaces[nfft]
+    except KeyError:
+        ret = workspaces[nfft] = (
+            lal.CreateCOMPLEX16Vector(nfft), lal.CreateCOMPLEX16Vector(nfft))
+        return ret
 
-    # Create temporary workspaces.
-    workspace1 = lal.CreateCOMPLEX16Vector(nfft)
-    workspace2 = lal.CreateCOMPLEX16Vector(nfft)
-    workspace3 = lal.CreateCOMPLEX16Vector(nfft)
 
+def _fft_zero_padded(x, nfft):
+    """Forward FFT of x, zero-padded to length nfft."""
+    workspace1, workspace2 = _get_fft_workspaces(nfft)
     workspace1.data[:len(x)] = x
     workspace1.data[len(x):] = 0
-    lal.COMPLEX16VectorFFT(workspace2, workspace1, forwardplan)
-    workspace1.data[:len(b)] = b
-    workspace1.data[len(b):] = 0
-    lal.COMPLEX16VectorFFT(workspace3, workspace1, forwardplan)
-    workspace2.data *= workspace3.data
-    lal.COMPLEX16VectorFFT(workspace1, workspace2, reverseplan)
+    lal.COMPLEX16VectorFFT(workspace2, workspace1, CreateForwardCOMPLEX16FFTPlan(nfft, 0))
+    # Copy, because the workspace will be reused.
+    return np.array(workspace2.data)
+
+
+def _ifft_truncated(X, n):
+    """Inverse FFT of X, normalized and truncated to length n."""
+    nfft = len(X)
+    workspace1, workspace2 = _get_fft_workspaces(nfft)
+    workspace1.data = X
+    lal.COMPLEX16VectorFFT(workspace2, workspace1, CreateReverseCOMPLEX16FFTPlan(nfft, 0))
+    return workspace2.data[:n] / nfft
+
+
+class MatchedFilterBank(object):
+    """Apply a bank of FIR filters to data segments of a fixed length by FFT
+    convolution. The spectra of the filter kernels are computed once, when the
+    bank is created, so filtering a segment costs one forward FFT of the data
+    plus one multiplication and one inverse FFT per kernel. FFT plans and
+    workspaces are shared among all banks with the same transform length.
+
+    Each kernel spectrum takes as much memory as a zero-padded data segment.
+    If max_bytes is given, then only as many spectra are kept as fit in that
+    many bytes; the spectra of the remaining kernels are recomputed each time
+    that a segment is filtered, at the cost of one more forward FFT each.
+    """
 
-    # Return result with zero-padding stripped.
-    return workspace1.data[:len(x)] / nfft
+    def __init__(self, kernels, data_length, max_bytes=None):
+        self.kernels = list(kernels)
+        self.kernel_lengths = [len(b) for b in self.kernels]
+        self.data_length = data_length
+
+        # Zero-pad by at least (len(b) - 1) for the longest kernel.
+        self.nfft = int(ceil_pow_2(data_length + max(self.kernel_lengths) - 1))
+
+        if max_bytes is None:
+            nkept = len(self.kernels)
+        else:
+            nkept = int(max_bytes // (self.nfft * np.dtype(np.complex128).itemsize))
+        self.kernel_spectra = [_fft_zero_padded(b, self.nfft)
+            for b in self.kernels[:nkept]]
+
+    def __len__(self):
+        return len(self.kernels)
+
+    def filter(self, x):
+        """Apply every filter to the signal x, as if the filters' states are
+        initially all zeros. Yields one output per filter, each of the same
+        length as x, so that only one output needs to be held in memory at a
+        time."""
+        if len(x) != self.data_length:
+            raise ValueError("expected data of length %d, got %d" % (self.data_length, len(x)))
+        X = _fft_zero_padded(x, self.nfft)
+        for i, b in enumerate(self.kernels):
+            if i < len(self.kernel_spectra):
+                B = self.kernel_spectra[i]
+            else:
+                B = _fft_zero_padded(b, self.nfft)
+            yield _ifft_truncated(X * B, len(x))
+
+
+# Spectra of recently used kernels for fftfilt, by content and FFT length.
+# The cache is bounded by the total size of the spectra, because at the
+# transform lengths of long data segments each one takes tens of megabytes.
+_kernel_spectra = collections.OrderedDict()
+_kernel_spectra_lock = threading.Lock()
+_kernel_spectra_nbytes = 0
+_kernel_spectra_max_bytes = 256 << 20
+
+
+def _get_kernel_spectrum(b, nfft):
+    global _kernel_spectra_nbytes
+    b = np.ascontiguousarray(b)
+    key = (hashlib.sha1(b.view(np.uint8)).hexdigest(), b.dtype.str, len(b), nfft)
+    with _kernel_spectra_lock:
+        try:
+            B = _kernel_spectra.pop(key)
+        except KeyError:
+            B = None
+        else:
+            _kernel_spectra[key] = B
+    if B is None:
+        B = _fft_zero_padded(b, nfft)
+        if B.nbytes <= _kernel_spectra_max_bytes:
+            with _kernel_spectra_lock:
+                if key not in _kernel_spectra:
+                    _kernel_spectra[key] = B
+                    _kernel_spectra_nbytes += B.nbytes
+                while _kernel_spectra_nbytes > _kernel_spectra_max_bytes:
+                    _, evicted = _kernel_spectra.popitem(last=False)
+                    _kernel_spectra_nbytes -= evicted.nbytes
+    return B
+
+
+def fftfilt(b, x):
+    """Apply the FIR filter with coefficients b to the signal x, as if the filter's
+    state is initially all zeros. The output has the same length as x.
+
+    The spectra of recently used filters are cached, so filtering many
+    signals with the same filter costs one forward and one inverse FFT each.
+    To filter a signal with many filters, use MatchedFilterBank."""
+
+    # Zero-pad by at least (len(b) - 1).
+    nfft = int(ceil_pow_2(len(x) + len(b) - 1))
+
+    X = _fft_zero_padded(x, nfft)
+    return _ifft_truncated(X * _get_kernel_spectrum(b, nfft), len(x))
 
 
 def abscissa(series):
@@ -100,43 +217,123 @@ def abscissa(series):
     return x0 + delta * np.arange(len(series.data.data))
 
 
+class ColoredNoiseGenerator(object):
+    """Generate colored Gaussian noise with a fixed power spectrum.
+
+    The reverse FFT plan, the frequency-domain shaping filter, and the
+    frequency and time domain buffers are created once when the generator is
+    constructed, and reused for every realization. Each call to generate()
+    overwrites the time series returned by the previous call, so callers that
+    need to keep more than one realization should copy it.
+
+    psd should be an instance of REAL8FrequencySeries containing a discretely
+    sampled power spectrum with f0=0, deltaF=1/duration, and a length of
+    ((duration * sample_rate) // 2 + 1) samples.
+
+    random_state may be an integer seed, None, or any object with a
+    standard_normal method, such as an instance of numpy.random.RandomState or
+    the numpy.random module itself. Give each generator its own random state if generators are
+    used from several threads at once.
+    """
+
+    def __init__(self, psd, duration, sample_rate, random_state=None):
+        data_length = int(duration * sample_rate)
+        if len(psd.data.data) != data_length // 2 + 1:
+            raise ValueError(
+                "PSD has %d samples, but %d s of data at %g Hz requires %d"
+                % (len(psd.data.data), duration, sample_rate,
+                data_length // 2 + 1))
+        if random_state is None or isinstance(random_state, (int, long)):
+            random_state = np.random.RandomState(random_state)
+
+        self.duration = duration
+        self.sample_rate = sample_rate
+        self.data_length = data_length
+        self.random_state = random_state
+        self._plan = CreateReverseREAL8FFTPlan(data_length, 0)
+        self._x = lal.CreateREAL8TimeSeries(None, lal.LIGOTimeGPS(0), 0,
+            1 / sample_rate, lal.lalStrainUnit, data_length)
+        self._xf = lal.CreateCOMPLEX16FrequencySeries(None,
+            lal.LIGOTimeGPS(0), 0, 1 / duration, lal.lalDimensionlessUnit,
+            data_length // 2 + 1)
+
+        # On line 1288 of lal's AverageSpectrum.c, in the code comments for
+        # XLALWhitenCOMPLEX8FrequencySeries, it says that according to the LAL
+        # conventions a whitened frequency series should consist of bins whose
+        # real and imaginary parts each have a variance of 1/2, hence the
+        # factor of 1/sqrt(2). The factor of sqrt(2 * psd.deltaF) comes from
+        # the value of 'norm' on line 1362 of AverageSpectrum.c.
+        self._shaping = np.sqrt(psd.data.data / (4 * psd.deltaF))
+
+        # Detrend the data: no DC component.
+        self._shaping[0] = 0
+
+    def generate(self, epoch):
+        """Realize duration seconds of colored noise starting at the GPS time
+        epoch, and return it as a REAL8TimeSeries. The returned series is
+        owned by the generator and is overwritten by the next call."""
+        n = len(self._shaping)
+        white_noise = np.empty(n, dtype=np.complex128)
+        white_noise.real = self.random_state.standard_normal(n)
+        white_noise.imag = self.random_state.standard_normal(n)
+        white_noise *= self._shaping
+        self._xf.data.data = white_noise
+
+        # Return to time domain.
+        lal.REAL8FreqTimeFFT(self._x, self._xf, self._plan)
+
+        # REAL8FreqTimeFFT copies the epoch and deltaT from the frequency
+        # series, so restore the metadata afterwards.
+        self._x.epoch = epoch
+        self._x.deltaT = 1 / self.sample_rate
+        self._x.sampleUnits = lal.lalStrainUnit
+        return self._x
+
+    def segments(self, epoch, segment_duration, stride):
+        """Generate an endless stream of overlapping segments of colored
+        noise, each segment_duration seconds long, with start times that
+        advance by stride seconds starting from the GPS time epoch.
+
+        Segments are cut from one long realization of duration seconds; when
+        it is exhausted, a new, independent realization is drawn. To get
+        several segments out of each realization, construct the generator with
+        a duration that is several times segment_duration. Each segment is
+        returned as a REAL8TimeSeries that is owned by the generator and is
+        overwritten by the next segment."""
+        segment_length = int(segment_duration * self.sample_rate)
+        stride_length = int(stride * self.sample_rate)
+        if not 0 < segment_length <= self.data_length:
+            raise ValueError(
+                "segment duration must be positive and no longer than %g s"
+                % self.duration)
+        if stride_length <= 0:
+            raise ValueError("stride must be positive")
+
+        segment = lal.CreateREAL8TimeSeries(None, lal.LIGOTimeGPS(0), 0,
+            1 / self.sample_rate, lal.lalStrainUnit, segment_length)
+        epoch = epoch + 0 # make a copy that can be advanced in place
+        while True:
+            data = self.generate(epoch).data.data
+            for i in xrange(0,
+                    self.data_length - segment_length + 1, stride_length):
+                segment.data.data = data[i:i + segment_length]
+                segment.epoch = epoch
+                yield segment
+                epoch += stride
+
+
 def colored_noise(epoch, duration, sample_rate, psd):
     """Generate a REAL8TimeSeries containing duration seconds of colored
     Gaussian noise at the given sample rate, with the start time given by epoch.
     psd should be an instance of REAL8FrequencySeries containing a discretely
     sample power spectrum with f0=0, deltaF=1/duration, and a length of
     ((duration * sample_rate) // 2 + 1) samples.
+
+    To generate many realizations with the same power spectrum, use a
+    ColoredNoiseGenerator instead.
     """
-    data_length = duration * sample_rate
-    plan = CreateReverseREAL8FFTPlan(data_length, 0)
-    x = lal.CreateREAL8TimeSeries(None, lal.LIGOTimeGPS(0), 0, 0,
-        lal.lalDimensionlessUnit, data_length)
-    xf = lal.CreateCOMPLEX16FrequencySeries(None, epoch, 0, 1 / duration,
-        lal.lalDimensionlessUnit, data_length // 2 + 1)
-    white_noise = (np.random.randn(len(xf.data.data)) + np.random.randn(len(xf.data.data)) * 1j)
-
-    # On line 1288 of lal's AverageSpectrum.c, in the code comments for
-    # XLALWhitenCOMPLEX8FrequencySeries, it says that according to the LAL
-    # conventions a whitened frequency series should consist of bins whose
-    # real and imaginary parts each have a variance of 1/2.
-    white_noise /= np.sqrt(2)
-
-    # The factor of sqrt(2 * psd.deltaF) comes from the value of 'norm' on
-    # line 1362 of AverageSpectrum.c.
-    xf.data.data = white_noise * np.sqrt(psd.data.data / (2 * psd.deltaF))
-
-    # Detrend the data: no DC component.
-    xf.data.data[0] = 0
-
-    # Return to time domain.
-    lal.REAL8FreqTimeFFT(x, xf, plan)
-
-    # Copy over metadata.
-    x.epoch = epoch
-    x.sampleUnits = lal.lalStrainUnit
-
-    # Done.
-    return x
+    return ColoredNoiseGenerator(psd, duration, sample_rate, np.random
+        ).generate(epoch)
 
 
 def add_quadrature_phase(rseries):
@@ -75,7 +75,8 @@ import lal
 #
 # Modifications:
 #  * Added extra_metadata= argument to inject additional values into header.
-#  * Added optional unit= argument to set units of table data.
+#  * Added optional unit= argument to set units of table data; it may be a
+#    sequence with one unit for each column.
 #  * Support writing to gzip-compressed FITS files.
 #
 # FIXME: Instead of pyfits, use astropy.io.fits; it supports gzip compression.
@@ -105,6 +106,8 @@ def write_map(filename,m,nest=False,dtype=np.float32,fits_IDL=True,coord=None,co
       I/Q/U_STOKES for 3 components,
       II, IQ, IU, QQ, QU, UU for 6 components,
       COLUMN_0, COLUMN_1... otherwise
+    unit : str or list
+      Unit of all of the columns, or list of units of each column
     """
     if not hasattr(m, '__len__'):
         raise TypeError('The map must be a sequence')
@@ -120,6 +123,12 @@ def write_map(filename,m,nest=False,dtype=np.float32,fits_IDL=True,coord=None,co
     else:
         assert len(column_names) == len(m), "Length column_names != number of maps"
 
+    if unit is None or isinstance(unit, basestring):
+        units = [unit] * len(m)
+    else:
+        units = unit
+        assert len(units) == len(m), "Length unit != number of maps"
+
     # maps must have same length
     assert len(set(map(len, m))) == 1, "Maps must have same length"
     nside = pixelfunc.npix2nside(len(m[0]))
@@ -128,19 +137,19 @@ def write_map(filename,m,nest=False,dtype=np.float32,fits_IDL=True,coord=None,co
         raise ValueError('Invalid healpix map : wrong number of pixel')
 
     cols=[]
-    for cn, mm in zip(column_names, m):
+    for cn, cu, mm in zip(column_names, units, m):
         if len(mm) > 1024 and fits_IDL:
             # I need an ndarray, for reshape:
             mm2 = np.asarray(mm)
             cols.append(pf.Column(name=cn,
                                    format='1024%s' % fitsformat,
                                    array=mm2.reshape(mm2.size/1024,1024),
-                                   unit=unit))
+                                   unit=cu))
         else:
             cols.append(pf.Column(name=cn,
                                    format='%s' % fitsformat,
                                    array=mm,
-                                   unit=unit))
+                                   unit=cu))
 
     tbhdu = pf.new_table(cols)
     # add needed keywords
@@ -164,13 +173,19 @@ def write_map(filename,m,nest=False,dtype=np.float32,fits_IDL=True,coord=None,co
     for metadata in extra_metadata:
         tbhdu.header.update(*metadata)
 
+    writeto(tbhdu, filename)
+
+
+def writeto(hdu, filename):
+    """Write a FITS HDU to a file, gzip-compressing it if the filename ends in
+    '.gz'."""
     # FIXME: use with-clause, but GzipFile doesn't support it in Python 2.6.
     # We can't even use GzipFile because the ancient version of PyFITS that is
     # in SL6 is too broken, so we have to write the file and then compress it.
     basename, ext = os.path.splitext(filename)
     if ext == '.gz':
         with tempfile.NamedTemporaryFile(suffix='.fits') as tmpfile:
-            tbhdu.writeto(tmpfile.name, clobber=True)
+            hdu.writeto(tmpfile.name, clobber=True)
             gzfile = gzip.GzipFile(filename, 'wb')
             try:
                 try:
@@ -181,7 +196,7 @@ def write_map(filename,m,nest=False,dtype=np.float32,fits_IDL=True,coord=None,co
                 os.unlink(gzfile.name)
                 raise
     else:
-        tbhdu.writeto(filename, clobber=True)
+        hdu.writeto(filename, clobber=True)
 
 
 def gps_to_iso8601(gps_time):
@@ -217,14 +232,10 @@ def gps_to_mjd(gps_time):
     return jd - lal.XLAL_MJD_REF + gps_seconds_fraction
 
 
-def write_sky_map(filename, prob, objid=None, url=None, instruments=None,
-    gps_time=None, gps_creation_time=None, creator=None, runtime=None):
-    """Write a gravitational-wave sky map to a file, populating the header
-    with optional metadata."""
-
-    #
-    # Populate optional header fieds.
-    #
+def sky_map_metadata(objid=None, url=None, instruments=None, gps_time=None,
+    gps_creation_time=None, creator=None, runtime=None):
+    """Return a list of (keyword, value, comment) tuples for the optional
+    header fields of a sky map."""
 
     extra_metadata = []
 
@@ -259,12 +270,109 @@ def write_sky_map(filename, prob, objid=None, url=None, instruments=None,
         extra_metadata.append(('RUNTIME', runtime,
             'Runtime in seconds of the CREATOR program'))
 
-    write_map(filename, prob, nest=False, fits_IDL=True, coord='C',
-        column_names=('PROB',), unit='pix-1', extra_metadata=extra_metadata)
+    return extra_metadata
+
+
+def pyramid_filename(filename, nside):
+    """Name of the file that holds the down-sampled copy at resolution nside
+    of the sky map in filename: for example, 'foo.fits.gz' becomes
+    'foo.nside64.fits.gz'."""
+    root, sep, ext = filename.rpartition('.fits')
+    if not sep:
+        root, ext = filename, ''
+    return '%s.nside%d%s%s' % (root, nside, sep, ext)
 
 
-def read_sky_map(filename):
-    prob, header = hp.read_map(filename, h=True)
+def write_sky_map(filename, prob, distmean=None, diststd=None, nsides=(),
+        **kwargs):
+    """Write a gravitational-wave sky map to a file, populating the header
+    with optional metadata (see sky_map_metadata). If distmean and diststd are
+    given, then they are written as the additional columns DISTMEAN and
+    DISTSTD: the posterior mean and standard deviation of distance in Mpc in
+    each pixel, as returned by bayestar.sky_map.tdoa_snr with
+    return_distance=True.
+
+    For each of the resolutions in nsides, also write a copy of the sky map
+    that is down-sampled to that resolution, conserving probability, to the
+    file named by pyramid_filename. All of the copies are computed together
+    from the full resolution map by bayestar.sky_map.pyramid. Distance moments
+    do not add up across pixels, so the copies hold probability only."""
+    if (distmean is None) != (diststd is None):
+        raise ValueError("distmean and diststd must be given together")
+    if len(nsides) > 0:
+        from . import sky_map
+        # The maps are stored in single precision anyway.
+        levels = sky_map.pyramid(prob, nsides, single=True)
+        for nside, level in zip(nsides, levels):
+            write_map(pyramid_filename(filename, nside), level, nest=False,
+                fits_IDL=True, coord='C', column_names=('PROB',),
+                unit='pix-1', extra_metadata=sky_map_metadata(**kwargs))
+    if distmean is None:
+        m = prob
+        column_names = ('PROB',)
+        unit = 'pix-1'
+    else:
+        m = (prob, distmean, diststd)
+        column_names = ('PROB', 'DISTMEAN', 'DISTSTD')
+        unit = ('pix-1', 'Mpc', 'Mpc')
+    write_map(filename, m, nest=False, fits_IDL=True, coord='C',
+        column_names=column_names, unit=unit,
+        extra_metadata=sky_map_metadata(**kwargs))
+
+
+def write_sparse_sky_map(filename, nside, ipix, prob, **kwargs):
+    """Write a sparse gravitational-wave sky map, as produced by the tiled mode
+    of bayestar.sky_map.tdoa_snr, to a file. ipix are the NESTED indices of the
+    pixels that have nonzero probability and prob are their probabilities. The
+    pixels are stored with explicit indexing, so the file is only as large as
+    the support of the sky map no matter how fine the resolution is. Optional
+    metadata is as for write_sky_map."""
+    npix = hp.nside2npix(nside)
+    # FITS has no unsigned 32-bit integer type, so fall back to 64 bits for
+    # resolutions that need them.
+    if npix > np.iinfo(np.int32).max:
+        ipix_format = 'K'
+    else:
+        ipix_format = 'J'
+
+    tbhdu = pf.new_table([
+        pf.Column(name='PIXEL', format=ipix_format,
+            array=np.asarray(ipix, dtype=np.int64)),
+        pf.Column(name='PROB', format=getformat(np.float64),
+            array=np.asarray(prob), unit='pix-1')])
+    tbhdu.header.update('PIXTYPE', 'HEALPIX', 'HEALPIX pixelisation')
+    tbhdu.header.update('ORDERING', 'NESTED',
+        'Pixel ordering scheme, either RING or NESTED')
+    tbhdu.header.update('COORDSYS', 'C',
+        'Ecliptic, Galactic or Celestial (equatorial)')
+    tbhdu.header.update('EXTNAME', 'xtension',
+        'name of this binary table extension')
+    tbhdu.header.update('NSIDE', nside, 'Resolution parameter of HEALPIX')
+    tbhdu.header.update('FIRSTPIX', 0, 'First pixel # (0 based)')
+    tbhdu.header.update('LASTPIX', npix - 1, 'Last pixel # (0 based)')
+    tbhdu.header.update('INDXSCHM', 'EXPLICIT',
+        'Indexing: IMPLICIT or EXPLICIT')
+    tbhdu.header.update('OBS_NPIX', len(ipix),
+        'Number of pixels that are stored')
+
+    for metadata in sky_map_metadata(**kwargs):
+        tbhdu.header.update(*metadata)
+
+    writeto(tbhdu, filename)
+
+
+def read_sky_map(filename, distances=False):
+    """Read a sky map that was written by write_sky_map. Return the
+    probability and a dictionary of metadata. If distances is True, then
+    return a tuple of the probability, the posterior mean distance, and the
+    posterior standard deviation of distance in place of the probability; the
+    file must have been written with distmean and diststd."""
+    if distances:
+        ret = hp.read_map(filename, field=(0, 1, 2), h=True)
+        prob = ret[:-1]
+        header = ret[-1]
+    else:
+        prob, header = hp.read_map(filename, h=True)
     header = dict(header)
 
     metadata = {}
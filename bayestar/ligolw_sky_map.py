@@ -24,7 +24,6 @@ __author__ = "Leo Singer <leo.singer@ligo.org>"
 
 import time
 import numpy as np
-from . import filter
 from . import timing
 from . import sky_map
 import lal, lalsimulation
@@ -101,27 +100,184 @@ def read_psd_xmldoc(xmldoc):
 # End section copied and adapted from pylal.series.read_psd_xmldoc.
 
 
-def ligolw_sky_map(sngl_inspirals, approximant, amplitude_order, phase_order, f_low, min_distance=None, max_distance=None, prior=None, method="toa_snr", reference_frequency=None, psds=None, nside=-1):
+# Detector networks by instrument names, so that the detector data are
+# unpacked only once per process (see bayestar.sky_map.Network).
+_networks = {}
+
+
+def get_network(ifos):
+    """Return a bayestar.sky_map.Network for a sequence of instrument names.
+    Networks are cached, so this is cheap after the first call for a given
+    combination of instruments."""
+    key = tuple(str(ifo) for ifo in ifos)
+    try:
+        network = _networks[key]
+    except KeyError:
+        detectors = [lalsimulation.InstrumentNameToLALDetector(ifo)
+            for ifo in key]
+        network = _networks[key] = sky_map.Network(
+            [det.response for det in detectors],
+            [det.location for det in detectors])
+    return network
+
+
+class WarmStart(object):
+    """State that is carried from one TOA+SNR localization of an event to the
+    next. When the same event is localized again with updated triggers or
+    PSDs, pass the same WarmStart object each time. Work is reused at three
+    levels:
+
+     * The resolution that was selected in the previous run is tried first,
+       and the sky map code falls back to a full search over resolutions if
+       it no longer fits the new inputs.
+
+     * The antenna factors of each detector on the pixel grid depend only on
+       the detector and the grid, so they are kept for every detector that
+       has taken part so far. They survive updated SNRs, horizon distances,
+       and PSDs, as well as detectors joining or leaving.
+
+     * The amplitude terms of the previous run are reused for pixels that are
+       still in the support if none of the inputs that they depend on have
+       changed.
+
+    The GMST of the first localization is kept for the later ones, so that the
+    antenna factors stay valid when updated triggers move the mean time of
+    arrival. It moves by at most the light travel time between detectors,
+    during which the Earth turns by less than a microradian, which is far
+    smaller than a pixel."""
+
+    def __init__(self):
+        self.gmst = None
+        self.key = None
+        self.state = None
+        self.antenna = {}
+        self.antenna_reused = 0
+
+    def tdoa_snr(self, gmst, toas, snrs, s2_toas, responses, locations,
+            horizons, min_distance, max_distance, prior, detectors=None,
+            **kwargs):
+        """Like bayestar.sky_map.tdoa_snr. detectors identifies the
+        detectors, for example by their instrument names, and is required if
+        locations is a bayestar.sky_map.Network. After the first call, gmst is
+        ignored in favor of the GMST of the first call."""
+        if detectors is None:
+            if responses is None:
+                raise ValueError("detectors is required if locations is a Network")
+            detectors = [np.asarray(response, dtype=np.float32).tostring()
+                for response in responses]
+        detectors = tuple(detectors)
+
+        if self.gmst is None:
+            self.gmst = gmst
+        gmst = self.gmst
+
+        # Inputs that the amplitude terms depend on, besides the GMST, which
+        # is fixed, and the antenna factors, which are fixed per detector.
+        key = (tuple(snrs), tuple(horizons), min_distance, max_distance,
+            prior, detectors, tuple(sorted(kwargs.items())))
+
+        if self.state is None:
+            state = None
+        else:
+            npix, support, amplitude = self.state
+            if key != self.key:
+                amplitude = None
+            state = (npix, support, amplitude,
+                [self.antenna.get((detector, npix)) for detector in detectors])
+
+        result, (npix, support, amplitude, antenna) = sky_map.tdoa_snr(
+            gmst, toas, snrs, s2_toas, responses, locations, horizons,
+            min_distance, max_distance, prior, warm_start=state,
+            return_warm_start=True, **kwargs)
+
+        # Keep the antenna factors that were computed in this run; the others
+        # were reused. Drop any at other resolutions.
+        self.antenna_reused = sum(factors is None for factors in antenna)
+        self.antenna = dict(item for item in self.antenna.iteritems()
+            if item[0][1] == npix)
+        for detector, factors in zip(detectors, antenna):
+            if factors is not None:
+                self.antenna[(detector, npix)] = factors
+
+        self.state = (npix, support, amplitude)
+        self.key = key
+        return result
+
+
+def ligolw_sky_map(sngl_inspirals, approximant, amplitude_order, phase_order, f_low, min_distance=None, max_distance=None, prior=None, method="toa_snr", reference_frequency=None, psds=None, nside=-1, tabulated=False, warm_start=None, max_bytes=None, distances=False, split_tolerance=0, cache=None):
     """Convenience function to produce a sky map from LIGO-LW rows. Note that
-    min_distance and max_distance should be in Mpc."""
+    min_distance and max_distance should be in Mpc. If tabulated is True, then
+    interpolate horizon distances and timing uncertainties from persistent
+    tables (see bayestar.signal_model_table) instead of computing them from
+    scratch. The sngl_inspirals may be LIGO-LW rows or a record array as
+    returned by bayestar.ligolw_columns.read_coincs. If warm_start is a
+    WarmStart object, then reuse work from the
+    previous localization of the same event and update it for the next one.
+
+    If max_bytes is given, then the TOA+SNR sky map is computed at the fixed
+    resolution nside in tiles, using at most about max_bytes of memory, and
+    the returned sky map is sparse: a tuple of the NESTED indices of the pixels
+    in its support and their probabilities (see
+    bayestar.fits.write_sparse_sky_map). If the credible region does not fit
+    in max_bytes, then sky_map.MemoryBudgetError is raised.
+
+    If distances is True, then the TOA+SNR sky map is a tuple of the
+    probability, the posterior mean distance, and the posterior standard
+    deviation of distance in each pixel, in Mpc (see
+    bayestar.fits.write_sky_map). These are found in the same pass as the
+    probability.
+
+    If split_tolerance is positive, then the amplitude term of the TOA+SNR sky
+    map is evaluated on the coarsest grid from which it can be interpolated to
+    within that error in its logarithm (see bayestar.sky_map.tdoa_snr).
+
+    If cache is a bayestar.result_cache.ResultCache, then a sky map that was
+    computed before from identical inputs is returned from the cache, and a
+    newly computed sky map is stored in it."""
 
     if method == "toa_snr" and prior is None:
         raise ValueError("For method='toa_snr', the argument prior is required.")
-
-    ifos = [sngl_inspiral.ifo for sngl_inspiral in sngl_inspirals]
-
-    # Extract masses from the table.
-    mass1s = np.asarray([sngl_inspiral.mass1 for sngl_inspiral in sngl_inspirals])
-    mass2s = np.asarray([sngl_inspiral.mass2 for sngl_inspiral in sngl_inspirals])
-
-    # Extract SNRs from table.
-    # FIXME: should get complex SNR, but MBTAOnline events don't populate the
-    # coa_phase column, and we are not using coa_phase yet.
-    snrs = np.asarray([sngl_inspiral.snr for sngl_inspiral in sngl_inspirals])
-
-    # Extract TOAs from table.
-    toas_ns = np.asarray([sngl_inspiral.get_end().ns()
-        for sngl_inspiral in sngl_inspirals], dtype=np.int64)
+    if distances and (method != "toa_snr" or max_bytes is not None):
+        raise ValueError("Distances are only available for method='toa_snr' without max_bytes.")
+
+    if isinstance(sngl_inspirals, np.ndarray):
+        # Columns from bayestar.ligolw_columns.
+        ifos = list(sngl_inspirals['ifo'])
+        mass1s = sngl_inspirals['mass1']
+        mass2s = sngl_inspirals['mass2']
+        snrs = sngl_inspirals['snr']
+        toas_ns = sngl_inspirals['end_time_ns'].copy()
+    else:
+        ifos = [sngl_inspiral.ifo for sngl_inspiral in sngl_inspirals]
+
+        # Extract masses from the table.
+        mass1s = np.asarray([sngl_inspiral.mass1 for sngl_inspiral in sngl_inspirals])
+        mass2s = np.asarray([sngl_inspiral.mass2 for sngl_inspiral in sngl_inspirals])
+
+        # Extract SNRs from table.
+        # FIXME: should get complex SNR, but MBTAOnline events don't populate the
+        # coa_phase column, and we are not using coa_phase yet.
+        snrs = np.asarray([sngl_inspiral.snr for sngl_inspiral in sngl_inspirals])
+
+        # Extract TOAs from table.
+        toas_ns = np.asarray([sngl_inspiral.get_end().ns()
+            for sngl_inspiral in sngl_inspirals], dtype=np.int64)
+
+    # Look for an earlier result from identical inputs.
+    if cache is not None:
+        from .signal_model_table import psd_digest
+        cache_key = cache.key(ifos=ifos, mass1s=mass1s, mass2s=mass2s,
+            snrs=snrs, toas_ns=toas_ns, approximant=approximant,
+            amplitude_order=amplitude_order, phase_order=phase_order,
+            f_low=f_low, min_distance=min_distance,
+            max_distance=max_distance, prior=prior, method=method,
+            reference_frequency=reference_frequency,
+            psds=None if psds is None else [psd_digest(psd, f_low) for psd in psds],
+            nside=nside, tabulated=tabulated, max_bytes=max_bytes,
+            distances=distances, split_tolerance=split_tolerance)
+        result = cache.get(cache_key)
+        if result is not None:
+            return result
 
     # Optionally apply reference frequency shift.
     if reference_frequency is not None:
@@ -144,24 +300,37 @@ def ligolw_sky_map(sngl_inspirals, approximant, amplitude_order, phase_order, f_
     if psds is None:
         psds = [timing.get_noise_psd_func(ifo) for ifo in ifos]
 
-    # Signal models for each detector.
-    signal_models = [timing.SignalModel(mass1, mass2, psd, f_low, approximant, amplitude_order, phase_order)
-        for mass1, mass2, psd in zip(mass1s, mass2s, psds)]
+    if tabulated:
+        from .signal_model_table import SignalModelTable
+
+        # Tabulated signal models for each detector.
+        tables = [SignalModelTable(psd, f_low, approximant, amplitude_order, phase_order)
+            for psd in psds]
+
+        # Get SNR=1 horizon distances for each detector.
+        horizons = [table.get_horizon_distance(mass1, mass2)
+            for table, mass1, mass2 in zip(tables, mass1s, mass2s)]
+
+        # Estimate TOA uncertainty (squared) evaluated at MEASURED values of
+        # the SNRs.
+        s2_toas = [np.square(table.get_toa_uncert(mass1, mass2, np.abs(snr)))
+            for table, mass1, mass2, snr in zip(tables, mass1s, mass2s, snrs)]
+    else:
+        # Signal models for each detector.
+        signal_models = [timing.SignalModel(mass1, mass2, psd, f_low, approximant, amplitude_order, phase_order)
+            for mass1, mass2, psd in zip(mass1s, mass2s, psds)]
 
-    # Get SNR=1 horizon distances for each detector.
-    horizons = [signal_model.get_horizon_distance()
-        for signal_model in signal_models]
+        # Get SNR=1 horizon distances for each detector.
+        horizons = [signal_model.get_horizon_distance()
+            for signal_model in signal_models]
 
-    # Estimate TOA uncertainty (squared) using CRB or BRB evaluated at MEASURED
-    # values of the SNRs.
-    s2_toas = [np.square(signal_model.get_toa_uncert(np.abs(snr)))
-        for signal_model, snr in zip(signal_models, snrs)]
+        # Estimate TOA uncertainty (squared) using CRB or BRB evaluated at
+        # MEASURED values of the SNRs.
+        s2_toas = [np.square(signal_model.get_toa_uncert(np.abs(snr)))
+            for signal_model, snr in zip(signal_models, snrs)]
 
     # Look up physical parameters for detector.
-    detectors = [lalsimulation.InstrumentNameToLALDetector(str(ifo))
-        for ifo in ifos]
-    responses = [det.response for det in detectors]
-    locations = [det.location for det in detectors]
+    network = get_network(ifos)
 
     # Use half the minimum effective distance as the default value for
     # min_distance and twice the maximum effective distance as the default
@@ -176,9 +345,13 @@ def ligolw_sky_map(sngl_inspirals, approximant, amplitude_order, phase_order, f_
     # Time and run sky localization.
     start_time = time.time()
     if method == "toa":
-        prob = sky_map.tdoa(gmst, toas, s2_toas, locations, nside=nside)
+        prob = sky_map.tdoa(gmst, toas, s2_toas, network, nside=nside)
+    elif method == "toa_snr" and max_bytes is not None:
+        prob = sky_map.tdoa_snr(gmst, toas, snrs, s2_toas, None, network, horizons, min_distance, max_distance, prior, nside=nside, max_bytes=max_bytes)
+    elif method == "toa_snr" and warm_start is not None:
+        prob = warm_start.tdoa_snr(gmst, toas, snrs, s2_toas, None, network, horizons, min_distance, max_distance, prior, detectors=[str(ifo) for ifo in ifos], nside=nside, return_distance=distances, split_tolerance=split_tolerance)
     elif method == "toa_snr":
-        prob = sky_map.tdoa_snr(gmst, toas, snrs, s2_toas, responses, locations, horizons, min_distance, max_distance, prior, nside=nside)
+        prob = sky_map.tdoa_snr(gmst, toas, snrs, s2_toas, None, network, horizons, min_distance, max_distance, prior, nside=nside, return_distance=distances, split_tolerance=split_tolerance)
     else:
         raise ValueError("Unrecognized method: %s" % method)
     end_time = time.time()
@@ -186,19 +359,21 @@ def ligolw_sky_map(sngl_inspirals, approximant, amplitude_order, phase_order, f_
     # Find elapsed run time.
     elapsed_time = end_time - start_time
 
+    if cache is not None:
+        cache.put(cache_key, (prob, epoch, elapsed_time))
+
     # Done!
     return prob, epoch, elapsed_time
 
 
-def gracedb_sky_map(coinc_file, psd_file, waveform, f_low, min_distance=None, max_distance=None, prior=None, reference_frequency=None, nside=-1):
+def gracedb_sngl_inspirals(coinc_file):
+    """Read the sngl_inspiral rows that belong to the first coinc_inspiral
+    record in a GraceDb coinc.xml file."""
     # LIGO-LW XML imports.
     from glue.ligolw import table as ligolw_table
     from glue.ligolw import utils as ligolw_utils
     from glue.ligolw import lsctables
 
-    # Determine approximant, amplitude order, and phase order from command line arguments.
-    approximant, amplitude_order, phase_order = timing.get_approximant_and_orders_from_string(waveform)
-
     # Read input file.
     xmldoc, _ = ligolw_utils.load_fileobj(coinc_file)
 
@@ -215,23 +390,60 @@ def gracedb_sky_map(coinc_file, psd_file, waveform, f_low, min_distance=None, ma
     coinc_event_id = coinc_inspiral.coinc_event_id
     event_ids = [coinc_map.event_id for coinc_map in coinc_map_table
         if coinc_map.coinc_event_id == coinc_event_id]
-    sngl_inspirals = [(sngl_inspiral for sngl_inspiral in sngl_inspiral_table
+    return [(sngl_inspiral for sngl_inspiral in sngl_inspiral_table
         if sngl_inspiral.event_id == event_id).next() for event_id in event_ids]
 
-    # Read PSDs.
-    if psd_file is None:
-        psds = None
-    else:
-        xmldoc, _ = ligolw_utils.load_fileobj(psd_file)
-        psds = read_psd_xmldoc(xmldoc)
 
-        # Rearrange PSDs into the same order as the sngl_inspirals.
-        psds = [psds[sngl_inspiral.ifo] for sngl_inspiral in sngl_inspirals]
+def gracedb_psds(psd_file, cache_dir=None):
+    """Read a GraceDb psd.xml.gz file and return a dictionary that maps
+    instrument names to interpolated PSDs. The PSDs are loaded from the
+    binary PSD store in cache_dir (see bayestar.psd_cache), so that the file is
+    parsed only the first time that its contents are seen."""
+    from . import psd_cache
+    return psd_cache.psds_for_fileobj(psd_file, cache_dir)
+
+
+def gracedb_sky_map_for_sngl_inspirals(sngl_inspirals, psds, waveform, f_low, min_distance=None, max_distance=None, prior=None, reference_frequency=None, nside=-1, warm_start=None, cache=None):
+    """Produce a sky map from sngl_inspiral rows (or a record array from
+    bayestar.ligolw_columns) and a dictionary of interpolated PSDs, as
+    returned by gracedb_sngl_inspirals and gracedb_psds. If psds is None, then
+    use model PSDs."""
+
+    # Determine approximant, amplitude order, and phase order from command line arguments.
+    approximant, amplitude_order, phase_order = timing.get_approximant_and_orders_from_string(waveform)
 
-        # Interpolate PSDs.
-        psds = [timing.InterpolatedPSD(filter.abscissa(psd), psd.data.data) for psd in psds]
+    # Rearrange PSDs into the same order as the sngl_inspirals.
+    if psds is not None:
+        if isinstance(sngl_inspirals, np.ndarray):
+            ifos = sngl_inspirals['ifo']
+        else:
+            ifos = [sngl_inspiral.ifo for sngl_inspiral in sngl_inspirals]
+        psds = [psds[ifo] for ifo in ifos]
 
     # TOA+SNR sky localization
     return ligolw_sky_map(sngl_inspirals, approximant, amplitude_order, phase_order, f_low,
         min_distance, max_distance, prior,
-        reference_frequency=reference_frequency, nside=nside, psds=psds)
+        reference_frequency=reference_frequency, nside=nside, psds=psds,
+        warm_start=warm_start, cache=cache)
+
+
+def gracedb_sky_map(coinc_file, psd_file, waveform, f_low, min_distance=None, max_distance=None, prior=None, reference_frequency=None, nside=-1, psd_cache_dir=None, warm_start=None, cache=None):
+    from .ligolw_columns import read_coincs
+
+    # Read input file; use the first coincidence.
+    coincs = read_coincs(coinc_file)
+    if len(coincs) == 0:
+        raise ValueError("coinc file does not contain any coincidences")
+    _, sngl_inspirals = coincs[0]
+
+    # Read PSDs.
+    if psd_file is None:
+        psds = None
+    else:
+        psds = gracedb_psds(psd_file, psd_cache_dir)
+
+    # TOA+SNR sky localization
+    return gracedb_sky_map_for_sngl_inspirals(sngl_inspirals, psds, waveform,
+        f_low, min_distance, max_distance, prior,
+        reference_frequency=reference_frequency, nside=nside,
+        warm_start=warm_start, cache=cache)
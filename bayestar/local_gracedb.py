@@ -0,0 +1,126 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+A stand-in for the GraceDb client that keeps events in a local directory, so
+that alert handling can be exercised and benchmarked without a network
+connection. Each event is a subdirectory of the root directory whose name is
+the GraceDb ID. Files that are uploaded by the pipeline, such as coinc.xml and
+psd.xml.gz, are ordinary files in that subdirectory. Uploaded files are stored
+alongside them, and log messages and labels are appended to the files named
+'log' and 'labels'.
+
+The methods mirror the subset of ligo.gracedb.rest.GraceDb that BAYESTAR uses.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import json
+import logging
+import os
+import shutil
+import time
+from cStringIO import StringIO
+
+
+class HTTPError(Exception):
+    """Raised when a requested file does not exist, in the same way that
+    ligo.gracedb.rest.GraceDb raises an HTTP 404 error."""
+
+    def __init__(self, status, reason):
+        super(HTTPError, self).__init__(status, reason)
+        self.status = status
+        self.reason = reason
+
+
+class GraceDb(object):
+    """Local stand-in for ligo.gracedb.rest.GraceDb.
+
+    To imitate a remote server, every request can be made to take latency
+    seconds (or upload_latency seconds for writeFile, if given). The optional
+    arrival_delays dictionary maps file names to the number of seconds after
+    construction of this object before the file becomes visible to files(),
+    imitating files that are uploaded some time after the alert is sent."""
+
+    def __init__(self, root, latency=0, upload_latency=None,
+            arrival_delays=None):
+        self.root = root
+        self.latency = latency
+        if upload_latency is None:
+            upload_latency = latency
+        self.upload_latency = upload_latency
+        self.arrival_delays = dict(arrival_delays or {})
+        self.start_time = time.time()
+
+    def _wait(self, latency):
+        if latency > 0:
+            time.sleep(latency)
+
+    def _path(self, graceid, filename=None):
+        path = os.path.join(self.root, str(graceid))
+        if filename is not None:
+            path = os.path.join(path, os.path.basename(filename))
+        return path
+
+    def _append(self, graceid, filename, line):
+        dirname = self._path(graceid)
+        if not os.path.isdir(dirname):
+            os.makedirs(dirname)
+        with open(self._path(graceid, filename), 'a') as f:
+            print >>f, line
+
+    def files(self, graceid, filename):
+        """Open a file that is attached to an event."""
+        self._wait(self.latency)
+        delay = self.arrival_delays.get(os.path.basename(filename), 0)
+        if time.time() - self.start_time < delay:
+            raise HTTPError(404, 'Not Found')
+        try:
+            return open(self._path(graceid, filename), 'rb')
+        except IOError:
+            raise HTTPError(404, 'Not Found')
+
+    def writeFile(self, graceid, filename):
+        """Attach a file to an event. Returns a file-like object containing a
+        JSON response, like the GraceDb REST API does."""
+        self._wait(self.upload_latency)
+        path = self._path(graceid, filename)
+        shutil.copyfile(filename, path)
+        return StringIO(json.dumps({'permalink': 'file://' + os.path.abspath(path)}))
+
+    def writeLog(self, graceid, message, *args, **kwargs):
+        """Add a log message to an event."""
+        self._wait(self.latency)
+        self._append(graceid, 'log', '%.3f %s' % (time.time(), message))
+
+    def writeLabel(self, graceid, label):
+        """Apply a label to an event."""
+        self._wait(self.latency)
+        self._append(graceid, 'labels', label)
+
+
+class GraceDbLogHandler(logging.Handler):
+    """Send log messages to an event's log, like
+    ligo.gracedb.logging.GraceDbLogHandler."""
+
+    def __init__(self, gracedb, graceid):
+        logging.Handler.__init__(self)
+        self.gracedb = gracedb
+        self.graceid = graceid
+
+    def emit(self, record):
+        self.gracedb.writeLog(self.graceid, self.format(record))
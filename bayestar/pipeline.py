@@ -0,0 +1,295 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Pipelined handling of GraceDb alerts. Every event passes through three
+stages, each of which runs in its own threads so that the stages of
+successive events overlap:
+
+ 1. Retrieval. The coinc.xml and psd.xml.gz files are polled for and parsed
+    concurrently, and the event moves on as soon as the coinc.xml file is
+    ready, without waiting for the PSD.
+ 2. Localization. A single thread runs the sky localization itself, which is
+    already parallelized with OpenMP and releases the GIL while it runs. It
+    uses the PSD if it has arrived by then (waiting for it at most a few
+    seconds); otherwise it starts with model PSDs, and the event is
+    localized again when the PSD arrives.
+ 3. Publication. Writing and compressing the FITS file and uploading it run
+    while the localization thread moves on to the next event.
+
+The work that is done in each stage is supplied by the caller, so that the
+pipeline can be exercised with a fake GraceDb and fake localizations.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import logging
+import sys
+import threading
+import time
+import Queue
+
+
+log = logging.getLogger('BAYESTAR')
+
+
+class DownloadNotFoundError(Exception):
+    pass
+
+
+def poll_for_download(gracedb, graceid, filename, http_error, timeout=31,
+        initial_interval=0.05, max_interval=1, backoff=1.5):
+    """Poll GraceDb for a file until it arrives. The polling interval starts
+    at initial_interval seconds and grows geometrically up to max_interval
+    seconds, so that a file that arrives shortly after the alert is picked up
+    promptly. Raise DownloadNotFoundError if the file has not arrived after
+    timeout seconds."""
+    deadline = time.time() + timeout
+    interval = initial_interval
+    log.debug("%s:%s:waiting for file to arrive", graceid, filename)
+    while True:
+        try:
+            fileobj = gracedb.files(graceid, filename)
+        except http_error:
+            remaining = deadline - time.time()
+            if remaining <= 0:
+                raise DownloadNotFoundError(filename)
+            time.sleep(min(interval, remaining))
+            interval = min(interval * backoff, max_interval)
+        else:
+            log.debug('%s:%s:downloaded', graceid, filename)
+            return fileobj
+
+
+class _PsdFuture(object):
+    """The outcome of retrieving an event's PSD file, which is filled in by a
+    retrieval thread while the event may already be waiting to be localized
+    or may already have been localized with model PSDs."""
+
+    def __init__(self):
+        self._event = threading.Event()
+        self.psds = None
+        self.exc_info = None
+
+    def set(self, psds=None, exc_info=None):
+        self.psds = psds
+        self.exc_info = exc_info
+        self._event.set()
+
+    def wait(self, timeout=None):
+        """Wait for the PSD file to be retrieved or given up on. Return True
+        if it has been, or False if the timeout expired first."""
+        self._event.wait(timeout)
+        return self._event.is_set()
+
+
+class _Alert(object):
+    """The state of an event as it passes through the pipeline."""
+
+    def __init__(self, graceid):
+        self.graceid = graceid
+        self.coinc = None
+        self.psd = _PsdFuture()
+        self.deadline = None
+        self.preliminary = False
+        self.published = False
+
+
+class EventLogFilter(logging.Filter):
+    """Pass only the log messages that concern a particular event, i.e., that
+    start with the event's GraceDb ID followed by a colon. Attach this to a
+    GraceDb log handler when several events are in flight at once."""
+
+    def __init__(self, graceid):
+        logging.Filter.__init__(self)
+        self.prefix = str(graceid) + ':'
+
+    def filter(self, record):
+        return record.getMessage().startswith(self.prefix)
+
+
+class AlertPipeline(object):
+    """Overlapped retrieval, localization, and publication of GraceDb events.
+
+    parse_coinc(fileobj) and parse_psd(fileobj) turn the downloaded files
+    into whatever localize(graceid, coinc, psds) expects; psds is None if
+    model PSDs are to be used. publish(graceid, result) receives the return
+    value of localize.
+
+    If the PSD file has not arrived psd_wait seconds after the coinc.xml
+    file, then the event is localized with model PSDs and that preliminary
+    sky map is published. Once the PSD file arrives, the event is localized
+    again and publish is called a second time with the refined sky map. If
+    the PSD file never arrives, the preliminary sky map stands."""
+
+    def __init__(self, gracedb, http_error, parse_coinc, parse_psd, localize,
+            publish, coinc_filename="coinc.xml", psd_filename="psd.xml.gz",
+            download_timeout=31, psd_wait=5, publish_threads=2):
+        self.gracedb = gracedb
+        self.http_error = http_error
+        self.parse_coinc = parse_coinc
+        self.parse_psd = parse_psd
+        self.localize = localize
+        self.publish = publish
+        self.coinc_filename = coinc_filename
+        self.psd_filename = psd_filename
+        self.download_timeout = download_timeout
+        self.psd_wait = psd_wait
+        self.publish_threads = publish_threads
+
+        # Final status of each event: 'ok' if a sky map was published, or
+        # 'error'.
+        self.status = {}
+
+        self._compute_queue = Queue.Queue()
+        self._publish_queue = Queue.Queue()
+        self._pending = 0
+        self._cond = threading.Condition()
+        self._threads = []
+
+    def _start_thread(self, target, *args):
+        thread = threading.Thread(target=target, args=args)
+        thread.daemon = True
+        thread.start()
+        return thread
+
+    def start(self):
+        """Start the localization and publication threads."""
+        self._threads.append(self._start_thread(self._compute_loop))
+        for _ in range(self.publish_threads):
+            self._threads.append(self._start_thread(self._publish_loop))
+
+    def stop(self):
+        """Wait for all submitted events to finish, then stop all threads."""
+        self.join()
+        self._compute_queue.put(None)
+        for _ in range(self.publish_threads):
+            self._publish_queue.put(None)
+        for thread in self._threads:
+            thread.join()
+        del self._threads[:]
+
+    def submit(self, graceid):
+        """Start processing an event."""
+        with self._cond:
+            self._pending += 1
+        self._start_thread(self._fetch, graceid)
+
+    def join(self):
+        """Wait until every submitted event has been published or has
+        failed."""
+        with self._cond:
+            while self._pending:
+                # Wait with a timeout so that KeyboardInterrupt gets through.
+                self._cond.wait(1)
+
+    def _finish(self, graceid, status):
+        with self._cond:
+            self.status[graceid] = status
+            self._pending -= 1
+            self._cond.notify_all()
+
+    def _download(self, graceid, filename):
+        return poll_for_download(self.gracedb, graceid, filename,
+            self.http_error, timeout=self.download_timeout)
+
+    def _fetch(self, graceid):
+        alert = _Alert(graceid)
+
+        def fetch_psd():
+            try:
+                fileobj = self._download(graceid, self.psd_filename)
+            except DownloadNotFoundError as e:
+                log.warn("%s:%s:file not found, assuming aLIGO/AdvVirgo model PSDs", graceid, e.args[0])
+                alert.psd.set()
+            except:
+                alert.psd.set(exc_info=sys.exc_info())
+            else:
+                try:
+                    alert.psd.set(self.parse_psd(fileobj))
+                except:
+                    alert.psd.set(exc_info=sys.exc_info())
+
+        self._start_thread(fetch_psd)
+        try:
+            alert.coinc = self.parse_coinc(self._download(graceid, self.coinc_filename))
+        except DownloadNotFoundError as e:
+            log.error("%s:%s:file not found, giving up on this event", graceid, e.args[0])
+            self._finish(graceid, 'error')
+        except:
+            log.exception("%s:failed to retrieve event", graceid)
+            self._finish(graceid, 'error')
+        else:
+            alert.deadline = time.time() + self.psd_wait
+            self._compute_queue.put(alert)
+
+    def _refine(self, alert):
+        # Called once the preliminary sky map has been published, so that the
+        # refined sky map is always published after it.
+        alert.psd.wait()
+        if alert.psd.exc_info is not None:
+            log.error("%s:failed to retrieve PSD, keeping preliminary sky map", alert.graceid, exc_info=alert.psd.exc_info)
+            self._finish(alert.graceid, 'ok' if alert.published else 'error')
+        elif alert.psd.psds is None:
+            self._finish(alert.graceid, 'ok' if alert.published else 'error')
+        else:
+            log.info("%s:%s:file arrived, refining sky map", alert.graceid, self.psd_filename)
+            self._compute_queue.put(alert)
+
+    def _compute_loop(self):
+        while True:
+            alert = self._compute_queue.get()
+            if alert is None:
+                break
+            graceid = alert.graceid
+            if alert.psd.wait(max(0, alert.deadline - time.time())):
+                if alert.psd.exc_info is not None:
+                    log.error("%s:failed to retrieve PSD", graceid, exc_info=alert.psd.exc_info)
+                    self._finish(graceid, 'error')
+                    continue
+                alert.preliminary = False
+                psds = alert.psd.psds
+            else:
+                log.info("%s:%s:file has not arrived yet, starting with model PSDs", graceid, self.psd_filename)
+                alert.preliminary = True
+                psds = None
+            log.info("%s:starting sky localization", graceid)
+            try:
+                result = self.localize(graceid, alert.coinc, psds)
+            except:
+                log.exception("%s:sky localization failed", graceid)
+                self._finish(graceid, 'ok' if alert.published else 'error')
+            else:
+                log.info("%s:sky localization complete", graceid)
+                self._publish_queue.put((alert, result))
+
+    def _publish_loop(self):
+        while True:
+            item = self._publish_queue.get()
+            if item is None:
+                break
+            alert, result = item
+            try:
+                self.publish(alert.graceid, result)
+            except:
+                log.exception("%s:failed to publish sky map", alert.graceid)
+            else:
+                alert.published = True
+            if alert.preliminary:
+                self._start_thread(self._refine, alert)
+            else:
+                self._finish(alert.graceid, 'ok' if alert.published else 'error')
@@ -0,0 +1,281 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Content-addressed, memory-mapped store of noise power spectral densities.
+
+Parsing PSDs out of LIGO-LW XML is slow compared to everything else that
+happens before a localization starts. This module parses each distinct PSD
+file only once, and stores each PSD that it contains as a NumPy array on
+disk under the SHA-1 digest of its contents. After that, loading the PSD is
+just a memory map of the array. Because the arrays are mapped read-only,
+several processes that use the same PSDs share a single copy of them in
+the page cache.
+
+Each PSD is stored as a (4, n) array of doubles. The rows are the frequency
+f, the PSD S(f), and log f and log S, which are the abscissa and ordinate of
+the log-log linear interpolant. Only samples with positive, finite f and
+S(f) are kept; outside of that range, the PSD is taken to be infinite, as
+for timing.InterpolatedPSD.
+
+PSD files are indexed by the SHA-1 digest of their raw bytes, so recognizing
+a file that has been seen before costs only a hash.
+
+Entries are touched whenever they are used. When the total size of the store
+exceeds its bound, the least recently used entries are removed; a PSD file
+whose PSDs have been removed is simply parsed again the next time.
+
+The store lives in the directory named by the BAYESTAR_PSD_CACHE
+environment variable, or in ~/.cache/bayestar/psd by default.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import errno
+import hashlib
+import json
+import logging
+import os
+import tempfile
+from cStringIO import StringIO
+import numpy as np
+from .decorator import memoized
+
+
+log = logging.getLogger('BAYESTAR')
+
+# Default bound on the total size of the store in bytes.
+default_max_bytes = 256 << 20
+
+
+def default_cache_dir():
+    """Return the directory that the store uses if none is given."""
+    try:
+        return os.environ['BAYESTAR_PSD_CACHE']
+    except KeyError:
+        return os.path.join(os.path.expanduser('~'), '.cache', 'bayestar', 'psd')
+
+
+def makedirs(dirname):
+    """Create a directory and its parents, unless it already exists."""
+    try:
+        os.makedirs(dirname)
+    except OSError as e:
+        if e.errno != errno.EEXIST:
+            raise
+
+
+def atomic_write(path, write):
+    """Call write(fileobj) on a temporary file in the same directory as path,
+    then rename it into place, so that concurrent readers never see a
+    partially written file."""
+    dirname = os.path.dirname(path)
+    fd, tmppath = tempfile.mkstemp(dir=dirname, prefix='.tmp')
+    try:
+        with os.fdopen(fd, 'wb') as f:
+            write(f)
+        os.rename(tmppath, path)
+    except:
+        os.remove(tmppath)
+        raise
+
+
+def touch(path):
+    """Set the modification time of a file to now, to record its use for
+    eviction. Return False if the file does not exist. Other errors, such as
+    a store that is shared read-only, are ignored."""
+    try:
+        os.utime(path, None)
+    except OSError as e:
+        return e.errno != errno.ENOENT
+    return True
+
+
+def evict_lru(dirname, max_bytes, suffixes):
+    """Remove the least recently modified files in dirname whose names end
+    with one of suffixes until their total size is at most max_bytes. Files
+    that other processes remove at the same time are skipped. Return the
+    paths of the files that were removed."""
+    try:
+        names = os.listdir(dirname)
+    except OSError as e:
+        if e.errno != errno.ENOENT:
+            raise
+        return []
+
+    entries = []
+    for name in names:
+        if not name.endswith(suffixes):
+            continue
+        path = os.path.join(dirname, name)
+        try:
+            st = os.stat(path)
+        except OSError as e:
+            if e.errno != errno.ENOENT:
+                raise
+            continue
+        entries.append((st.st_mtime, st.st_size, path))
+
+    removed = []
+    total = sum(size for _, size, _ in entries)
+    for _, size, path in sorted(entries):
+        if total <= max_bytes:
+            break
+        try:
+            os.remove(path)
+        except OSError as e:
+            if e.errno != errno.ENOENT:
+                raise
+        else:
+            removed.append(path)
+        total -= size
+    return removed
+
+
+class CachedPSD(object):
+    """Log-log linear interpolant of a PSD that is stored in a (4, n) array,
+    which is usually memory-mapped from the store. Behaves like
+    timing.InterpolatedPSD."""
+
+    def __init__(self, data, digest=None):
+        self.data = data
+        self.digest = digest
+        self.f = data[0]
+        self.S = data[1]
+        self._log_f = data[2]
+        self._log_S = data[3]
+        self._f_min = self.f[0]
+        self._f_max = self.f[-1]
+
+    def __call__(self, f):
+        f = np.asarray(f)
+        f_min = np.min(f)
+        f_max = np.max(f)
+        if f_min < self._f_min:
+            log.warn("Assuming PSD is infinite at %g Hz because PSD is only sampled down to %g Hz", f_min, self._f_min)
+        if f_max > self._f_max:
+            log.warn("Assuming PSD is infinite at %g Hz because PSD is only sampled up to %g Hz", f_max, self._f_max)
+        with np.errstate(divide='ignore'):
+            log_f = np.log(f)
+        return np.exp(np.interp(log_f, self._log_f, self._log_S,
+            left=np.inf, right=np.inf))
+
+
+def psd_array(f, S):
+    """Build the (4, n) array that represents a sampled PSD in the store."""
+    f = np.asarray(f, dtype=float)
+    S = np.asarray(S, dtype=float)
+    keep = (f > 0) & (S > 0) & np.isfinite(f) & np.isfinite(S)
+    f = f[keep]
+    S = S[keep]
+    if len(f) < 2:
+        raise ValueError("PSD must have at least two positive, finite samples")
+    return np.ascontiguousarray(np.vstack((f, S, np.log(f), np.log(S))))
+
+
+def store(f, S, cache_dir=None):
+    """Add a sampled PSD to the store, and return its digest."""
+    if cache_dir is None:
+        cache_dir = default_cache_dir()
+    data = psd_array(f, S)
+    digest = hashlib.sha1(data[:2].tostring()).hexdigest()
+    path = os.path.join(cache_dir, digest + '.npy')
+    if not os.path.exists(path):
+        makedirs(cache_dir)
+        atomic_write(path, lambda f: np.save(f, data))
+    return digest
+
+
+@memoized
+def load(digest, cache_dir=None):
+    """Memory-map a PSD from the store. Within a process, loading the same
+    digest again returns the same object, so that memoized signal models
+    that depend on the PSD are reused too."""
+    if cache_dir is None:
+        cache_dir = default_cache_dir()
+    path = os.path.join(cache_dir, digest + '.npy')
+    return CachedPSD(np.load(path, mmap_mode='r'), digest)
+
+
+def evict(cache_dir=None, max_bytes=default_max_bytes):
+    """Remove the least recently used PSDs and PSD file indices until the
+    total size of the store is at most max_bytes."""
+    if cache_dir is None:
+        cache_dir = default_cache_dir()
+    for path in evict_lru(cache_dir, max_bytes, ('.npy', '.json')):
+        log.debug('%s:evicted from PSD cache', path)
+
+
+def _index_path(cache_dir, file_digest):
+    return os.path.join(cache_dir, 'xml-' + file_digest + '.json')
+
+
+def psds_for_fileobj(fileobj, cache_dir=None, max_bytes=default_max_bytes):
+    """Return a dictionary mapping instrument names to PSDs for an
+    (optionally gzip-compressed) LIGO-LW XML PSD file. The file is parsed
+    only if the store has not seen a file with the same contents before, or
+    if its PSDs have since been evicted. Afterwards, the store is trimmed to
+    max_bytes."""
+    if cache_dir is None:
+        cache_dir = default_cache_dir()
+
+    contents = fileobj.read()
+    file_digest = hashlib.sha1(contents).hexdigest()
+    index_path = _index_path(cache_dir, file_digest)
+
+    try:
+        with open(index_path) as f:
+            digests = json.load(f)
+    except IOError as e:
+        if e.errno != errno.ENOENT:
+            raise
+        digests = None
+    else:
+        log.debug('%s:PSD file found in cache', file_digest)
+        if all(touch(os.path.join(cache_dir, digest + '.npy'))
+                for digest in digests.itervalues()):
+            touch(index_path)
+        else:
+            log.debug('%s:PSDs were evicted from cache', file_digest)
+            digests = None
+
+    if digests is None:
+        # Late imports, so that the store can be read without glue.
+        from glue.ligolw import utils as ligolw_utils
+        from . import filter
+        from .ligolw_sky_map import read_psd_xmldoc
+
+        log.debug('%s:parsing PSD file', file_digest)
+        makedirs(cache_dir)
+        xmldoc, _ = ligolw_utils.load_fileobj(StringIO(contents))
+        digests = dict(
+            (ifo, store(filter.abscissa(psd), psd.data.data, cache_dir))
+            for ifo, psd in read_psd_xmldoc(xmldoc).iteritems()
+            if psd is not None)
+        atomic_write(index_path, lambda f: json.dump(digests, f))
+        evict(cache_dir, max_bytes)
+
+    return dict((str(ifo), load(digest, cache_dir))
+        for ifo, digest in digests.iteritems())
+
+
+@memoized
+def psds_for_filename(filename, cache_dir=None):
+    """Like psds_for_fileobj, but for a named file. Memoized, so that a file is
+    read at most once per process."""
+    with open(filename, 'rb') as f:
+        return psds_for_fileobj(f, cache_dir)
@@ -0,0 +1,216 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Batched realization of simulated triggers for bayestar_realize_coincs.
+
+Injections are grouped by their masses, low-frequency cutoff, and waveform,
+so that the signal model for each detector is built once per group. Antenna
+factors, times of arrival, and SNRs are computed for a whole group at once
+with array arithmetic. Groups may be farmed out to worker processes.
+
+Measurement noise for each injection is drawn from its own random number
+stream, seeded by the campaign seed and the injection's index in the input
+table. The realization of any given injection is therefore the same no
+matter how many processes are used or how the injections are grouped.
+"""
+from __future__ import division
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import itertools
+import multiprocessing
+import numpy as np
+import lal, lalsimulation
+from . import timing
+
+
+def antenna_factors(response, ra, dec, gmst):
+    """Compute the antenna factors F+ and Fx of a detector with the given
+    response tensor for arrays of sky positions, at zero polarization angle.
+    Equivalent to calling lal.ComputeDetAMResponse for each sky position."""
+    response = np.asarray(response)
+    gha = gmst - ra
+    cosgha = np.cos(gha)
+    singha = np.sin(gha)
+    cosdec = np.cos(dec)
+    sindec = np.sin(dec)
+    X = np.asarray((-singha, -cosgha, np.zeros_like(gha)))
+    Y = np.asarray((-cosgha * sindec, singha * sindec, cosdec))
+    DX = np.dot(response, X)
+    DY = np.dot(response, Y)
+    fplus = np.sum(X * DX - Y * DY, axis=0)
+    fcross = np.sum(X * DY + Y * DX, axis=0)
+    return fplus, fcross
+
+
+def time_delays_from_earth_center(location, ra, dec, gmst):
+    """Compute the arrival time at a detector at the given location relative
+    to the geocenter for arrays of sky positions. Equivalent to calling
+    lal.TimeDelayFromEarthCenter for each sky position."""
+    gha = gmst - ra
+    cosdec = np.cos(dec)
+    n = np.asarray((cosdec * np.cos(gha), -cosdec * np.sin(gha), np.sin(dec)))
+    return -np.dot(location, n) / lal.LAL_C_SI
+
+
+class Injections(object):
+    """Arrays of the parameters of the injections in a sim_inspiral table."""
+
+    def __init__(self, sim_inspirals):
+        sim_inspirals = list(sim_inspirals)
+        self.mass1 = np.asarray([row.mass1 for row in sim_inspirals])
+        self.mass2 = np.asarray([row.mass2 for row in sim_inspirals])
+        self.f_low = np.asarray([row.f_lower for row in sim_inspirals])
+        self.waveform = [str(row.waveform) for row in sim_inspirals]
+        self.distance = np.asarray([row.distance for row in sim_inspirals])
+        self.ra = np.asarray([row.longitude for row in sim_inspirals])
+        self.dec = np.asarray([row.latitude for row in sim_inspirals])
+        self.inclination = np.asarray([row.inclination for row in sim_inspirals])
+        self.coa_phase = np.asarray([row.coa_phase for row in sim_inspirals])
+        self.polarization = np.asarray([row.polarization for row in sim_inspirals])
+        self.epochs = [lal.LIGOTimeGPS(row.geocent_end_time, row.geocent_end_time_ns)
+            for row in sim_inspirals]
+        self.gmst = np.asarray([lal.GreenwichMeanSiderealTime(epoch)
+            for epoch in self.epochs])
+
+    def __len__(self):
+        return len(self.mass1)
+
+    def groups(self):
+        """Yield arrays of the indices of injections that share the same
+        masses, low-frequency cutoff, and waveform."""
+        keys = zip(self.mass1, self.mass2, self.f_low, self.waveform)
+        order = sorted(xrange(len(keys)), key=keys.__getitem__)
+        for _, indices in itertools.groupby(order, keys.__getitem__):
+            yield np.asarray(list(indices))
+
+
+def _realize_group(args):
+    """Realize the measurements for one group of injections. Returns the
+    indices of the injections, and arrays of shape (number of injections,
+    number of detectors) of the measured SNR amplitudes, SNR phases, and times
+    of arrival relative to the geocenter arrival time, and the SNR=1 horizon
+    distances."""
+    (ifos, responses, locations, seed, toa_error_from_estimator, indices,
+        mass1, mass2, f_low, waveform,
+        distance, ra, dec, inc, phi, psi, gmst) = args
+
+    approximant, amplitude_order, phase_order = timing.get_approximant_and_orders_from_string(waveform)
+
+    # Signal models for each detector.
+    signal_models = [timing.SignalModel(mass1, mass2, timing.get_noise_psd_func(ifo), f_low, approximant, amplitude_order, phase_order)
+        for ifo in ifos]
+
+    # Get SNR=1 horizon distances for each detector.
+    horizons = np.asarray([signal_model.get_horizon_distance()
+        for signal_model in signal_models])
+
+    # Get antenna factors for each detector, as arrays of shape
+    # (number of detectors, number of injections).
+    fplus, fcross = np.asarray([antenna_factors(response, ra, dec, gmst)
+        for response in responses]).transpose(1, 0, 2)
+
+    # Compute TOAs at each detector.
+    toas = np.asarray([time_delays_from_earth_center(location, ra, dec, gmst)
+        for location in locations])
+
+    # Apply the transformation that maps F+, Fx onto the amplitudes of the
+    # two waveform quadratures: rotate by the polarization angle, scale by the
+    # inclination factors, and rotate by the coalescence phase.
+    cosinc = np.cos(inc)
+    cosphi = np.cos(2 * phi)
+    sinphi = np.sin(2 * phi)
+    cospsi = np.cos(2 * psi)
+    sinpsi = np.sin(2 * psi)
+    q0 = (cospsi * fplus + sinpsi * fcross) * cosinc
+    q1 = (-sinpsi * fplus + cospsi * fcross) * 0.5 * (1 + cosinc * cosinc)
+    scale = horizons[:, np.newaxis] / distance
+    snrs = (cosphi * q0 + sinphi * q1) * scale + (-sinphi * q0 + cosphi * q1) * scale * 1j
+
+    abs_snrs = np.abs(snrs).T
+    arg_snrs = np.angle(snrs).T
+    toas = toas.T
+
+    # Add measurement noise, one injection at a time, each with its own
+    # random number stream.
+    for index, abs_snr, arg_snr, toa in zip(indices, abs_snrs, arg_snrs, toas):
+        random_state = np.random.RandomState([seed, index])
+
+        if toa_error_from_estimator:
+            # If user asked, apply noise to amplitudes /before/ adding noise to TOAs and phases.
+
+            # Add noise to SNR estimates.
+            abs_snr += random_state.randn(len(abs_snr))
+
+            for i, signal_model in enumerate(signal_models):
+                arg_snr[i], toa[i] = random_state.multivariate_normal([arg_snr[i], toa[i]], signal_model.get_cov(abs_snr[i]))
+        else:
+            # Otherwise, by default, apply noise to TOAs and phases first.
+
+            for i, signal_model in enumerate(signal_models):
+                arg_snr[i], toa[i] = random_state.multivariate_normal([arg_snr[i], toa[i]], signal_model.get_cov(abs_snr[i]))
+
+            # Add noise to SNR estimates.
+            abs_snr += random_state.randn(len(abs_snr))
+
+    return indices, abs_snrs, arg_snrs, toas, np.tile(horizons, (len(indices), 1))
+
+
+def realize(injections, ifos, seed, toa_error_from_estimator=False, processes=1):
+    """Realize measured SNRs, phases, and times of arrival for all
+    injections. Returns arrays of shape (number of injections, number of
+    detectors) of the SNR amplitudes, SNR phases, times of arrival relative
+    to the geocenter arrival time, and SNR=1 horizon distances. If processes
+    is greater than one, then groups of injections are processed in parallel
+    by that many worker processes."""
+    detectors = [lalsimulation.InstrumentNameToLALDetector(ifo)
+        for ifo in ifos]
+    responses = [np.asarray(det.response) for det in detectors]
+    locations = [np.asarray(det.location) for det in detectors]
+
+    tasks = ((ifos, responses, locations, seed, toa_error_from_estimator,
+        indices, injections.mass1[indices[0]], injections.mass2[indices[0]],
+        injections.f_low[indices[0]], injections.waveform[indices[0]],
+        injections.distance[indices], injections.ra[indices],
+        injections.dec[indices], injections.inclination[indices],
+        injections.coa_phase[indices], injections.polarization[indices],
+        injections.gmst[indices]) for indices in injections.groups())
+
+    shape = (len(injections), len(ifos))
+    abs_snrs = np.empty(shape)
+    arg_snrs = np.empty(shape)
+    toas = np.empty(shape)
+    horizons = np.empty(shape)
+
+    if processes > 1:
+        pool = multiprocessing.Pool(processes)
+        results = pool.imap_unordered(_realize_group, tasks)
+    else:
+        pool = None
+        results = itertools.imap(_realize_group, tasks)
+    try:
+        for indices, group_abs_snrs, group_arg_snrs, group_toas, group_horizons in results:
+            abs_snrs[indices] = group_abs_snrs
+            arg_snrs[indices] = group_arg_snrs
+            toas[indices] = group_toas
+            horizons[indices] = group_horizons
+    finally:
+        if pool is not None:
+            pool.terminate()
+
+    return abs_snrs, arg_snrs, toas, horizons
@@ -0,0 +1,198 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Accuracy-versus-speed regression harness for the sky map code.
+
+A fixed corpus of synthetic events is realized with the same machinery as
+bayestar_realize_coincs (see bayestar.realize), from a fixed random seed, so
+that every run of the harness sees the same events. Each event is localized
+with a reference configuration of sky_map.tdoa_snr that uses much finer
+quadrature than the default, and then with each of the configurations under
+test. For every configuration, the harness reports the total runtime and the
+following accuracy metrics against the reference sky map:
+
+  kl: Kullback-Leibler divergence D(reference || configuration) in nats
+  area90_error: fractional change in the area of the 90% credible region
+  searched_area_shift: fractional change in the searched area
+
+Each configuration declares tolerances on the 90th percentiles of kl,
+|area90_error|, and |searched_area_shift| over the corpus. A configuration
+that exceeds any of them fails.
+"""
+from __future__ import division
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import collections
+import time
+import numpy as np
+import lal, lalsimulation
+from . import realize
+from . import sky_map
+from . import timing
+
+
+class Configuration(collections.namedtuple('Configuration',
+        'name options max_kl max_area90_error max_searched_area_shift')):
+    """A named set of keyword arguments for sky_map.tdoa_snr, and the
+    tolerances that it must meet."""
+
+
+# Quadrature settings that are fine enough to serve as the truth.
+reference = Configuration('reference',
+    dict(ntwopsi=64, nu=64, epsrel=1e-3), 0, 0, 0)
+
+# Configurations under test. Add an entry here for every new accuracy knob
+# of the sky map code.
+configurations = [
+    Configuration('default', dict(), 0.02, 0.05, 0.05),
+    Configuration('coarse-psi', dict(ntwopsi=8), 0.05, 0.1, 0.1),
+    Configuration('coarse-inclination', dict(nu=8), 0.05, 0.1, 0.1),
+    Configuration('loose-radial', dict(epsrel=0.2), 0.05, 0.1, 0.1),
+    Configuration('split-amplitude', dict(split_tolerance=0.05), 0.05, 0.1, 0.1),
+]
+
+
+Event = collections.namedtuple('Event',
+    'ra dec gmst toas snrs s2_toas horizons min_distance max_distance')
+
+
+class _SimInspiral(object):
+    """Just enough of a sim_inspiral row for realize.Injections."""
+
+    def __init__(self, **kwargs):
+        self.__dict__.update(kwargs)
+
+
+def make_corpus(nevents, seed=0, ifos=('H1', 'L1', 'V1'), mass1=1.4,
+        mass2=1.4, f_low=10., waveform='TaylorF2threePointFivePN',
+        max_distance=200., snr_threshold=4., min_network_snr=12.):
+    """Realize nevents synthetic events that are detected in all of the
+    detectors. Sources are distributed isotropically and uniformly in volume
+    out to max_distance Mpc. The corpus depends only on the arguments."""
+    random_state = np.random.RandomState(seed)
+    approximant, amplitude_order, phase_order = timing.get_approximant_and_orders_from_string(waveform)
+    signal_models = [timing.SignalModel(mass1, mass2,
+        timing.get_noise_psd_func(ifo), f_low, approximant, amplitude_order,
+        phase_order) for ifo in ifos]
+
+    events = []
+    batch = 0
+    while len(events) < nevents:
+        n = 4 * nevents
+        epochs = 1e9 + random_state.uniform(0, 86400, n)
+        sim_inspirals = [_SimInspiral(mass1=mass1, mass2=mass2, f_lower=f_low,
+            waveform=waveform, distance=distance, longitude=ra,
+            latitude=dec, inclination=inclination, coa_phase=coa_phase,
+            polarization=polarization, geocent_end_time=int(epoch),
+            geocent_end_time_ns=int(1e9 * (epoch - int(epoch))))
+            for distance, ra, dec, inclination, coa_phase, polarization, epoch
+            in zip(
+                max_distance * random_state.uniform(0, 1, n) ** (1 / 3),
+                random_state.uniform(0, 2 * np.pi, n),
+                np.arcsin(random_state.uniform(-1, 1, n)),
+                np.arccos(random_state.uniform(-1, 1, n)),
+                random_state.uniform(0, 2 * np.pi, n),
+                random_state.uniform(0, 2 * np.pi, n),
+                epochs)]
+        injections = realize.Injections(sim_inspirals)
+        abs_snrs, arg_snrs, toas, horizons = realize.realize(
+            injections, list(ifos), seed + batch)
+        batch += 1
+
+        for ra, dec, gmst, event_snrs, event_toas, event_horizons in zip(
+                injections.ra, injections.dec, injections.gmst, abs_snrs,
+                toas, horizons):
+            if np.any(event_snrs < snr_threshold) or np.sqrt(np.sum(np.square(event_snrs))) < min_network_snr:
+                continue
+            s2_toas = np.square([signal_model.get_toa_uncert(snr)
+                for signal_model, snr in zip(signal_models, event_snrs)])
+            effective_distances = event_horizons / event_snrs
+            events.append(Event(ra, dec, gmst, event_toas - event_toas[0],
+                event_snrs, s2_toas, event_horizons,
+                0.5 * effective_distances.min(),
+                2 * effective_distances.max()))
+            if len(events) == nevents:
+                break
+    return events
+
+
+def localize(event, configuration, ifos=('H1', 'L1', 'V1'), nside=64,
+        prior='uniform in volume'):
+    """Localize one event with the given configuration, and return the sky
+    map and the wall-clock time that it took."""
+    detectors = [lalsimulation.InstrumentNameToLALDetector(ifo) for ifo in ifos]
+    start_time = time.time()
+    prob = sky_map.tdoa_snr(event.gmst, event.toas, event.snrs,
+        event.s2_toas, [det.response for det in detectors],
+        [det.location for det in detectors], event.horizons,
+        event.min_distance, event.max_distance, prior, nside=nside,
+        **configuration.options)
+    return prob, time.time() - start_time
+
+
+def compare(event, reference_prob, prob):
+    """Compute the accuracy metrics of the sky map prob against the sky map
+    reference_prob for the given event."""
+    theta = 0.5 * np.pi - event.dec
+    phi = event.ra
+    ref_searched_area, _, _, (ref_area90,) = sky_map.injection_stats(
+        reference_prob, theta, phi, [0.9])
+    searched_area, _, _, (area90,) = sky_map.injection_stats(
+        prob, theta, phi, [0.9])
+
+    # The sky maps are normalized, but guard against pixels that are zero in
+    # one map and not the other.
+    p = reference_prob[reference_prob > 0]
+    q = np.maximum(prob[reference_prob > 0], np.finfo(float).tiny)
+    kl = np.sum(p * np.log(p / q))
+
+    return kl, area90 / ref_area90 - 1, searched_area / ref_searched_area - 1
+
+
+def run(events, configurations=configurations, ifos=('H1', 'L1', 'V1'),
+        nside=64):
+    """Run the reference and every configuration on every event. Return a
+    list of (configuration, runtime, kl, area90_error, searched_area_shift,
+    passed) tuples, in which the metrics are the 90th percentiles over the
+    events, and the runtime of the reference configuration."""
+    reference_probs = []
+    reference_runtime = 0
+    for event in events:
+        prob, runtime = localize(event, reference, ifos, nside)
+        reference_probs.append(prob)
+        reference_runtime += runtime
+
+    results = [(reference, reference_runtime, 0., 0., 0., True)]
+    for configuration in configurations:
+        total_runtime = 0
+        metrics = []
+        for event, reference_prob in zip(events, reference_probs):
+            prob, runtime = localize(event, configuration, ifos, nside)
+            total_runtime += runtime
+            metrics.append(compare(event, reference_prob, prob))
+        kl, area90_error, searched_area_shift = np.transpose(metrics)
+        kl = np.percentile(kl, 90)
+        area90_error = np.percentile(np.abs(area90_error), 90)
+        searched_area_shift = np.percentile(np.abs(searched_area_shift), 90)
+        passed = (kl <= configuration.max_kl
+            and area90_error <= configuration.max_area90_error
+            and searched_area_shift <= configuration.max_searched_area_shift)
+        results.append((configuration, total_runtime, kl, area90_error,
+            searched_area_shift, passed))
+    return results
@@ -0,0 +1,182 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Content-addressed cache of finished sky maps.
+
+The same coinc and PSDs are often localized more than once: an alert may be
+delivered twice, bayestar_localize_gracedb may be run again by hand, and
+campaign shards may be re-executed. A ResultCache stores each finished sky
+map under the SHA-1 digest of a canonical description of all of the inputs to
+ligolw_sky_map.ligolw_sky_map: the instruments, times of arrival, SNRs, and
+masses of the triggers; the PSDs; the waveform; the prior; the resolution and
+other options; and the version of the sky map engine. When the same inputs
+come again, the sky map is just read back from disk.
+
+Each entry is a single uncompressed .npz file that is written atomically, so
+that concurrent local processes can share a cache without locking. At worst,
+two processes compute the same sky map and one replaces the other's entry
+with an identical one. Entries are touched whenever they are read. When the
+total size of the cache exceeds its bound, the least recently used entries
+are removed.
+
+The engine version is the digest of the compiled sky_map extension, together
+with cache_version below, which must be incremented whenever a change to the
+Python code changes the sky maps that it produces.
+
+The cache lives in the directory named by the BAYESTAR_RESULT_CACHE
+environment variable, or in ~/.cache/bayestar/result by default.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import errno
+import hashlib
+import json
+import logging
+import os
+import numpy as np
+import lal
+from . import sky_map
+from .decorator import memoized
+from .psd_cache import atomic_write, evict_lru, makedirs, touch
+
+
+log = logging.getLogger('BAYESTAR')
+
+
+# Version of the sky map code that is not covered by the digest of the
+# extension module. Increment to invalidate all existing entries.
+cache_version = 1
+
+# Default bound on the total size of the cache in bytes.
+default_max_bytes = 1 << 30
+
+
+def default_cache_dir():
+    """Return the directory that the cache uses if none is given."""
+    try:
+        return os.environ['BAYESTAR_RESULT_CACHE']
+    except KeyError:
+        return os.path.join(os.path.expanduser('~'), '.cache', 'bayestar', 'result')
+
+
+@memoized
+def engine_version():
+    """Return a string that identifies the version of the sky map code."""
+    with open(sky_map.__file__, 'rb') as f:
+        digest = hashlib.sha1(f.read()).hexdigest()
+    return '%d:%s' % (cache_version, digest)
+
+
+def _canonical(value):
+    """Convert value to plain JSON types, so that equal inputs always
+    serialize in the same way."""
+    if isinstance(value, np.ndarray):
+        return _canonical(value.tolist())
+    elif isinstance(value, dict):
+        return dict((str(key), _canonical(item))
+            for key, item in value.iteritems())
+    elif isinstance(value, (list, tuple)):
+        return [_canonical(item) for item in value]
+    elif isinstance(value, (bool, np.bool_)):
+        return bool(value)
+    elif isinstance(value, (int, long, np.integer)):
+        return int(value)
+    elif isinstance(value, (float, np.floating)):
+        return float(value)
+    elif isinstance(value, basestring) or value is None:
+        return value
+    else:
+        raise TypeError("cannot use %r in a result cache key" % (value,))
+
+
+class ResultCache(object):
+    """On-disk cache of the (sky_map, epoch, elapsed_time) tuples that are
+    returned by ligolw_sky_map.ligolw_sky_map. sky_map may be an array or a
+    tuple of arrays."""
+
+    def __init__(self, cache_dir=None, max_bytes=default_max_bytes):
+        if cache_dir is None:
+            cache_dir = default_cache_dir()
+        self.cache_dir = cache_dir
+        self.max_bytes = max_bytes
+
+    def key(self, **inputs):
+        """Return the key for a localization with the given inputs. Values
+        may be numbers, strings, None, arrays, or lists, tuples, or
+        dictionaries of these."""
+        inputs = _canonical(dict(inputs, engine=engine_version()))
+        return hashlib.sha1(json.dumps(inputs, sort_keys=True,
+            separators=(',', ':'))).hexdigest()
+
+    def _path(self, key):
+        return os.path.join(self.cache_dir, key + '.npz')
+
+    def get(self, key):
+        """Return the result that is stored under key, or None if there is
+        none."""
+        path = self._path(key)
+        try:
+            f = open(path, 'rb')
+        except IOError as e:
+            if e.errno != errno.ENOENT:
+                raise
+            return None
+
+        with f:
+            data = np.load(f)
+            try:
+                maps = tuple(data['map_%d' % i]
+                    for i in range(int(data['nmaps'])))
+                if not data['is_tuple']:
+                    maps, = maps
+                epoch = lal.LIGOTimeGPS(int(data['epoch_seconds']),
+                    int(data['epoch_nanoseconds']))
+                elapsed_time = float(data['elapsed_time'])
+            finally:
+                data.close()
+
+        # Record the use of this entry, for eviction.
+        touch(path)
+
+        log.info('%s:sky map found in result cache', key)
+        return maps, epoch, elapsed_time
+
+    def put(self, key, result):
+        """Store a result under key, then evict entries if the cache is too
+        large."""
+        sky_map, epoch, elapsed_time = result
+        is_tuple = isinstance(sky_map, tuple)
+        maps = sky_map if is_tuple else (sky_map,)
+        arrays = dict(('map_%d' % i, np.asarray(m)) for i, m in enumerate(maps))
+
+        makedirs(self.cache_dir)
+        atomic_write(self._path(key), lambda f: np.savez(f,
+            nmaps=len(maps), is_tuple=is_tuple,
+            epoch_seconds=epoch.gpsSeconds,
+            epoch_nanoseconds=epoch.gpsNanoSeconds,
+            elapsed_time=elapsed_time, **arrays))
+        log.info('%s:sky map saved in result cache', key)
+        self.evict()
+
+    def evict(self):
+        """Remove the least recently used entries until the total size of the
+        cache is at most max_bytes. Entries that other processes remove at
+        the same time are skipped."""
+        for path in evict_lru(self.cache_dir, self.max_bytes, ('.npz',)):
+            log.debug('%s:evicted from result cache', path)
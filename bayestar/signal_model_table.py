@@ -0,0 +1,267 @@
+# -*- coding: utf-8
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Tabulated horizon distances and timing uncertainties.
+
+Building a timing.SignalModel means generating a full waveform and then
+computing many trapezoid integrals, and the Barankin bound needs a dense
+linear solve on top of that. For low-resolution events, this can take
+longer than the sky map itself. A SignalModelTable avoids this work by
+computing each quantity only at the nodes of a fixed grid and interpolating
+between them:
+
+ * the SNR=1 horizon distance, on a grid of (log mass1, log mass2), and
+ * the timing uncertainty, on a grid of (log mass1, log mass2, log SNR).
+
+Interpolation is linear in the logarithm of the tabulated quantity. If any
+of the nodes that an interpolation needs have not been computed yet, the
+quantity is computed directly with timing.SignalModel instead, so that a
+cold table costs no more than not using one, and the missing nodes are
+noted. The noted nodes are computed and the table is saved to disk in
+batches: whenever flush_nodes of them have accumulated, and when the process
+exits. The saved nodes are shared by later processes that use the same PSD,
+low-frequency cutoff, and waveform.
+
+Masses and SNRs outside of the grid fall back to timing.SignalModel.
+
+The tables live in the directory named by the BAYESTAR_SIGNAL_MODEL_CACHE
+environment variable, or in ~/.cache/bayestar/signal_model by default.
+"""
+from __future__ import division
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import atexit
+import errno
+import hashlib
+import logging
+import os
+import numpy as np
+from . import timing
+from .decorator import memoized
+from .psd_cache import atomic_write, makedirs
+
+
+log = logging.getLogger('BAYESTAR')
+
+
+# Grid of component masses in solar masses, uniformly spaced in log mass.
+mass_min = 1.
+mass_max = 100.
+log_mass_step = 0.05
+
+# Grid of SNRs, uniformly spaced in log SNR.
+snr_min = 4.
+snr_max = 100.
+log_snr_step = 0.1
+
+# Number of missing nodes to accumulate before computing them and saving the
+# table. The rest are computed when the process exits.
+flush_nodes = 64
+
+
+def default_cache_dir():
+    """Return the directory that tables are saved in if none is given."""
+    try:
+        return os.environ['BAYESTAR_SIGNAL_MODEL_CACHE']
+    except KeyError:
+        return os.path.join(os.path.expanduser('~'), '.cache', 'bayestar', 'signal_model')
+
+
+def psd_digest(S, f_low):
+    """Identify a PSD function by its values on a fixed frequency grid, or by
+    its content digest if it came from bayestar.psd_cache."""
+    digest = getattr(S, 'digest', None)
+    if digest is not None:
+        return digest
+    f = np.logspace(np.log10(f_low), np.log10(4096), 512)
+    return hashlib.sha1(np.asarray(S(f), dtype=float).tostring()).hexdigest()
+
+
+def _grid(x_min, x_max, log_step):
+    n = int(np.ceil(np.log(x_max / x_min) / log_step)) + 1
+    return np.log(x_min) + log_step * np.arange(n)
+
+
+def _bracket(log_grid, log_x):
+    """Find the index of the grid cell that contains log_x and the fractional
+    position within it, or return None if log_x is outside the grid."""
+    step = log_grid[1] - log_grid[0]
+    u = (log_x - log_grid[0]) / step
+    if not 0 <= u <= len(log_grid) - 1:
+        return None
+    i = min(int(np.floor(u)), len(log_grid) - 2)
+    return i, u - i
+
+
+@memoized
+class SignalModelTable(object):
+    """Interpolated replacement for the horizon distance and timing
+    uncertainty of timing.SignalModel, for a given PSD function S(f),
+    low-frequency cutoff, and waveform."""
+
+    def __init__(self, S, f_low, approximant, amplitude_order, phase_order, cache_dir=None):
+        self.S = S
+        self.f_low = f_low
+        self.approximant = approximant
+        self.amplitude_order = amplitude_order
+        self.phase_order = phase_order
+
+        self.log_masses = _grid(mass_min, mass_max, log_mass_step)
+        self.log_snrs = _grid(snr_min, snr_max, log_snr_step)
+        nmasses = len(self.log_masses)
+        nsnrs = len(self.log_snrs)
+
+        # Tabulated logarithms of the horizon distance and of the timing
+        # uncertainty. Nodes that have not been computed yet are NaN. Only
+        # entries with mass1 index >= mass2 index are used.
+        self.log_horizons = np.empty((nmasses, nmasses))
+        self.log_toa_uncerts = np.empty((nmasses, nmasses, nsnrs))
+        self.log_horizons.fill(np.nan)
+        self.log_toa_uncerts.fill(np.nan)
+
+        if cache_dir is None:
+            cache_dir = default_cache_dir()
+        key = hashlib.sha1(repr((psd_digest(S, f_low), float(f_low),
+            int(approximant), int(amplitude_order), int(phase_order),
+            mass_min, mass_max, log_mass_step,
+            snr_min, snr_max, log_snr_step))).hexdigest()
+        self.path = os.path.join(cache_dir, key + '.npz')
+        self._dirty = False
+        self._merge_saved()
+
+        # Nodes that interpolations have needed but that have not been
+        # computed yet: (i, j) for horizon distances and (i, j, k) for timing
+        # uncertainties.
+        self._missing = set()
+        atexit.register(self._flush_at_exit)
+
+    def _merge_saved(self):
+        """Fill in any nodes that have been saved to disk."""
+        try:
+            saved = np.load(self.path)
+        except IOError as e:
+            if e.errno != errno.ENOENT:
+                raise
+            return
+        try:
+            for name in ('log_horizons', 'log_toa_uncerts'):
+                ours = getattr(self, name)
+                missing = np.isnan(ours)
+                ours[missing] = saved[name][missing]
+        finally:
+            saved.close()
+
+    def save(self):
+        """Write any newly computed nodes to disk. Nodes that other processes
+        saved in the meantime are merged in first."""
+        if not self._dirty:
+            return
+        self._merge_saved()
+        makedirs(os.path.dirname(self.path))
+        atomic_write(self.path, lambda f: np.savez(f,
+            log_horizons=self.log_horizons,
+            log_toa_uncerts=self.log_toa_uncerts))
+        self._dirty = False
+
+    def flush(self):
+        """Compute the nodes that interpolations have needed so far, and save
+        the table."""
+        for node in sorted(self._missing):
+            i, j = node[:2]
+            if len(node) == 2:
+                if np.isnan(self.log_horizons[i, j]):
+                    self.log_horizons[i, j] = np.log(
+                        self._node_model(i, j).get_horizon_distance())
+            else:
+                k = node[2]
+                if np.isnan(self.log_toa_uncerts[i, j, k]):
+                    self.log_toa_uncerts[i, j, k] = np.log(
+                        self._node_model(i, j).get_toa_uncert(np.exp(self.log_snrs[k])))
+            self._dirty = True
+        self._missing.clear()
+        self.save()
+
+    def _flush_at_exit(self):
+        try:
+            self.flush()
+        except:
+            log.exception('%s:failed to save signal model table', self.path)
+
+    def _signal_model(self, mass1, mass2):
+        return timing.SignalModel(mass1, mass2, self.S, self.f_low,
+            self.approximant, self.amplitude_order, self.phase_order)
+
+    def _node_model(self, i, j):
+        return self._signal_model(np.exp(self.log_masses[i]), np.exp(self.log_masses[j]))
+
+    def _interpolate(self, table, cell):
+        """Interpolate the logarithm of a tabulated quantity in the given
+        cell, a list of (index, fractional position) pairs for each axis.
+        Return None and note the missing nodes if any of the nodes that are
+        needed have not been computed yet."""
+        terms = [((), 1.)]
+        for i, x in cell:
+            terms = [(node + (i + di,), w * wi)
+                for node, w in terms
+                for di, wi in ((0, 1 - x), (1, x))
+                if w * wi != 0]
+        missing = []
+        result = 0.
+        for node, w in terms:
+            # Only entries with mass1 index >= mass2 index are used.
+            node = (max(node[:2]), min(node[:2])) + node[2:]
+            value = table[node]
+            if np.isnan(value):
+                missing.append(node)
+            else:
+                result += w * value
+        if missing:
+            self._missing.update(missing)
+            if len(self._missing) >= flush_nodes:
+                self.flush()
+            return None
+        return result
+
+    def _mass_cell(self, mass1, mass2):
+        cell1 = _bracket(self.log_masses, np.log(mass1))
+        cell2 = _bracket(self.log_masses, np.log(mass2))
+        if cell1 is None or cell2 is None:
+            return None
+        return cell1, cell2
+
+    def get_horizon_distance(self, mass1, mass2, snr_thresh=1):
+        """Interpolate the horizon distance for the given masses."""
+        cell = self._mass_cell(mass1, mass2)
+        if cell is not None:
+            log_horizon = self._interpolate(self.log_horizons, cell)
+            if log_horizon is not None:
+                return np.exp(log_horizon) / snr_thresh
+        return self._signal_model(mass1, mass2).get_horizon_distance(snr_thresh)
+
+    def get_toa_uncert(self, mass1, mass2, snr):
+        """Interpolate the timing uncertainty for the given masses and SNR."""
+        cell = self._mass_cell(mass1, mass2)
+        snr_cell = _bracket(self.log_snrs, np.log(snr))
+        if cell is not None and snr_cell is not None:
+            log_toa_uncert = self._interpolate(self.log_toa_uncerts,
+                cell + (snr_cell,))
+            if log_toa_uncert is not None:
+                return np.exp(log_toa_uncert)
+        return self._signal_model(mass1, mass2).get_toa_uncert(snr)
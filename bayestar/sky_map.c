@@ -20,10 +20,13 @@
 #define NPY_NO_DEPRECATED_API 7
 
 #include <Python.h>
+#include <structmember.h>
 #include <numpy/arrayobject.h>
 #include <chealpix.h>
 #include <gsl/gsl_errno.h>
 #include "bayestar_sky_map.h"
+#include "bayestar_stats.h"
+#include "bayestar_timing.h"
 
 
 /**
@@ -65,10 +68,238 @@ static PyObject *premalloced_new(void *data)
 }
 
 
+/**
+ * Detector networks.
+ */
+
+
+/* Alignment of the per-detector data. */
+#define NETWORK_ALIGNMENT 64
+
+
+typedef struct {
+    PyObject_HEAD
+    int nifos;
+    float *response_data; /* nifos contiguous 3x3 matrices, or NULL. */
+    double *location_data; /* nifos contiguous 3-vectors. */
+    float **responses; /* Pointers into response_data, or NULL. */
+    const double **locations; /* Pointers into location_data. */
+} network_object;
+
+
+static void network_clear(network_object *self)
+{
+    free(self->response_data);
+    free(self->location_data);
+    free(self->responses);
+    free(self->locations);
+    self->nifos = 0;
+    self->response_data = NULL;
+    self->location_data = NULL;
+    self->responses = NULL;
+    self->locations = NULL;
+}
+
+
+static void network_dealloc(network_object *self)
+{
+    network_clear(self);
+    self->ob_type->tp_free((PyObject *) self);
+}
+
+
+/* Copy each element of a sequence of arrays of a given shape into one block
+ * of aligned memory. Returns the block, or NULL on failure. */
+static void *network_unpack(PyObject *seq, Py_ssize_t n, int typenum,
+    size_t itemsize, npy_intp rows, npy_intp cols, const char *message)
+{
+    const int nd = cols ? 2 : 1;
+    const size_t stride = rows * (cols ? cols : 1) * itemsize;
+    char *data;
+    Py_ssize_t i;
+
+    if (posix_memalign((void **) &data, NETWORK_ALIGNMENT, (n ? n : 1) * stride))
+    {
+        PyErr_SetNone(PyExc_MemoryError);
+        return NULL;
+    }
+
+    for (i = 0; i < n; i ++)
+    {
+        PyArrayObject *npy;
+        PyObject *obj = PySequence_GetItem(seq, i);
+        if (!obj) goto fail;
+        npy = (PyArrayObject *) PyArray_ContiguousFromAny(obj, typenum, nd, nd);
+        Py_DECREF(obj);
+        if (!npy) goto fail;
+        if (PyArray_DIM(npy, 0) != rows || (cols && PyArray_DIM(npy, 1) != cols))
+        {
+            Py_DECREF(npy);
+            PyErr_SetString(PyExc_ValueError, message);
+            goto fail;
+        }
+        memcpy(data + i * stride, PyArray_DATA(npy), stride);
+        Py_DECREF(npy);
+    }
+
+    return data;
+fail:
+    free(data);
+    return NULL;
+}
+
+
+static int network_init(network_object *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *responses_obj, *locations_obj;
+    Py_ssize_t n, nifos;
+    Py_ssize_t i;
+
+    /* Names of arguments */
+    static const char *keywords[] = {"responses", "locations", NULL};
+
+    /* Parse arguments */
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", keywords,
+        &responses_obj, &locations_obj))
+        return -1;
+
+    network_clear(self);
+
+    nifos = PySequence_Length(locations_obj);
+    if (nifos < 0) goto fail;
+    if (responses_obj != Py_None)
+    {
+        n = PySequence_Length(responses_obj);
+        if (n < 0) goto fail;
+        if (n != nifos)
+        {
+            PyErr_SetString(PyExc_ValueError, "responses and locations must have the same length");
+            goto fail;
+        }
+    }
+
+    self->location_data = network_unpack(locations_obj, nifos, NPY_DOUBLE,
+        sizeof(double), 3, 0, "expected every element of locations to be a vector of length 3");
+    if (!self->location_data) goto fail;
+    self->locations = malloc((nifos ? nifos : 1) * sizeof(double *));
+    if (!self->locations)
+    {
+        PyErr_SetNone(PyExc_MemoryError);
+        goto fail;
+    }
+    for (i = 0; i < nifos; i ++)
+        self->locations[i] = &self->location_data[3 * i];
+
+    if (responses_obj != Py_None)
+    {
+        self->response_data = network_unpack(responses_obj, nifos, NPY_FLOAT,
+            sizeof(float), 3, 3, "expected every element of responses to be a 3x3 matrix");
+        if (!self->response_data) goto fail;
+        self->responses = malloc((nifos ? nifos : 1) * sizeof(float *));
+        if (!self->responses)
+        {
+            PyErr_SetNone(PyExc_MemoryError);
+            goto fail;
+        }
+        for (i = 0; i < nifos; i ++)
+            self->responses[i] = &self->response_data[9 * i];
+    }
+
+    self->nifos = nifos;
+    return 0;
+fail:
+    network_clear(self);
+    return -1;
+}
+
+
+static PyMemberDef network_members[] = {
+    {"nifos", T_INT, offsetof(network_object, nifos), READONLY,
+        "Number of detectors"},
+    {NULL, 0, 0, 0, NULL}
+};
+
+
+static PyTypeObject network_type = {
+    PyObject_HEAD_INIT(NULL)
+    .tp_name = "sky_map.Network",
+    .tp_basicsize = sizeof(network_object),
+    .tp_dealloc = (destructor)network_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Network(responses, locations)\n\n"
+        "A network of detectors, given the sequences of their 3x3 response\n"
+        "matrices and their locations in Cartesian geographic coordinates.\n"
+        "The detector data are converted and copied once, so a Network can\n"
+        "be passed as the locations argument of tdoa and tdoa_snr to save\n"
+        "the work of unpacking them again in every call. responses may be\n"
+        "None if the network will only be used for tdoa.",
+    .tp_members = network_members,
+    .tp_init = (initproc)network_init
+};
+
+
+/* Return a new reference to a network from the responses and locations
+ * arguments of a sky map function. If locations is already a network, then
+ * responses must be None. Otherwise, a temporary network is built. */
+static network_object *network_from_args(PyObject *responses_obj, PyObject *locations_obj)
+{
+    if (PyObject_TypeCheck(locations_obj, &network_type))
+    {
+        if (responses_obj != Py_None)
+        {
+            PyErr_SetString(PyExc_ValueError, "responses must be None if locations is a Network");
+            return NULL;
+        }
+        Py_INCREF(locations_obj);
+        return (network_object *) locations_obj;
+    }
+    return (network_object *) PyObject_CallFunctionObjArgs(
+        (PyObject *) &network_type, responses_obj, locations_obj, NULL);
+}
+
+
+/* Wrap a malloc'd array in a one-dimensional Numpy array that frees it when
+ * the array is deallocated. On failure, the memory is freed. */
+static PyArrayObject *premalloced_array(void *data, npy_intp n, int typenum)
+{
+    PyArrayObject *out;
+    PyObject *premalloced = premalloced_new(data);
+    if (!premalloced)
+        return NULL;
+    out = (PyArrayObject *) PyArray_SimpleNewFromData(1, &n, typenum, data);
+    if (!out)
+    {
+        Py_DECREF(premalloced);
+        return NULL;
+    }
+#ifdef PyArray_BASE
+    /* FIXME: PyArray_BASE changed from a macro to a getter function in
+     * Numpy 1.7. When we drop Numpy 1.6 support, remove this #ifdef block. */
+    PyArray_BASE(out) = premalloced;
+#else
+    if (PyArray_SetBaseObject(out, premalloced))
+    {
+        Py_DECREF(out);
+        return NULL;
+    }
+#endif
+    return out;
+}
+
+
+/* Raised when a tiled sky map exceeds its memory budget. */
+static PyObject *MemoryBudgetError;
+
+
+/* The sky map functions run with the GIL released, so the GSL error handler
+ * must reacquire it before raising the Python exception. Note that the GSL
+ * error handler is process-wide: only one thread should be computing a sky map
+ * at any given time. */
 static void
 my_gsl_error (const char * reason, const char * file, int line, int gsl_errno)
 {
     PyObject *exception_type;
+    PyGILState_STATE gstate = PyGILState_Ensure();
     switch (gsl_errno)
     {
         case GSL_EINVAL:
@@ -77,29 +308,31 @@ my_gsl_error (const char * reason, const char * file, int line, int gsl_errno)
         case GSL_ENOMEM:
             exception_type = PyExc_MemoryError;
             break;
+        case BAYESTAR_EBUDGET:
+            exception_type = MemoryBudgetError;
+            break;
         default:
             exception_type = PyExc_ArithmeticError;
             break;
     }
     PyErr_Format(exception_type, "%s:%d: %s\n", file, line, reason);
+    PyGILState_Release(gstate);
 }
 
 
 static PyObject *sky_map_tdoa(PyObject *module, PyObject *args, PyObject *kwargs)
 {
-    long i;
-    Py_ssize_t n;
     long nside = -1;
     long npix;
     long nifos = 0;
     double gmst;
     PyObject *toas_obj, *toa_variances_obj, *locations_obj;
 
-    PyArrayObject *toas_npy = NULL, *toa_variances_npy = NULL, **locations_npy = NULL;
+    PyArrayObject *toas_npy = NULL, *toa_variances_npy = NULL;
+    network_object *network = NULL;
 
     double *toas;
     double *toa_variances;
-    const double **locations = NULL;
 
     npy_intp dims[1];
     PyArrayObject  *out = NULL, *ret = NULL;
@@ -145,45 +378,18 @@ static PyObject *sky_map_tdoa(PyObject *module, PyObject *args, PyObject *kwargs
     }
     toa_variances = PyArray_DATA(toa_variances_npy);
 
-    locations_npy = malloc(nifos * sizeof(PyObject *));
-    if (!locations_npy)
-    {
-        PyErr_SetNone(PyExc_MemoryError);
-        goto fail;
-    }
-    for (i = 0; i < nifos; i ++)
-        locations_npy[i] = NULL;
-    locations = malloc(nifos * sizeof(double *));
-    if (!locations)
-    {
-        PyErr_SetNone(PyExc_MemoryError);
-        goto fail;
-    }
-
-    n = PySequence_Length(locations_obj);
-    if (n < 0) goto fail;
-    if (n != nifos)
+    network = network_from_args(Py_None, locations_obj);
+    if (!network) goto fail;
+    if (network->nifos != nifos)
     {
         PyErr_SetString(PyExc_ValueError, "toas and locations must have the same length");
         goto fail;
     }
-    for (i = 0; i < nifos; i ++)
-    {
-        PyObject *obj = PySequence_GetItem(locations_obj, i);
-        if (!obj) goto fail;
-        locations_npy[i] = (PyArrayObject *) PyArray_ContiguousFromAny(obj, NPY_DOUBLE, 1, 1);
-        Py_XDECREF(obj);
-        if (!locations_npy[i]) goto fail;
-        if (PyArray_DIM(locations_npy[i], 0) != 3)
-        {
-            PyErr_SetString(PyExc_ValueError, "expected every element of locations to be a vector of length 3");
-            goto fail;
-        }
-        locations[i] = PyArray_DATA(locations_npy[i]);
-    }
 
     old_handler = gsl_set_error_handler(my_gsl_error);
-    P = bayestar_sky_map_tdoa(&npix, gmst, nifos, locations, toas, toa_variances);
+    Py_BEGIN_ALLOW_THREADS
+        P = bayestar_sky_map_tdoa(&npix, gmst, nifos, network->locations, toas, toa_variances);
+    Py_END_ALLOW_THREADS
     gsl_set_error_handler(old_handler);
 
     if (!P)
@@ -210,11 +416,7 @@ static PyObject *sky_map_tdoa(PyObject *module, PyObject *args, PyObject *kwargs
 fail:
     Py_XDECREF(toas_npy);
     Py_XDECREF(toa_variances_npy);
-    if (locations_npy)
-        for (i = 0; i < nifos; i ++)
-            Py_XDECREF(locations_npy[i]);
-    free(locations_npy);
-    free(locations);
+    Py_XDECREF(network);
     Py_XDECREF(premalloced);
     Py_XDECREF(out);
     return (PyObject *) ret;
@@ -223,8 +425,6 @@ fail:
 
 static PyObject *sky_map_tdoa_snr(PyObject *module, PyObject *args, PyObject *kwargs)
 {
-    long i;
-    Py_ssize_t n;
     long nside = -1;
     long npix;
     long nifos = 0;
@@ -232,22 +432,38 @@ static PyObject *sky_map_tdoa_snr(PyObject *module, PyObject *args, PyObject *kw
     PyObject *toas_obj, *snrs_obj, *toa_variances_obj, *responses_obj,
         *locations_obj, *horizons_obj;
 
-    PyArrayObject *toas_npy = NULL, *snrs_npy = NULL, *toa_variances_npy = NULL, **responses_npy = NULL, **locations_npy = NULL, *horizons_npy = NULL;
+    PyArrayObject *toas_npy = NULL, *snrs_npy = NULL, *toa_variances_npy = NULL, *horizons_npy = NULL;
+    network_object *network = NULL;
     char *prior_str = NULL;
 
     double *toas;
     double *snrs;
     double *toa_variances;
-    /* FIXME: make const; change XLALComputeDetAMResponse prototype */
-    /* const */ float **responses = NULL;
-    const double **locations = NULL;
     double *horizons;
 
     double min_distance, max_distance;
     bayestar_prior_t prior = -1;
+    bayestar_quadrature_t quadrature = bayestar_quadrature_default;
+
+    PyObject *warm_start_obj = Py_None, *warm_support_obj, *warm_amplitude_obj;
+    PyObject *warm_antenna_obj = Py_None, *antenna_out = NULL;
+    PyArrayObject *warm_support_npy = NULL, *warm_amplitude_npy = NULL;
+    PyArrayObject **warm_antenna_npy = NULL;
+    double **warm_antenna = NULL;
+    long i;
+    PyArrayObject *support_npy = NULL, *amplitude_npy = NULL;
+    PyArrayObject *distmean_npy = NULL, *diststd_npy = NULL;
+    PyObject *result = NULL;
+    int return_warm_start = 0;
+    int return_distance = 0;
+    double *distmean = NULL, *diststd = NULL;
+    unsigned long max_bytes = 0;
+    bayestar_warm_start_t warm_in = {0, 0, NULL, NULL, NULL};
+    bayestar_warm_start_t warm_out = {0, 0, NULL, NULL, NULL};
 
     npy_intp dims[1];
-    PyArrayObject *out = NULL, *ret = NULL;
+    PyArrayObject *out = NULL;
+    PyObject *ret = NULL;
     PyObject *premalloced = NULL;
     double *P;
     gsl_error_handler_t *old_handler;
@@ -255,16 +471,48 @@ static PyObject *sky_map_tdoa_snr(PyObject *module, PyObject *args, PyObject *kw
     /* Names of arguments */
     static const char *keywords[] = {"gmst", "toas", "snrs",
         "toa_variances", "responses", "locations", "horizons",
-        "min_distance", "max_distance", "prior", "nside", NULL};
+        "min_distance", "max_distance", "prior", "nside", "ntwopsi", "nu",
+        "epsrel", "warm_start", "return_warm_start", "max_bytes",
+        "return_distance", "split_tolerance", NULL};
 
     /* Silence warning about unused parameter. */
     (void)module;
 
     /* Parse arguments */
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "dOOOOOOdds|l", keywords,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "dOOOOOOdds|liidOikid", keywords,
         &gmst, &toas_obj, &snrs_obj, &toa_variances_obj,
         &responses_obj, &locations_obj, &horizons_obj,
-        &min_distance, &max_distance, &prior_str, &nside)) goto fail;
+        &min_distance, &max_distance, &prior_str, &nside,
+        &quadrature.ntwopsi, &quadrature.nu, &quadrature.epsrel,
+        &warm_start_obj, &return_warm_start, &max_bytes,
+        &return_distance, &quadrature.split_tolerance)) goto fail;
+
+    /* Unpack warm-start state: a tuple of (npix, support, amplitude[,
+     * antenna]), where amplitude may be None if only the resolution and
+     * support are reused, and antenna is a sequence of the tabulated antenna
+     * factors of each detector, or None for detectors that have none. */
+    if (warm_start_obj != Py_None)
+    {
+        if (!PyArg_ParseTuple(warm_start_obj, "lOO|O", &warm_in.npix,
+            &warm_support_obj, &warm_amplitude_obj, &warm_antenna_obj)) goto fail;
+
+        warm_support_npy = (PyArrayObject *) PyArray_ContiguousFromAny(warm_support_obj, NPY_LONG, 1, 1);
+        if (!warm_support_npy) goto fail;
+        warm_in.nsupport = PyArray_DIM(warm_support_npy, 0);
+        warm_in.support = PyArray_DATA(warm_support_npy);
+
+        if (warm_amplitude_obj != Py_None)
+        {
+            warm_amplitude_npy = (PyArrayObject *) PyArray_ContiguousFromAny(warm_amplitude_obj, NPY_DOUBLE, 1, 1);
+            if (!warm_amplitude_npy) goto fail;
+            if (PyArray_DIM(warm_amplitude_npy, 0) != warm_in.nsupport)
+            {
+                PyErr_SetString(PyExc_ValueError, "warm-start support and amplitude must have the same length");
+                goto fail;
+            }
+            warm_in.amplitude = PyArray_DATA(warm_amplitude_npy);
+        }
+    }
 
     if (nside == -1)
     {
@@ -283,6 +531,43 @@ static PyObject *sky_map_tdoa_snr(PyObject *module, PyObject *args, PyObject *kw
     nifos = PyArray_DIM(toas_npy, 0);
     toas = PyArray_DATA(toas_npy);
 
+    if (warm_antenna_obj != Py_None)
+    {
+        if (!PySequence_Check(warm_antenna_obj)
+            || PySequence_Size(warm_antenna_obj) != nifos)
+        {
+            PyErr_SetString(PyExc_ValueError, "warm-start antenna factors must have one entry per detector");
+            goto fail;
+        }
+        warm_antenna_npy = calloc(nifos, sizeof(PyArrayObject *));
+        warm_antenna = calloc(nifos, sizeof(double *));
+        if (!warm_antenna_npy || !warm_antenna)
+        {
+            PyErr_NoMemory();
+            goto fail;
+        }
+        for (i = 0; i < nifos; i ++)
+        {
+            PyObject *item = PySequence_GetItem(warm_antenna_obj, i);
+            if (!item) goto fail;
+            if (item != Py_None)
+                warm_antenna_npy[i] = (PyArrayObject *) PyArray_ContiguousFromAny(item, NPY_DOUBLE, 1, 1);
+            Py_DECREF(item);
+            if (!warm_antenna_npy[i])
+            {
+                if (PyErr_Occurred()) goto fail;
+                continue;
+            }
+            if (PyArray_DIM(warm_antenna_npy[i], 0) != 2 * warm_in.npix)
+            {
+                PyErr_SetString(PyExc_ValueError, "warm-start antenna factors must have two entries per pixel");
+                goto fail;
+            }
+            warm_antenna[i] = PyArray_DATA(warm_antenna_npy[i]);
+        }
+        warm_in.antenna = warm_antenna;
+    }
+
     snrs_npy = (PyArrayObject *) PyArray_ContiguousFromAny(snrs_obj, NPY_DOUBLE, 1, 1);
     if (!snrs_npy) goto fail;
     if (PyArray_DIM(snrs_npy, 0) != nifos)
@@ -301,79 +586,18 @@ static PyObject *sky_map_tdoa_snr(PyObject *module, PyObject *args, PyObject *kw
     }
     toa_variances = PyArray_DATA(toa_variances_npy);
 
-    responses_npy = malloc(nifos * sizeof(PyObject *));
-    if (!responses_npy)
-    {
-        PyErr_SetNone(PyExc_MemoryError);
-        goto fail;
-    }
-    for (i = 0; i < nifos; i ++)
-        responses_npy[i] = NULL;
-    responses = malloc(nifos * sizeof(float *));
-    if (!responses)
-    {
-        PyErr_SetNone(PyExc_MemoryError);
-        goto fail;
-    }
-
-    n = PySequence_Length(responses_obj);
-    if (n < 0) goto fail;
-    if (n != nifos)
-    {
-        PyErr_SetString(PyExc_ValueError, "toas and responses must have the same length");
-        goto fail;
-    }
-    for (i = 0; i < nifos; i ++)
-    {
-        PyObject *obj = PySequence_GetItem(responses_obj, i);
-        if (!obj) goto fail;
-        responses_npy[i] = (PyArrayObject *) PyArray_ContiguousFromAny(obj, NPY_FLOAT, 2, 2);
-        Py_XDECREF(obj);
-        if (!responses_npy[i]) goto fail;
-        if (PyArray_DIM(responses_npy[i], 0) != 3 || PyArray_DIM(responses_npy[i], 1) != 3)
-        {
-            PyErr_SetString(PyExc_ValueError, "expected every element of responses to be a 3x3 matrix");
-            goto fail;
-        }
-        responses[i] = PyArray_DATA(responses_npy[i]);
-    }
-
-    locations_npy = malloc(nifos * sizeof(PyObject *));
-    if (!locations_npy)
+    network = network_from_args(responses_obj, locations_obj);
+    if (!network) goto fail;
+    if (!network->responses)
     {
-        PyErr_SetNone(PyExc_MemoryError);
+        PyErr_SetString(PyExc_ValueError, "network has no detector responses");
         goto fail;
     }
-    for (i = 0; i < nifos; i ++)
-        locations_npy[i] = NULL;
-    locations = malloc(nifos * sizeof(double *));
-    if (!locations)
-    {
-        PyErr_SetNone(PyExc_MemoryError);
-        goto fail;
-    }
-
-    n = PySequence_Length(locations_obj);
-    if (n < 0) goto fail;
-    if (n != nifos)
+    if (network->nifos != nifos)
     {
         PyErr_SetString(PyExc_ValueError, "toas and locations must have the same length");
         goto fail;
     }
-    for (i = 0; i < nifos; i ++)
-    {
-        PyObject *obj = PySequence_GetItem(locations_obj, i);
-        if (!obj) goto fail;
-        locations_npy[i] = (PyArrayObject *) PyArray_ContiguousFromAny(obj, NPY_DOUBLE, 1, 1);
-        Py_XDECREF(obj);
-        if (!locations_npy[i]) goto fail;
-        if (PyArray_DIM(locations_npy[i], 0) != 3)
-        {
-            PyErr_SetString(PyExc_ValueError, "expected every element of locations to be a vector of length 3");
-            goto fail;
-        }
-        locations[i] = PyArray_DATA(locations_npy[i]);
-    }
 
     horizons_npy = (PyArrayObject *) PyArray_ContiguousFromAny(horizons_obj, NPY_DOUBLE, 1, 1);
     if (!horizons_npy) goto fail;
@@ -392,8 +616,55 @@ static PyObject *sky_map_tdoa_snr(PyObject *module, PyObject *args, PyObject *kw
             prior = BAYESTAR_PRIOR_UNIFORM_IN_VOLUME;
     }
 
+    /* In tiled mode, return a sparse sky map as a tuple of NESTED pixel
+     * indices and probabilities. */
+    if (max_bytes)
+    {
+        uint32_t *tiled_ipix;
+        long tiled_n;
+        int status;
+
+        if (nside == -1 || warm_start_obj != Py_None || return_warm_start || return_distance)
+        {
+            PyErr_SetString(PyExc_ValueError, "max_bytes requires a fixed nside and cannot be combined with a warm start or with distance moments");
+            goto fail;
+        }
+
+        old_handler = gsl_set_error_handler(my_gsl_error);
+        Py_BEGIN_ALLOW_THREADS
+            status = bayestar_sky_map_tdoa_snr_tiled(nside, max_bytes,
+                &tiled_ipix, &P, &tiled_n, gmst, nifos, network->responses,
+                network->locations,
+                toas, snrs, toa_variances, horizons, min_distance,
+                max_distance, prior, &quadrature);
+        Py_END_ALLOW_THREADS
+        gsl_set_error_handler(old_handler);
+
+        if (status != GSL_SUCCESS)
+            goto fail;
+        support_npy = premalloced_array(tiled_ipix, tiled_n, NPY_UINT32);
+        if (!support_npy)
+        {
+            free(P);
+            goto fail;
+        }
+        out = premalloced_array(P, tiled_n, NPY_DOUBLE);
+        if (!out)
+            goto fail;
+        ret = Py_BuildValue("OO", support_npy, out);
+        goto fail;
+    }
+
     old_handler = gsl_set_error_handler(my_gsl_error);
-    P = bayestar_sky_map_tdoa_snr(&npix, gmst, nifos, responses, locations, toas, snrs, toa_variances, horizons, min_distance, max_distance, prior);
+    Py_BEGIN_ALLOW_THREADS
+        P = bayestar_sky_map_tdoa_snr(&npix, gmst, nifos, network->responses,
+            network->locations,
+            toas, snrs, toa_variances, horizons, min_distance, max_distance,
+            prior, &quadrature, warm_start_obj != Py_None ? &warm_in : NULL,
+            return_warm_start ? &warm_out : NULL,
+            return_distance ? &distmean : NULL,
+            return_distance ? &diststd : NULL);
+    Py_END_ALLOW_THREADS
     gsl_set_error_handler(old_handler);
 
     if (!P)
@@ -415,42 +686,374 @@ static PyObject *sky_map_tdoa_snr(PyObject *module, PyObject *args, PyObject *kw
         goto fail;
 #endif
 
-    ret = out;
-    out = NULL;
+    /* With distance moments, the sky map is a tuple of the probability, the
+     * posterior mean distance, and the posterior standard deviation of
+     * distance. */
+    if (return_distance)
+    {
+        distmean_npy = premalloced_array(distmean, npix, NPY_DOUBLE);
+        distmean = NULL;
+        if (!distmean_npy)
+            goto fail;
+        diststd_npy = premalloced_array(diststd, npix, NPY_DOUBLE);
+        diststd = NULL;
+        if (!diststd_npy)
+            goto fail;
+        result = Py_BuildValue("OOO", out, distmean_npy, diststd_npy);
+        if (!result)
+            goto fail;
+    } else {
+        result = (PyObject *) out;
+        out = NULL;
+    }
+
+    if (return_warm_start)
+    {
+        dims[0] = warm_out.nsupport;
+        support_npy = (PyArrayObject *) PyArray_SimpleNew(1, dims, NPY_LONG);
+        if (!support_npy)
+            goto fail;
+        memcpy(PyArray_DATA(support_npy), warm_out.support, warm_out.nsupport * sizeof(long));
+        amplitude_npy = (PyArrayObject *) PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+        if (!amplitude_npy)
+            goto fail;
+        memcpy(PyArray_DATA(amplitude_npy), warm_out.amplitude, warm_out.nsupport * sizeof(double));
+
+        /* Antenna factors that were computed in this run, or None for the
+         * detectors whose factors were passed in. */
+        antenna_out = PyTuple_New(nifos);
+        if (!antenna_out)
+            goto fail;
+        for (i = 0; i < nifos; i ++)
+        {
+            PyObject *item;
+            if (warm_out.antenna && warm_out.antenna[i])
+            {
+                item = (PyObject *) premalloced_array(warm_out.antenna[i],
+                    2 * warm_out.npix, NPY_DOUBLE);
+                warm_out.antenna[i] = NULL;
+                if (!item)
+                    goto fail;
+            } else {
+                item = Py_None;
+                Py_INCREF(item);
+            }
+            PyTuple_SET_ITEM(antenna_out, i, item);
+        }
+
+        ret = Py_BuildValue("O(lOOO)", result, warm_out.npix, support_npy,
+            amplitude_npy, antenna_out);
+    } else {
+        ret = result;
+        result = NULL;
+    }
 fail:
+    free(distmean);
+    free(diststd);
+    free(warm_out.support);
+    free(warm_out.amplitude);
+    if (warm_out.antenna)
+        for (i = 0; i < nifos; i ++)
+            free(warm_out.antenna[i]);
+    free(warm_out.antenna);
+    if (warm_antenna_npy)
+        for (i = 0; i < nifos; i ++)
+            Py_XDECREF(warm_antenna_npy[i]);
+    free(warm_antenna_npy);
+    free(warm_antenna);
+    Py_XDECREF(antenna_out);
+    Py_XDECREF(warm_support_npy);
+    Py_XDECREF(warm_amplitude_npy);
+    Py_XDECREF(support_npy);
+    Py_XDECREF(amplitude_npy);
+    Py_XDECREF(distmean_npy);
+    Py_XDECREF(diststd_npy);
+    Py_XDECREF(result);
     Py_XDECREF(toas_npy);
     Py_XDECREF(snrs_npy);
     Py_XDECREF(toa_variances_npy);
-    if (responses_npy)
-        for (i = 0; i < nifos; i ++)
-            Py_XDECREF(responses_npy[i]);
-    free(responses_npy);
-    free(responses);
-    if (locations_npy)
-        for (i = 0; i < nifos; i ++)
-            Py_XDECREF(locations_npy[i]);
-    free(locations_npy);
-    free(locations);
+    Py_XDECREF(network);
     Py_XDECREF(horizons_npy);
     Py_XDECREF(premalloced);
     Py_XDECREF(out);
+    return ret;
+};
+
+
+static PyObject *sky_map_brb(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    double snr;
+    PyObject *w_obj, *weights_obj;
+    PyArrayObject *w_npy = NULL, *weights_npy = NULL;
+    const double *w, *weights;
+    npy_intp n;
+    npy_intp dims[2] = {2, 2};
+    PyArrayObject *out = NULL, *ret = NULL;
+    double *brb;
+    int status;
+    gsl_error_handler_t *old_handler;
+
+    /* Names of arguments */
+    static const char *keywords[] = {"w", "weights", "snr", NULL};
+
+    /* Silence warning about unused parameter. */
+    (void)module;
+
+    /* Parse arguments */
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOd", keywords,
+        &w_obj, &weights_obj, &snr))
+        goto fail;
+
+    w_npy = (PyArrayObject *) PyArray_ContiguousFromAny(w_obj, NPY_DOUBLE, 1, 1);
+    if (!w_npy) goto fail;
+    n = PyArray_DIM(w_npy, 0);
+    w = PyArray_DATA(w_npy);
+
+    weights_npy = (PyArrayObject *) PyArray_ContiguousFromAny(weights_obj, NPY_DOUBLE, 1, 1);
+    if (!weights_npy) goto fail;
+    if (PyArray_DIM(weights_npy, 0) != n)
+    {
+        PyErr_SetString(PyExc_ValueError, "w and weights must have the same length");
+        goto fail;
+    }
+    weights = PyArray_DATA(weights_npy);
+
+    out = (PyArrayObject *) PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (!out) goto fail;
+    brb = PyArray_DATA(out);
+
+    old_handler = gsl_set_error_handler(my_gsl_error);
+    Py_BEGIN_ALLOW_THREADS
+        status = bayestar_brb(brb, n, w, weights, snr);
+    Py_END_ALLOW_THREADS
+    gsl_set_error_handler(old_handler);
+
+    if (status != GSL_SUCCESS)
+        goto fail;
+
+    ret = out;
+    out = NULL;
+fail:
+    Py_XDECREF(w_npy);
+    Py_XDECREF(weights_npy);
+    Py_XDECREF(out);
     return (PyObject *) ret;
 };
 
 
+static PyObject *sky_map_injection_stats(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    double theta, phi;
+    PyObject *P_obj, *levels_obj = NULL;
+    PyArrayObject *P_npy = NULL, *levels_npy = NULL, *areas = NULL;
+    PyObject *ret = NULL;
+    npy_intp nlevels = 0;
+    bayestar_injection_stats stats;
+    int status;
+    gsl_error_handler_t *old_handler;
+
+    /* Names of arguments */
+    static const char *keywords[] = {"prob", "theta", "phi", "levels", NULL};
+
+    /* Silence warning about unused parameter. */
+    (void)module;
+
+    /* Parse arguments */
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Odd|O", keywords,
+        &P_obj, &theta, &phi, &levels_obj))
+        goto fail;
+
+    P_npy = (PyArrayObject *) PyArray_ContiguousFromAny(P_obj, NPY_DOUBLE, 1, 1);
+    if (!P_npy) goto fail;
+
+    if (levels_obj)
+    {
+        levels_npy = (PyArrayObject *) PyArray_ContiguousFromAny(levels_obj, NPY_DOUBLE, 1, 1);
+        if (!levels_npy) goto fail;
+        nlevels = PyArray_DIM(levels_npy, 0);
+    }
+
+    areas = (PyArrayObject *) PyArray_SimpleNew(1, &nlevels, NPY_DOUBLE);
+    if (!areas) goto fail;
+
+    old_handler = gsl_set_error_handler(my_gsl_error);
+    Py_BEGIN_ALLOW_THREADS
+        status = bayestar_injection_stats_compute(&stats, PyArray_DATA(areas),
+            PyArray_DIM(P_npy, 0), PyArray_DATA(P_npy), theta, phi, nlevels,
+            levels_npy ? PyArray_DATA(levels_npy) : NULL);
+    Py_END_ALLOW_THREADS
+    gsl_set_error_handler(old_handler);
+
+    if (status != GSL_SUCCESS)
+        goto fail;
+
+    ret = Py_BuildValue("dddO", stats.searched_area, stats.searched_prob,
+        stats.offset, areas);
+fail:
+    Py_XDECREF(P_npy);
+    Py_XDECREF(levels_npy);
+    Py_XDECREF(areas);
+    return ret;
+};
+
+
+static PyObject *sky_map_pyramid(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    int single = 0;
+    PyObject *P_obj, *nsides_obj;
+    PyArrayObject *P_npy = NULL, *nsides_npy = NULL;
+    PyObject *out = NULL, *ret = NULL;
+    const long *nsides;
+    void **levels = NULL;
+    npy_intp nlevels, i;
+    long nside;
+    int status;
+    gsl_error_handler_t *old_handler;
+
+    /* Names of arguments */
+    static const char *keywords[] = {"prob", "nsides", "single", NULL};
+
+    /* Silence warning about unused parameter. */
+    (void)module;
+
+    /* Parse arguments */
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|i", keywords,
+        &P_obj, &nsides_obj, &single))
+        goto fail;
+
+    P_npy = (PyArrayObject *) PyArray_ContiguousFromAny(P_obj, NPY_DOUBLE, 1, 1);
+    if (!P_npy) goto fail;
+
+    nsides_npy = (PyArrayObject *) PyArray_ContiguousFromAny(nsides_obj, NPY_LONG, 1, 1);
+    if (!nsides_npy) goto fail;
+    nlevels = PyArray_DIM(nsides_npy, 0);
+    nsides = PyArray_DATA(nsides_npy);
+
+    /* Check the resolutions before allocating the outputs, so that absurd
+     * ones fail cleanly rather than in an attempt at a huge allocation. */
+    nside = npix2nside(PyArray_DIM(P_npy, 0));
+    if (nside <= 0 || (nside & (nside - 1)))
+    {
+        PyErr_SetString(PyExc_ValueError, "input nside must be a power of 2");
+        goto fail;
+    }
+    for (i = 0; i < nlevels; i ++)
+    {
+        if (nsides[i] < 1 || nsides[i] > nside || (nsides[i] & (nsides[i] - 1)))
+        {
+            PyErr_SetString(PyExc_ValueError, "output nside must be a power of 2 that is no greater than the input nside");
+            goto fail;
+        }
+    }
+
+    out = PyTuple_New(nlevels);
+    if (!out) goto fail;
+    levels = malloc((nlevels + 1) * sizeof(void *));
+    if (!levels)
+    {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    for (i = 0; i < nlevels; i ++)
+    {
+        npy_intp npix = nside2npix(nsides[i]);
+        PyObject *level;
+        level = PyArray_SimpleNew(1, &npix, single ? NPY_FLOAT : NPY_DOUBLE);
+        if (!level) goto fail;
+        PyTuple_SET_ITEM(out, i, level);
+        levels[i] = PyArray_DATA((PyArrayObject *) level);
+    }
+
+    old_handler = gsl_set_error_handler(my_gsl_error);
+    Py_BEGIN_ALLOW_THREADS
+        status = bayestar_sky_map_pyramid(PyArray_DIM(P_npy, 0),
+            PyArray_DATA(P_npy), nlevels, nsides,
+            single ? NULL : (double **) levels,
+            single ? (float **) levels : NULL);
+    Py_END_ALLOW_THREADS
+    gsl_set_error_handler(old_handler);
+
+    if (status != GSL_SUCCESS)
+        goto fail;
+
+    ret = out;
+    out = NULL;
+fail:
+    free(levels);
+    Py_XDECREF(P_npy);
+    Py_XDECREF(nsides_npy);
+    Py_XDECREF(out);
+    return ret;
+};
+
+
+static PyObject *sky_map_isa(PyObject *module, PyObject *args)
+{
+    /* Silence warnings about unused parameters. */
+    (void)module;
+    (void)args;
+
+    return PyString_FromString(bayestar_isa());
+};
+
+
 static PyMethodDef methods[] = {
     {"tdoa", (PyCFunction)sky_map_tdoa, METH_VARARGS | METH_KEYWORDS, "fill me in"},
     {"tdoa_snr", (PyCFunction)sky_map_tdoa_snr, METH_VARARGS | METH_KEYWORDS, "fill me in"},
+    {"brb", (PyCFunction)sky_map_brb, METH_VARARGS | METH_KEYWORDS,
+        "brb(w, weights, snr)\n\n"
+        "Barankin bound on the covariance of phase and time of arrival, given\n"
+        "angular frequency samples w and the SNR per unit angular frequency\n"
+        "at each sample."},
+    {"isa", (PyCFunction)sky_map_isa, METH_NOARGS,
+        "isa()\n\n"
+        "Name of the instruction set variant of the sky map code that is in\n"
+        "use on this CPU, or 'none' if the extension was built without\n"
+        "instruction set variants."},
+    {"injection_stats", (PyCFunction)sky_map_injection_stats, METH_VARARGS | METH_KEYWORDS,
+        "injection_stats(prob, theta, phi, levels=())\n\n"
+        "Given a RING-ordered HEALPix sky map and the true location of the\n"
+        "source in spherical polar coordinates, return the searched area in\n"
+        "deg^2, the searched probability, the offset in degrees between the\n"
+        "mode and the true location, and an array of the areas in deg^2 of\n"
+        "the smallest regions that contain the given credible levels."},
+    {"pyramid", (PyCFunction)sky_map_pyramid, METH_VARARGS | METH_KEYWORDS,
+        "pyramid(prob, nsides, single=False)\n\n"
+        "Down-sample a RING-ordered HEALPix sky map to each of the given\n"
+        "resolutions, which must be powers of 2 no finer than that of the\n"
+        "input, conserving probability. Returns a tuple of RING-ordered maps,\n"
+        "one for each resolution, in single precision if single is true."},
     {NULL, NULL, 0, NULL}
 };
 
 
 PyMODINIT_FUNC
 initsky_map(void) {
+    PyObject *module;
+
     premalloced_type.tp_new = PyType_GenericNew;
     if (PyType_Ready(&premalloced_type) < 0)
         return;
 
-    Py_InitModule("sky_map", methods);
+    network_type.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&network_type) < 0)
+        return;
+
+    module = Py_InitModule("sky_map", methods);
+    if (!module)
+        return;
     import_array();
+
+    Py_INCREF(&network_type);
+    PyModule_AddObject(module, "Network", (PyObject *) &network_type);
+
+    MemoryBudgetError = PyErr_NewException("sky_map.MemoryBudgetError",
+        PyExc_MemoryError, NULL);
+    if (!MemoryBudgetError)
+        return;
+    Py_INCREF(MemoryBudgetError);
+    PyModule_AddObject(module, "MemoryBudgetError", MemoryBudgetError);
+
+    PyEval_InitThreads();
 }
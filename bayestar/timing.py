@@ -31,6 +31,7 @@ from scipy import linalg
 from scipy import optimize
 from .decorator import memoized
 from .filter import CreateForwardREAL8FFTPlan
+from . import sky_map
 
 
 log = logging.getLogger('BAYESTAR')
@@ -197,7 +198,15 @@ class SignalModel(object):
 
     @memoized
     def get_brb(self, snr):
-        """Get the Barankin bound on the phase and time estimation covariance."""
+        """Get the Barankin bound on the phase and time estimation covariance.
+        This calls the C implementation, sky_map.brb, which computes all of
+        the frequency moments in a single pass over the frequency samples."""
+        return np.asmatrix(sky_map.brb(self.w, self.denom_integrand, snr))
+
+    @memoized
+    def get_brb_numpy(self, snr):
+        """Get the Barankin bound on the phase and time estimation covariance.
+        This is the reference implementation of get_brb in pure Numpy."""
 
         # Mean-square angular frequency.
         w1 = self.get_sn_moment(1)
@@ -0,0 +1,199 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Array-based construction of template banks in the TaylorF2RedSpin chirp times
+(theta0, theta3, theta3S) of P. Ajith (2011, http://arxiv.org/abs/1107.1267).
+
+The transformations between chirp times and (mchirp, eta, chi) are evaluated
+in closed form over whole arrays. The first time that they are used for a
+given low frequency cutoff, they are checked against
+lalsimulation.SimInspiralTaylorF2RedSpinChirpTimesFromMchirpEtaChi and
+SimInspiralTaylorF2RedSpinMchirpEtaChiFromChirpTimes; if they disagree, the
+LALSimulation functions are evaluated point by point instead.
+"""
+from __future__ import division
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import logging
+import numpy as np
+import lal, lalsimulation
+from .decorator import memoized
+
+
+log = logging.getLogger('BAYESTAR')
+
+
+def _v0(mtotal, f_low):
+    """Post-Newtonian velocity parameter (pi M f_low)^(1/3)."""
+    return np.power(np.pi * lal.LAL_MTSUN_SI * mtotal * f_low, 1 / 3)
+
+
+def _closed_form_chirp_times(mchirp, eta, chi, f_low):
+    v0 = _v0(mchirp * eta ** -0.6, f_low)
+    theta0 = 5 / (128 * eta * v0 ** 5)
+    theta3 = -np.pi / (4 * eta * v0 ** 2)
+    theta3S = 113 / (48 * eta * v0 ** 2) * chi
+    return theta0, theta3, theta3S
+
+
+def _closed_form_mchirp_eta_chi(theta0, theta3, theta3S, f_low):
+    v0_cubed = -5 * theta3 / (32 * np.pi * theta0)
+    mtotal = v0_cubed / (np.pi * lal.LAL_MTSUN_SI * f_low)
+    eta = 5 / (128 * theta0 * v0_cubed ** (5 / 3))
+    chi = -12 * np.pi * theta3S / (113 * theta3)
+    mchirp = mtotal * eta ** 0.6
+    return mchirp, eta, chi
+
+
+_lalsim_chirp_times = np.vectorize(
+    lalsimulation.SimInspiralTaylorF2RedSpinChirpTimesFromMchirpEtaChi)
+_lalsim_mchirp_eta_chi = np.vectorize(
+    lalsimulation.SimInspiralTaylorF2RedSpinMchirpEtaChiFromChirpTimes)
+
+
+@memoized
+def _closed_form_agrees(f_low):
+    """Check the closed form transformations against LALSimulation at a few
+    representative points."""
+    mchirp = np.asarray([0.87, 1.22, 5.2, 20.])
+    eta = np.asarray([0.25, 0.2, 0.1, 0.24])
+    chi = np.asarray([0., 0.3, -0.5, 0.9])
+    expected = [np.asarray([lalsimulation.SimInspiralTaylorF2RedSpinChirpTimesFromMchirpEtaChi(*args)])
+        for args in zip(mchirp, eta, chi, [f_low] * len(mchirp))]
+    expected = np.vstack(expected).T
+    thetas = np.asarray(_closed_form_chirp_times(mchirp, eta, chi, f_low))
+    agrees = np.allclose(thetas, expected, rtol=1e-8, atol=0)
+    if agrees:
+        agrees = np.allclose(
+            _closed_form_mchirp_eta_chi(*(list(expected) + [f_low])),
+            [mchirp, eta, chi], rtol=1e-8, atol=1e-12)
+    if not agrees:
+        log.warn('closed form chirp times disagree with LALSimulation at f_low=%g Hz; '
+            'falling back to point-by-point evaluation', f_low)
+    return agrees
+
+
+def chirp_times_from_mchirp_eta_chi(mchirp, eta, chi, f_low):
+    """Compute the chirp times (theta0, theta3, theta3S) for arrays of chirp
+    mass, symmetric mass ratio, and reduced spin."""
+    mchirp, eta, chi = np.broadcast_arrays(mchirp, eta, chi)
+    if _closed_form_agrees(f_low):
+        return _closed_form_chirp_times(mchirp, eta, chi, f_low)
+    else:
+        return _lalsim_chirp_times(mchirp, eta, chi, f_low)
+
+
+def mchirp_eta_chi_from_chirp_times(theta0, theta3, theta3S, f_low):
+    """Compute the chirp mass, symmetric mass ratio, and reduced spin for
+    arrays of chirp times (theta0, theta3, theta3S). Unphysical chirp times
+    may result in nan values or in values that are out of range."""
+    theta0, theta3, theta3S = np.broadcast_arrays(theta0, theta3, theta3S)
+    if _closed_form_agrees(f_low):
+        with np.errstate(invalid='ignore', divide='ignore'):
+            return _closed_form_mchirp_eta_chi(theta0, theta3, theta3S, f_low)
+    else:
+        return _lalsim_mchirp_eta_chi(theta0, theta3, theta3S, f_low)
+
+
+def component_masses(mchirp, eta):
+    """Compute the component masses (mass1 <= mass2) and total mass for arrays
+    of chirp mass and symmetric mass ratio."""
+    mtotal = mchirp * eta ** -0.6
+    with np.errstate(invalid='ignore'):
+        sqrt_discriminant = np.sqrt(1 - 4 * eta)
+    mass1 = 0.5 * mtotal * (1 - sqrt_discriminant)
+    mass2 = 0.5 * mtotal * (1 + sqrt_discriminant)
+    return mass1, mass2, mtotal
+
+
+def lattice(initial_mass1, initial_mass2, basis, n, min_mass, max_mass, f_low):
+    """Sample a lattice in (theta0, theta3) with theta3S=0, anchored at the
+    initial point (initial_mass1, initial_mass2) and spanned by the columns of
+    the 2x2 matrix basis, out to n lattice steps in each direction. Keep only
+    the lattice points whose component masses both lie between min_mass and
+    max_mass. The initial point keeps its exact parameters, so that roundoff
+    cannot make it unphysical.
+
+    Rather than testing all (2 n + 1)^2 lattice points, restrict the lattice
+    to the bounding box of the physical region. The boundary of the region of
+    allowed component masses (T. Cokelaer 2007,
+    http://dx.doi.org/10.1103/PhysRevD.76.102004) is mapped into lattice
+    coordinates, and only lattice points within its bounding box are tested.
+
+    Returns the arrays theta0, theta3, mchirp, eta, chi, mass1, mass2, and
+    mtotal, with one entry per template."""
+
+    initial_mtotal = initial_mass1 + initial_mass2
+    initial_eta = initial_mass1 * initial_mass2 / np.square(initial_mtotal)
+    initial_mchirp = initial_mtotal * initial_eta ** 0.6
+    initial_theta = np.asarray(chirp_times_from_mchirp_eta_chi(
+        initial_mchirp, initial_eta, 0, f_low)[:2])
+
+    # Trace the boundary of the region min_mass <= mass1 <= mass2 <= max_mass,
+    # and find its extent in lattice coordinates.
+    m = np.linspace(min_mass, max_mass, 1024)
+    m_min = np.repeat(min_mass, len(m))
+    m_max = np.repeat(max_mass, len(m))
+    boundary_mass1 = np.concatenate((m_min, m, m))
+    boundary_mass2 = np.concatenate((m, m_max, m))
+    boundary_mtotal = boundary_mass1 + boundary_mass2
+    boundary_eta = boundary_mass1 * boundary_mass2 / np.square(boundary_mtotal)
+    boundary_theta = np.asarray(chirp_times_from_mchirp_eta_chi(
+        boundary_mtotal * boundary_eta ** 0.6, boundary_eta, 0, f_low)[:2])
+    boundary_i = np.linalg.solve(basis, boundary_theta - initial_theta[:, np.newaxis])
+
+    # Pad by a lattice step to allow for the sampling of the boundary.
+    i_min = np.maximum(np.floor(boundary_i.min(axis=1)).astype(int) - 1, -n)
+    i_max = np.minimum(np.ceil(boundary_i.max(axis=1)).astype(int) + 1, n)
+
+    # Generate the lattice points within the bounding box. Make sure that the
+    # initial point is included.
+    i_min = np.minimum(i_min, 0)
+    i_max = np.maximum(i_max, 0)
+    i0, i1 = np.mgrid[i_min[0]:i_max[0]+1, i_min[1]:i_max[1]+1]
+    i = np.row_stack((i0.ravel(), i1.ravel()))
+    theta0, theta3 = np.dot(basis, i) + initial_theta[:, np.newaxis]
+
+    # Transform to masses, and find the physical points.
+    mchirp, eta, chi = mchirp_eta_chi_from_chirp_times(theta0, theta3, 0, f_low)
+    mass1, mass2, mtotal = component_masses(mchirp, eta)
+    with np.errstate(invalid='ignore'):
+        keep = ((mchirp >= 0) & (0 <= eta) & (eta <= 0.25) & (-1 <= chi) & (chi <= 1)
+            & (min_mass <= mass1) & (mass1 <= max_mass)
+            & (min_mass <= mass2) & (mass2 <= max_mass))
+
+    # Always keep the initial point, with its exact parameters.
+    initial = (i[0] == 0) & (i[1] == 0)
+    mchirp[initial] = initial_mchirp
+    eta[initial] = initial_eta
+    chi[initial] = 0
+    mass1[initial] = initial_mass1
+    mass2[initial] = initial_mass2
+    mtotal[initial] = initial_mtotal
+    keep[initial] = (min_mass <= initial_mass1 <= max_mass
+        and min_mass <= initial_mass2 <= max_mass)
+
+    return tuple(a[keep] for a in (theta0, theta3, mchirp, eta, chi, mass1, mass2, mtotal))
+
+
+def metric_distance(thetas, thetas_0, metric):
+    """Compute the squared metric distance between each of the rows of the
+    array thetas and the point thetas_0, under the given metric."""
+    dthetas = np.asarray(thetas) - thetas_0
+    return np.sum(np.dot(dthetas, metric) * dthetas, axis=1)
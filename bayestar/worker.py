@@ -0,0 +1,227 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Persistent localization worker. A long-running process imports LAL, Healpy,
+Glue, and the sky map extension once, warms up its caches, and then serves
+localization requests that arrive over a Unix domain socket. This avoids
+paying the start-up cost of a fresh Python process for every alert.
+
+The protocol is one line of JSON in each direction per connection. A request
+is a dictionary with the keys
+
+  coinc: path to a coinc.xml file (required)
+  psd: path to a psd.xml[.gz] file (optional)
+  output: path at which to write the FITS file (optional; by default, a new
+          file is created in the worker's spool directory)
+  objid: unique identifier for the event, recorded in the FITS header; if
+         the same objid is localized again, the worker reuses work from the
+         previous localization (see bayestar.ligolw_sky_map.WarmStart)
+
+and any of the localization options that the worker was started with, which
+override the worker's defaults for that request. The response is a dictionary
+with the key 'status', which is 'ok' or 'error'. On success, 'fits' is the
+path of the FITS file, 'gps_time' is the time of the event, 'runtime' is the
+time spent in the sky map code, and 'latency' is the time between receiving
+the request and finishing writing the FITS file. On failure, 'message'
+describes the error.
+
+If the worker has a result cache, then a request whose inputs are identical to
+those of an earlier one is answered from the cache instead of being localized
+again (see bayestar.result_cache).
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+import collections
+import json
+import logging
+import os
+import socket
+import stat
+import tempfile
+import time
+import SocketServer
+
+
+log = logging.getLogger('BAYESTAR')
+
+
+# Options that a request may override.
+localization_options = ('waveform', 'f_low', 'min_distance', 'max_distance',
+    'prior', 'reference_frequency', 'nside')
+
+
+# Number of recently localized events for which to keep warm-start state.
+max_warm_starts = 64
+
+
+def warm_up(ifos=('H1', 'L1', 'V1')):
+    """Import the modules that localization needs and run a small synthetic
+    localization, so that the first real request does not pay for loading
+    shared libraries, populating LAL's detector and PSD tables, or starting
+    the OpenMP thread pool."""
+    import numpy as np
+    import lal
+    import lalsimulation
+    from . import fits
+    from . import ligolw_sky_map
+    from . import sky_map
+    from . import timing
+
+    detectors = [lalsimulation.InstrumentNameToLALDetector(ifo) for ifo in ifos]
+    responses = [det.response for det in detectors]
+    locations = [det.location for det in detectors]
+    for ifo in ifos:
+        timing.get_noise_psd_func(ifo)
+
+    # Source directly above the north pole of the Earth.
+    toas = np.asarray([-location[2] / lal.LAL_C_SI for location in locations])
+    snrs = np.repeat(10., len(ifos))
+    s2_toas = np.repeat(np.square(1e-4), len(ifos))
+    horizons = np.repeat(100., len(ifos))
+    sky_map.tdoa_snr(0., toas, snrs, s2_toas, responses, locations,
+        horizons, 5., 20., "uniform in log distance", nside=16)
+
+
+class LocalizationRequestHandler(SocketServer.StreamRequestHandler):
+    """Handle one JSON request and write one JSON response."""
+
+    def handle(self):
+        try:
+            request = json.loads(self.rfile.readline())
+            if not isinstance(request, dict):
+                raise ValueError("request must be a JSON object")
+            response = self.server.localize(**dict(
+                (str(key), value) for key, value in request.iteritems()))
+        except Exception as e:
+            log.exception("localization request failed")
+            response = {'status': 'error', 'message': str(e)}
+        self.wfile.write(json.dumps(response) + '\n')
+
+
+class LocalizationServer(SocketServer.UnixStreamServer):
+    """Serve localization requests on a Unix domain socket. Requests are
+    handled one at a time; each localization is already parallelized with
+    OpenMP."""
+
+    def __init__(self, socket_path, waveform="TaylorF2threePointFivePN",
+            f_low=10, min_distance=None, max_distance=None,
+            prior="uniform in log distance", reference_frequency=None,
+            nside=-1, spool_dir=None, creator=None, result_cache=None):
+        self.defaults = dict(waveform=waveform, f_low=f_low,
+            min_distance=min_distance, max_distance=max_distance,
+            prior=prior, reference_frequency=reference_frequency,
+            nside=nside)
+        self.spool_dir = spool_dir
+        self.creator = creator
+        self.result_cache = result_cache
+        self.warm_starts = collections.OrderedDict()
+
+        # Remove a stale socket left behind by a previous worker, but refuse
+        # to clobber anything that is not a socket.
+        try:
+            mode = os.stat(socket_path).st_mode
+        except OSError:
+            pass
+        else:
+            if stat.S_ISSOCK(mode):
+                os.unlink(socket_path)
+        SocketServer.UnixStreamServer.__init__(self, socket_path,
+            LocalizationRequestHandler)
+
+    def server_close(self):
+        SocketServer.UnixStreamServer.server_close(self)
+        try:
+            os.unlink(self.server_address)
+        except OSError:
+            pass
+
+    def localize(self, coinc, psd=None, output=None, objid=None, **kwargs):
+        from . import fits
+        from .ligolw_sky_map import gracedb_sky_map, WarmStart
+
+        start_time = time.time()
+
+        unknown = set(kwargs) - set(localization_options)
+        if unknown:
+            raise ValueError("unrecognized options: " + ", ".join(sorted(unknown)))
+        options = dict(self.defaults)
+        options.update(kwargs)
+
+        # Look up the state left behind by the last localization of this
+        # event, keeping the most recently used events at the end.
+        if objid is None:
+            warm_start = None
+        else:
+            warm_start = self.warm_starts.pop(objid, None) or WarmStart()
+            self.warm_starts[objid] = warm_start
+            while len(self.warm_starts) > max_warm_starts:
+                self.warm_starts.popitem(last=False)
+
+        log.info("%s:starting sky localization", coinc)
+        with open(coinc, 'rb') as coinc_file:
+            if psd is None:
+                psd_file = None
+            else:
+                psd_file = open(psd, 'rb')
+            try:
+                sky_map, epoch, elapsed_time = gracedb_sky_map(coinc_file,
+                    psd_file, options['waveform'], options['f_low'],
+                    options['min_distance'], options['max_distance'],
+                    options['prior'],
+                    reference_frequency=options['reference_frequency'],
+                    nside=options['nside'], warm_start=warm_start,
+                    cache=self.result_cache)
+            finally:
+                if psd_file is not None:
+                    psd_file.close()
+
+        if output is None:
+            fd, output = tempfile.mkstemp(suffix='.fits.gz', dir=self.spool_dir)
+            os.close(fd)
+        fits.write_sky_map(output, sky_map, gps_time=float(epoch),
+            creator=self.creator, objid=objid, runtime=elapsed_time)
+        log.info("%s:wrote sky map to %s", coinc, output)
+
+        return {'status': 'ok', 'fits': output, 'gps_time': float(epoch),
+            'runtime': elapsed_time, 'latency': time.time() - start_time}
+
+
+def request_localization(socket_path, coinc, psd=None, output=None,
+        timeout=None, **kwargs):
+    """Ask the worker listening on socket_path to localize an event, and
+    return the response as a dictionary. Raises RuntimeError if the worker
+    reports an error."""
+    request = dict(kwargs, coinc=os.path.abspath(coinc))
+    if psd is not None:
+        request['psd'] = os.path.abspath(psd)
+    if output is not None:
+        request['output'] = os.path.abspath(output)
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.settimeout(timeout)
+        sock.connect(socket_path)
+        sock.sendall(json.dumps(request) + '\n')
+        response = json.loads(sock.makefile('rb').readline())
+    finally:
+        sock.close()
+
+    if response.get('status') != 'ok':
+        raise RuntimeError(response.get('message', 'localization failed'))
+    return response
@@ -0,0 +1,327 @@
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Tuned builds of Python C extensions, on top of the OpenMP support in
+setuptools_openmp. The following options are added to `build_ext`:
+
+  --lto           Link-time optimization.
+  --pgo-generate=DIR
+                  Instrument the extensions to write execution profiles to DIR.
+  --pgo-use=DIR   Optimize the extensions using the execution profiles in DIR.
+  --isa-variants  Build the hot source files of an extension several times,
+                  for baseline x86-64, for AVX2, and for AVX-512, and link
+                  them all into the extension, which chooses between them at
+                  runtime according to the features of the CPU. Variants that
+                  the compiler does not support are skipped.
+
+The `build_pgo` command builds the extensions in place with profile-guided
+optimization in three steps: it builds instrumented extensions, runs a
+training command, and rebuilds the extensions using the profiles that the
+training command wrote. The profiles are matched to object files by path, so
+the same build directory is used for both builds.
+
+
+Examples
+--------
+
+    # Link-time optimization and instruction set variants
+    $ python setup.py build_ext --lto --isa-variants
+
+    # Profile-guided optimization, trained on the given command
+    $ python setup.py build_pgo --training-command='bin/bayestar_sky_map_regression'
+
+
+Usage
+-----
+
+To use, add the following line to your `setup.py` script instead of importing
+setuptools_openmp::
+
+    from misc.setuptools_tuning import *
+
+To build instruction set variants of an extension, pass the source files that
+contain its hot code as the `isa_variants` keyword argument, the source file
+that dispatches between them as `isa_dispatch`, and a prefix for the
+preprocessor macros as `isa_prefix`::
+
+    Extension(
+        ...,
+        isa_variants=['hot.c'],
+        isa_dispatch='dispatch.c',
+        isa_prefix='MY_'
+    )
+
+With --isa-variants, each variant of each file in `isa_variants` is compiled
+with the macro MY_ISA defined to the name of the variant ('baseline', 'avx2',
+or 'avx512'); the baseline variant also has MY_ISA_BASELINE defined. The
+dispatch file is compiled with MY_HAVE_AVX2 and MY_HAVE_AVX512 defined for the
+variants that were built. Without --isa-variants, the files in `isa_variants`
+are compiled normally and the dispatch file is left out.
+
+Finally, add both commands to the `cmdclass` keyword of `setup()`::
+
+    setup(
+        ...
+        cmdclass={'build_ext': build_ext, 'build_pgo': build_pgo},
+    )
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+
+from distutils import log as _log
+from distutils.core import Command as _Command
+from distutils.dir_util import mkpath as _mkpath
+from distutils.errors import DistutilsOptionError as _DistutilsOptionError
+from distutils.errors import CCompilerError as _CCompilerError
+from .setuptools_openmp import build_ext as _build_ext
+from .setuptools_openmp import Extension as _Extension
+import os as _os
+import platform as _platform
+import subprocess as _subprocess
+import tempfile as _tempfile
+
+__all__ = ['build_ext', 'build_pgo', 'Extension']
+
+
+# Instruction set variants: name, compiler flags.
+_isa_variants = [
+    ('baseline', ['-O3', '-march=x86-64', '-mtune=generic']),
+    ('avx2', ['-O3', '-march=haswell', '-mtune=haswell']),
+    ('avx512', ['-O3', '-march=skylake-avx512', '-mtune=skylake-avx512'])
+]
+
+
+class build_ext(_build_ext):
+    """Extend the OpenMP build_ext command with link-time optimization,
+    profile-guided optimization, and instruction set variants."""
+
+    user_options = _build_ext.user_options + [
+        ('lto', None, 'enable link-time optimization'),
+        ('pgo-generate=', None, 'instrument extensions to write execution profiles to this directory'),
+        ('pgo-use=', None, 'optimize extensions using execution profiles from this directory'),
+        ('isa-variants', None, 'build instruction set variants of hot code, chosen at runtime')
+        ]
+
+    boolean_options = _build_ext.boolean_options + ['lto', 'isa-variants']
+
+    def initialize_options(self):
+        self.lto = 0
+        self.pgo_generate = None
+        self.pgo_use = None
+        self.isa_variants = 0
+        _build_ext.initialize_options(self)
+
+    def finalize_options(self):
+        if self.pgo_generate and self.pgo_use:
+            raise _DistutilsOptionError("--pgo-generate and --pgo-use are mutually exclusive")
+        if self.pgo_generate:
+            self.pgo_generate = _os.path.abspath(self.pgo_generate)
+        if self.pgo_use:
+            self.pgo_use = _os.path.abspath(self.pgo_use)
+        if self.isa_variants and _platform.machine().lower() not in ('x86_64', 'amd64'):
+            raise _DistutilsOptionError("--isa-variants is only supported on x86-64")
+        _build_ext.finalize_options(self)
+
+    def _compiler_supports(self, flags):
+        """Determine if the compiler accepts the given flags by compiling and
+        linking a test program."""
+        _mkpath(self.build_temp)
+        with _tempfile.NamedTemporaryFile(mode='w', dir=self.build_temp, prefix='flagtest', suffix='.c') as srcfile:
+            srcfile.write("int main(void) { return 0; }\n")
+            srcfile.flush()
+            # Link too, because some flags (such as -flto without a linker
+            # plugin) are accepted by the compiler but fail at link time.
+            progname = _os.path.splitext(_os.path.basename(srcfile.name))[0]
+            objects = []
+            try:
+                objects = self.compiler.compile([srcfile.name], extra_postargs=flags, output_dir="/")
+                self.compiler.link_executable(objects, progname, output_dir=self.build_temp, extra_postargs=flags)
+            except _CCompilerError:
+                return False
+            finally:
+                for o in objects + [_os.path.join(self.build_temp, self.compiler.executable_filename(progname))]:
+                    if _os.path.exists(o):
+                        _os.remove(o)
+            return True
+
+    def build_extensions(self):
+        compile_args = []
+        link_args = []
+
+        if self.lto:
+            if self._compiler_supports(['-flto']):
+                _log.info("enabling link-time optimization")
+                compile_args += ['-flto']
+                link_args += ['-flto']
+            else:
+                raise _DistutilsOptionError("compiler does not support link-time optimization")
+
+        if self.pgo_generate:
+            _log.info("instrumenting extensions to write profiles to %s", self.pgo_generate)
+            compile_args += ['-fprofile-generate=' + self.pgo_generate]
+            link_args += ['-fprofile-generate=' + self.pgo_generate]
+        elif self.pgo_use:
+            _log.info("optimizing extensions using profiles from %s", self.pgo_use)
+            # Tolerate counters that are slightly off because of concurrent
+            # updates from OpenMP threads, and objects with no profile, such
+            # as instruction set variants that the training CPU did not run.
+            compile_args += ['-fprofile-use=' + self.pgo_use, '-fprofile-correction', '-Wno-missing-profile']
+            link_args += ['-fprofile-use=' + self.pgo_use]
+
+        if self.isa_variants:
+            self.supported_isa_variants = [(name, flags)
+                for name, flags in _isa_variants
+                if self._compiler_supports(flags)]
+            _log.info("building instruction set variants: %s",
+                ", ".join(name for name, flags in self.supported_isa_variants))
+
+        # The flags are added to the extensions for this build only, so that
+        # build_pgo can run this command twice with different flags.
+        saved = [(ext, dict((key, list(value) if isinstance(value, list) else value)
+            for key, value in vars(ext).items())) for ext in self.extensions]
+        try:
+            for ext in self.extensions:
+                ext.extra_compile_args = (ext.extra_compile_args or []) + compile_args
+                ext.extra_link_args = (ext.extra_link_args or []) + link_args
+
+            # Chain to method in parent class.
+            _build_ext.build_extensions(self)
+        finally:
+            for ext, attributes in saved:
+                vars(ext).clear()
+                vars(ext).update(attributes)
+
+    def build_extension(self, ext):
+        variant_sources = getattr(ext, 'isa_variant_sources', [])
+        if not variant_sources:
+            pass
+        elif not self.isa_variants:
+            ext.sources = [source for source in ext.sources if source != ext.isa_dispatch]
+        else:
+            prefix = ext.isa_prefix
+            objects = []
+            for source in variant_sources:
+                for name, flags in self.supported_isa_variants:
+                    # Compile a wrapper that includes the source file, so
+                    # that each variant gets its own object file.
+                    wrapper_dir = _os.path.join(self.build_temp, 'isa')
+                    _mkpath(wrapper_dir)
+                    wrapper = _os.path.join(wrapper_dir, '%s_%s.c' % (
+                        _os.path.splitext(_os.path.basename(source))[0], name))
+                    with open(wrapper, 'w') as f:
+                        f.write('#include "%s"\n' % _os.path.abspath(source))
+                    macros = list(ext.define_macros or []) + [(prefix + 'ISA', name)]
+                    if name == 'baseline':
+                        macros += [(prefix + 'ISA_BASELINE', None)]
+                    objects += self.compiler.compile([wrapper],
+                        output_dir=self.build_temp, macros=macros,
+                        include_dirs=ext.include_dirs, debug=self.debug,
+                        extra_postargs=list(ext.extra_compile_args or []) + flags,
+                        depends=[source] + list(ext.depends or []))
+            ext.sources = [source for source in ext.sources if source not in variant_sources]
+            if ext.isa_dispatch not in ext.sources:
+                ext.sources.append(ext.isa_dispatch)
+            ext.define_macros = list(ext.define_macros or []) + [
+                (prefix + 'HAVE_' + name.upper(), None)
+                for name, flags in self.supported_isa_variants
+                if name != 'baseline']
+            ext.extra_objects = list(ext.extra_objects or []) + objects
+            ext.depends = list(ext.depends or []) + variant_sources
+        _build_ext.build_extension(self, ext)
+
+
+class build_pgo(_Command):
+    """Build extensions in place with profile-guided optimization."""
+
+    description = "build C extensions in place with profile-guided optimization"
+
+    user_options = [
+        ('profile-dir=', None, 'directory for execution profiles (default: build/pgo)'),
+        ('training-command=', None, 'shell command that exercises the extensions'),
+        ('lto', None, 'enable link-time optimization'),
+        ('isa-variants', None, 'build instruction set variants of hot code, chosen at runtime')
+        ]
+
+    boolean_options = ['lto', 'isa-variants']
+
+    def initialize_options(self):
+        self.profile_dir = None
+        self.training_command = None
+        self.lto = 0
+        self.isa_variants = 0
+
+    def finalize_options(self):
+        if self.profile_dir is None:
+            self.profile_dir = _os.path.join('build', 'pgo')
+        self.profile_dir = _os.path.abspath(self.profile_dir)
+        if not self.training_command:
+            raise _DistutilsOptionError("--training-command is required")
+
+    def _build(self, **kwargs):
+        cmd = self.reinitialize_command('build_ext')
+        cmd.inplace = 1
+        cmd.force = 1
+        cmd.lto = self.lto
+        cmd.isa_variants = self.isa_variants
+        for key, value in kwargs.items():
+            setattr(cmd, key, value)
+        self.run_command('build_ext')
+        return cmd
+
+    def run(self):
+        # Start from empty profiles.
+        if _os.path.isdir(self.profile_dir):
+            for dirpath, dirnames, filenames in _os.walk(self.profile_dir):
+                for filename in filenames:
+                    if filename.endswith('.gcda'):
+                        _os.remove(_os.path.join(dirpath, filename))
+
+        cmd = self._build(pgo_generate=self.profile_dir)
+
+        # Train every instruction set variant that this CPU can run. The
+        # dispatcher ignores a variant that the CPU does not support, so
+        # those runs just train the best supported variant again.
+        env = dict(_os.environ)
+        env['PYTHONPATH'] = _os.pathsep.join(
+            [_os.path.abspath('.')] + env.get('PYTHONPATH', '').split(_os.pathsep))
+        variants = [None]
+        if self.isa_variants:
+            variants = [name for name, flags in cmd.supported_isa_variants]
+        for variant in variants:
+            for ext in self.distribution.ext_modules:
+                prefix = getattr(ext, 'isa_prefix', None)
+                if variant and prefix:
+                    env[prefix + 'ISA'] = variant
+            _log.info("training: %s", self.training_command)
+            _subprocess.check_call(self.training_command, shell=True, env=env)
+
+        self._build(pgo_use=self.profile_dir)
+
+
+class Extension(_Extension):
+    """Extend the OpenMP Extension to take options for instruction set
+    variants."""
+    def __init__(self, names, sources, isa_variants=(), isa_dispatch=None, isa_prefix='', **kw):
+        if isa_variants and not isa_dispatch:
+            raise ValueError("isa_variants requires isa_dispatch")
+        self.isa_variant_sources = list(isa_variants)
+        self.isa_dispatch = isa_dispatch
+        self.isa_prefix = isa_prefix
+        if isa_dispatch and isa_dispatch not in sources:
+            sources = list(sources) + [isa_dispatch]
+        _Extension.__init__(self, names, sources, **kw)
@@ -19,7 +19,7 @@
 
 from setuptools import setup
 from misc import *
-from misc.setuptools_openmp import *
+from misc.setuptools_tuning import *
 import numpy as np
 
 
@@ -34,7 +34,10 @@ setup(
     namespace_packages=['bayestar'],
     packages=['bayestar'],
     ext_modules=[
-        Extension('bayestar.sky_map', ['bayestar/sky_map.c', 'bayestar/bayestar_sky_map.c'],
+        Extension('bayestar.sky_map', ['bayestar/sky_map.c', 'bayestar/bayestar_sky_map.c', 'bayestar/bayestar_timing.c', 'bayestar/bayestar_stats.c'],
+            isa_variants=['bayestar/bayestar_sky_map.c'],
+            isa_dispatch='bayestar/bayestar_dispatch.c',
+            isa_prefix='BAYESTAR_',
             **copy_library_dirs_to_runtime_library_dirs(
             **pkgconfig('lal', 'lalsimulation', 'gsl', 'chealpix',
                 include_dirs=[np.get_include()],
@@ -50,13 +53,15 @@ setup(
         'bin/bayestar_lattice_tmpltbank',
         'bin/bayestar_localize_gracedb',
         'bin/bayestar_localize_lvalert',
+        'bin/bayestar_localize_worker',
         'bin/bayestar_cluster_coincs',
         'bin/bayestar_prune_neighborhood_tmpltbank',
         'bin/bayestar_realize_coincs',
         'bin/bayestar_localize_coincs',
         'bin/bayestar_sim_to_tmpltbank',
         'bin/ligolw_coire_to_coinc',
-        'bin/bayestar_littlehope'
+        'bin/bayestar_littlehope',
+        'bin/bayestar_sky_map_regression'
     ],
-    cmdclass={'build_ext': build_ext}
+    cmdclass={'build_ext': build_ext, 'build_pgo': build_pgo}
 )
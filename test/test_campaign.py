@@ -0,0 +1,122 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+"""
+Test cases for the recovery of abandoned claims in bayestar.campaign.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import os
+import shutil
+import tempfile
+import time
+import unittest
+from bayestar import campaign
+
+
+class TestWorkQueue(unittest.TestCase):
+
+    keys = ['a', 'b', 'c']
+    claim_timeout = 60
+
+    # How long to wait for a heartbeat before declaring that there was none.
+    # This only bounds how long a failing test takes.
+    timeout = 10
+
+    def setUp(self):
+        self.root = tempfile.mkdtemp()
+        self.queue = campaign.WorkQueue(self.root)
+        self.queue.populate(self.keys)
+
+    def tearDown(self):
+        shutil.rmtree(self.root)
+
+    def pending(self):
+        return sorted(os.listdir(self.queue.pending_dir))
+
+    def claimed(self):
+        return sorted(filename.split('@', 1)[0]
+            for filename in os.listdir(self.queue.claimed_dir))
+
+    def backdate(self, key):
+        """Make a claim look as if it was last touched long ago."""
+        then = time.time() - 2 * self.claim_timeout
+        os.utime(self.queue._claim_path(key), (then, then))
+
+    def test_fresh_claim_kept(self):
+        key = self.queue.claim()
+        self.queue.requeue_stale(self.claim_timeout)
+        self.assertEqual(self.claimed(), [key])
+        self.assertNotIn(key, self.pending())
+
+    def test_stale_claim_requeued(self):
+        # The claim was made by a process that still exists, but it has not
+        # been touched for longer than the timeout.
+        key = self.queue.claim()
+        self.backdate(key)
+        self.queue.requeue_stale(self.claim_timeout)
+        self.assertEqual(self.claimed(), [])
+        self.assertEqual(self.pending(), self.keys)
+
+    def test_heartbeated_claim_kept(self):
+        # A claim that was made long ago but was touched since is kept.
+        key = self.queue.claim()
+        self.backdate(key)
+        self.queue.touch(key)
+        self.queue.requeue_stale(self.claim_timeout)
+        self.assertEqual(self.claimed(), [key])
+
+    def test_dead_process_requeued(self):
+        # A fresh claim by a process on this host that no longer exists.
+        pid = 1 << 30
+        self.assertFalse(campaign._pid_exists(pid))
+        os.rename(os.path.join(self.queue.pending_dir, 'b'),
+            os.path.join(self.queue.claimed_dir,
+                'b@%s@%d' % (self.queue.host, pid)))
+        self.queue.requeue_stale(self.claim_timeout)
+        self.assertEqual(self.claimed(), [])
+        self.assertEqual(self.pending(), self.keys)
+
+    def test_heartbeat_during_work(self):
+        # While an item is processed, the worker keeps touching its claim, so
+        # that another runner does not requeue it however long it takes.
+        # Backdate the claim from within the item, wait for the heartbeat to
+        # refresh it, and then look at it the way another runner would.
+        outcomes = {}
+        other = campaign.WorkQueue(self.root)
+
+        def func(key):
+            path = self.queue._claim_path(key)
+            self.backdate(key)
+            backdated = os.stat(path).st_mtime
+            deadline = time.time() + self.timeout
+            while os.stat(path).st_mtime == backdated and time.time() < deadline:
+                time.sleep(0.01)
+            other.requeue_stale(self.claim_timeout)
+            outcomes[key] = key in self.claimed()
+            return dict(status='ok')
+
+        # With this timeout, the claim is touched every 0.05 s.
+        records = campaign.run(self.queue, func, claim_timeout=0.2)
+        self.assertEqual(outcomes, dict((key, True) for key in self.keys))
+        self.assertEqual([record['key'] for record in records], self.keys)
+        self.assertEqual(self.claimed(), [])
+        self.assertEqual(self.pending(), [])
+
+
+if __name__ == '__main__':
+    unittest.main()
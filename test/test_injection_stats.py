@@ -0,0 +1,116 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+"""
+Test cases for bayestar.sky_map.injection_stats, which finds the searched
+area and the credible areas by weighted quickselect, against the sort-based
+calculation that bayestar_aggregate_found_injections used to do.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import unittest
+import healpy as hp
+import numpy as np
+from bayestar import sky_map
+
+
+def injection_stats(prob, theta, phi, levels):
+    """Reference implementation: sort the pixels by descending probability
+    and accumulate. Pixels that are exactly as probable as the true location
+    are searched after it."""
+    npix = len(prob)
+    nside = hp.npix2nside(npix)
+    pixarea = hp.nside2pixarea(nside, degrees=True)
+    true_pix = hp.ang2pix(nside, theta, phi)
+
+    indices = np.lexsort((np.arange(npix) != true_pix, -prob))
+    cum_prob = np.cumsum(prob[indices])
+    idx = np.flatnonzero(indices == true_pix)[0]
+    searched_area = (idx + 1) * pixarea
+    searched_prob = cum_prob[idx]
+
+    mode_theta, mode_phi = hp.pix2ang(nside, np.argmax(prob))
+    offset = np.rad2deg(np.arccos(np.clip(
+        np.cos(phi - mode_phi) * np.sin(theta) * np.sin(mode_theta)
+        + np.cos(theta) * np.cos(mode_theta), -1, 1)))
+
+    # The smallest number of pixels that contains each level; none for a
+    # level of 0, and all of them if the map sums to less than the level.
+    counts = np.searchsorted(np.concatenate(([0.], cum_prob)), levels)
+    areas = np.minimum(counts, npix) * pixarea
+
+    return searched_area, searched_prob, offset, areas
+
+
+def random_sky_map(rng, npix, nvalues):
+    """Make a random sky map with many ties. The probabilities are small
+    multiples of a power of 2 that sum to exactly 1, so that every partial
+    sum is exact no matter in what order it is taken."""
+    counts = rng.randint(nvalues, size=npix)
+    total = 1 << int(np.ceil(np.log2(counts.sum() + 1)))
+    counts += rng.multinomial(total - counts.sum(), np.ones(npix) / npix)
+    return counts / float(total)
+
+
+class TestInjectionStats(unittest.TestCase):
+
+    # Unsorted, with duplicates, and including both ends.
+    levels = [0.9, 0., 0.5, 1., 0.5, 0.99, 0.25]
+
+    def assertStats(self, prob, true_pix, levels):
+        nside = hp.npix2nside(len(prob))
+        theta, phi = hp.pix2ang(nside, true_pix)
+        expected = injection_stats(prob, theta, phi, levels)
+        result = sky_map.injection_stats(prob, theta, phi, levels)
+        # Off by one pixel would be off by far more than the tolerance.
+        np.testing.assert_allclose(result[0], expected[0], rtol=1e-12)
+        self.assertEqual(result[1], expected[1])
+        self.assertAlmostEqual(result[2], expected[2])
+        np.testing.assert_allclose(result[3], expected[3], rtol=1e-12)
+
+    def test_random(self):
+        rng = np.random.RandomState(0)
+        for nside in (1, 4, 32):
+            npix = hp.nside2npix(nside)
+            for nvalues in (2, 5, 1000):
+                prob = random_sky_map(rng, npix, nvalues)
+                for true_pix in rng.randint(npix, size=4):
+                    self.assertStats(prob, true_pix, self.levels)
+
+    def test_uniform(self):
+        # Every pixel is tied with the true location. The map sums to 0.75,
+        # less than some of the levels, so their regions are the whole sky.
+        npix = hp.nside2npix(8)
+        self.assertStats(np.ones(npix) / 1024, 17, self.levels)
+
+    def test_point_mass(self):
+        # All of the probability is in one pixel, which is or is not the
+        # true location.
+        npix = hp.nside2npix(8)
+        prob = np.zeros(npix)
+        prob[42] = 1
+        self.assertStats(prob, 42, self.levels)
+        self.assertStats(prob, 7, self.levels)
+
+    def test_no_levels(self):
+        npix = hp.nside2npix(4)
+        prob = np.ones(npix) / npix
+        self.assertEqual(len(sky_map.injection_stats(prob, 0, 0)[3]), 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
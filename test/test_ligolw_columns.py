@@ -0,0 +1,114 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Test cases for the columnar LIGO-LW coinc reader.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import gzip
+import unittest
+from StringIO import StringIO
+from bayestar import ligolw_columns
+
+
+document = r'''<?xml version='1.0' encoding='utf-8'?>
+<LIGO_LW>
+<Table Name="process_paramsgroup:process_params:table">
+<Column Type="lstring" Name="process_paramsgroup:process_params:program"/>
+<Column Type="ilwd:char" Name="process_paramsgroup:process_params:process_id"/>
+<Column Type="lstring" Name="process_paramsgroup:process_params:param"/>
+<Column Type="lstring" Name="process_paramsgroup:process_params:type"/>
+<Column Type="lstring" Name="process_paramsgroup:process_params:value"/>
+<Stream Delimiter="," Type="Local" Name="process_paramsgroup:process_params:table">
+"prog","process:process_id:0","--reference-psd","lstring","psd, \"a\".xml.gz",
+"prog","process:process_id:0","--other","lstring","x"
+</Stream>
+</Table>
+<Table Name="sngl_inspiralgroup:sngl_inspiral:table">
+<Column Type="ilwd:char" Name="sngl_inspiralgroup:sngl_inspiral:process_id"/>
+<Column Type="lstring" Name="sngl_inspiralgroup:sngl_inspiral:ifo"/>
+<Column Type="int_4s" Name="sngl_inspiralgroup:sngl_inspiral:end_time"/>
+<Column Type="int_4s" Name="sngl_inspiralgroup:sngl_inspiral:end_time_ns"/>
+<Column Type="real_4" Name="sngl_inspiralgroup:sngl_inspiral:mass1"/>
+<Column Type="real_4" Name="sngl_inspiralgroup:sngl_inspiral:mass2"/>
+<Column Type="real_4" Name="sngl_inspiralgroup:sngl_inspiral:snr"/>
+<Column Type="lstring" Name="sngl_inspiralgroup:sngl_inspiral:channel"/>
+<Column Type="ilwd:char" Name="sngl_inspiralgroup:sngl_inspiral:event_id"/>
+<Stream Delimiter="," Type="Local" Name="sngl_inspiralgroup:sngl_inspiral:table">
+"process:process_id:0","H1",1000000000,500,1.4,1.3,10.5,,"sngl_inspiral:event_id:3",
+"process:process_id:0","L1",1000000000,600,1.4,1.3,8.5,"a,b","sngl_inspiral:event_id:1",
+"process:process_id:0","V1",1000000001,700,1.5,1.3,5.5,,"sngl_inspiral:event_id:2",
+"process:process_id:0","H1",1000000002,800,1.6,1.3,9,,"sngl_inspiral:event_id:7"
+</Stream>
+</Table>
+<Table Name="coinc_event_mapgroup:coinc_event_map:table">
+<Column Type="ilwd:char" Name="coinc_event_mapgroup:coinc_event_map:coinc_event_id"/>
+<Column Type="char_v" Name="coinc_event_mapgroup:coinc_event_map:table_name"/>
+<Column Type="ilwd:char" Name="coinc_event_mapgroup:coinc_event_map:event_id"/>
+<Stream Delimiter="," Type="Local" Name="coinc_event_mapgroup:coinc_event_map:table">
+"coinc_event:coinc_event_id:5","sngl_inspiral","sngl_inspiral:event_id:3",
+"coinc_event:coinc_event_id:9","sim_inspiral","sim_inspiral:simulation_id:0",
+"coinc_event:coinc_event_id:9","coinc_event","coinc_event:coinc_event_id:5",
+"coinc_event:coinc_event_id:5","sngl_inspiral","sngl_inspiral:event_id:1",
+"coinc_event:coinc_event_id:2","sngl_inspiral","sngl_inspiral:event_id:7",
+"coinc_event:coinc_event_id:5","sngl_inspiral","sngl_inspiral:event_id:2"
+</Stream>
+</Table>
+</LIGO_LW>
+'''
+
+
+class TestReadCoincs(unittest.TestCase):
+
+    def check(self, coincs):
+        self.assertEqual(len(coincs), 2)
+        self.assertEqual(coincs.psd_filenames_by_process_id,
+            {0: 'psd, "a".xml.gz'})
+
+        (id1, sngls1), (id2, sngls2) = coincs
+        self.assertEqual(id1, 2)
+        self.assertEqual(list(sngls1['ifo']), ['H1'])
+        self.assertEqual(list(sngls1['end_time_ns']), [1000000002000000800])
+        self.assertEqual(id2, 5)
+        self.assertEqual(list(sngls2['ifo']), ['H1', 'L1', 'V1'])
+        self.assertEqual(list(sngls2['event_id']), [3, 1, 2])
+        self.assertEqual(list(sngls2['snr']), [10.5, 8.5, 5.5])
+
+    def test_plain(self):
+        self.check(ligolw_columns.read_coincs(StringIO(document)))
+
+    def test_gzip(self):
+        compressed = StringIO()
+        gzfile = gzip.GzipFile(fileobj=compressed, mode='wb')
+        gzfile.write(document)
+        gzfile.close()
+        compressed.seek(0)
+        self.check(ligolw_columns.read_coincs(compressed))
+
+    def test_small_chunks(self):
+        # Tokens and quoted strings that straddle chunks.
+        tables = ligolw_columns._Reader().read(StringIO(document), chunk_size=7)
+        self.assertEqual(list(tables['sngl_inspiral']['snr']),
+            [10.5, 8.5, 5.5, 9])
+        self.assertEqual(tables['process_params']['value'],
+            ['psd, "a".xml.gz', 'x'])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,190 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Test cases for the pipelined alert handler, using a local stand-in for
+GraceDb. The tests are driven by events rather than by timing: files are made
+to arrive, and stages are made to wait for one another, at precise points, so
+that the assertions do not depend on how fast the machine is.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import os
+import shutil
+import tempfile
+import threading
+import unittest
+from bayestar import local_gracedb
+from bayestar import pipeline
+
+
+class TestAlertPipeline(unittest.TestCase):
+
+    graceids = ['G1', 'G2', 'G3', 'G4']
+    filenames = ['coinc.xml', 'psd.xml.gz']
+
+    # How long to wait for something that should happen promptly before
+    # declaring that it did not happen at all. This only bounds how long a
+    # failing test takes; passing tests never wait this long.
+    timeout = 10
+
+    def setUp(self):
+        self.root = tempfile.mkdtemp()
+        self.tmpdir = tempfile.mkdtemp()
+        for graceid in self.graceids:
+            os.mkdir(os.path.join(self.root, graceid))
+            for filename in self.filenames:
+                self.upload(graceid, filename)
+        self.gracedb = local_gracedb.GraceDb(self.root)
+        self.localized = []
+        self.published = []
+        self.lock = threading.Lock()
+        self.started = dict(
+            (graceid, threading.Event()) for graceid in self.graceids)
+        self.done = dict(
+            (graceid, threading.Event()) for graceid in self.graceids)
+
+        # Called at the start of publish() for each event.
+        self.before_publish = lambda graceid: None
+
+    def tearDown(self):
+        shutil.rmtree(self.root)
+        shutil.rmtree(self.tmpdir)
+
+    def upload(self, graceid, filename):
+        with open(os.path.join(self.root, graceid, filename), 'w') as f:
+            print >>f, graceid, filename
+
+    def parse(self, fileobj):
+        return fileobj.read().strip()
+
+    def localize(self, graceid, coinc, psds):
+        self.started[graceid].set()
+        with self.lock:
+            self.localized.append((graceid, coinc, psds))
+        return '%s sky map with %s' % (graceid, psds)
+
+    def publish(self, graceid, result):
+        self.before_publish(graceid)
+        path = os.path.join(self.tmpdir, graceid + '.fits.gz')
+        with open(path, 'w') as f:
+            print >>f, result
+        self.gracedb.writeFile(graceid, path).read()
+        with self.lock:
+            if graceid not in self.published:
+                self.gracedb.writeLabel(graceid, 'EM_READY')
+            self.published.append(graceid)
+        self.done[graceid].set()
+
+    def start_pipeline(self, **kwargs):
+        alert_pipeline = pipeline.AlertPipeline(self.gracedb,
+            local_gracedb.HTTPError, self.parse, self.parse,
+            self.localize, self.publish, **kwargs)
+        alert_pipeline.start()
+        return alert_pipeline
+
+    def run_pipeline(self, graceids, **kwargs):
+        alert_pipeline = self.start_pipeline(**kwargs)
+        for graceid in graceids:
+            alert_pipeline.submit(graceid)
+        alert_pipeline.stop()
+        return alert_pipeline.status
+
+    def assertPublished(self, graceid, psds):
+        with open(os.path.join(self.root, graceid, 'labels')) as f:
+            self.assertEqual(f.read().split(), ['EM_READY'])
+        with open(os.path.join(self.root, graceid, graceid + '.fits.gz')) as f:
+            self.assertEqual(f.read().strip(),
+                '%s sky map with %s' % (graceid, psds))
+
+    def test_overlap(self):
+        # Hold up the publication of each event until the localization of the
+        # next event has started. This can only finish in time if the
+        # localization thread moves on while the previous event is published.
+        overlapped = []
+
+        def before_publish(graceid):
+            i = self.graceids.index(graceid)
+            if i + 1 < len(self.graceids):
+                next_started = self.started[self.graceids[i + 1]]
+                next_started.wait(self.timeout)
+                overlapped.append(next_started.is_set())
+        self.before_publish = before_publish
+
+        status = self.run_pipeline(self.graceids)
+
+        self.assertEqual(status, dict((graceid, 'ok') for graceid in self.graceids))
+        self.assertEqual(overlapped, [True] * (len(self.graceids) - 1))
+        for graceid in self.graceids:
+            self.assertPublished(graceid, graceid + ' psd.xml.gz')
+        self.assertEqual(sorted(self.localized), [
+            (graceid, graceid + ' coinc.xml', graceid + ' psd.xml.gz')
+            for graceid in self.graceids])
+
+    def test_late_psd(self):
+        # G1's PSD does not arrive until its preliminary sky map, made with
+        # model PSDs, has been published; G2's files are all there.
+        os.remove(os.path.join(self.root, 'G1', 'psd.xml.gz'))
+        alert_pipeline = self.start_pipeline(psd_wait=0)
+        alert_pipeline.submit('G1')
+        self.done['G1'].wait(self.timeout)
+        self.assertTrue(self.done['G1'].is_set())
+        self.assertEqual(self.localized, [('G1', 'G1 coinc.xml', None)])
+        self.assertPublished('G1', None)
+
+        # Localizing another event is not held up by G1's missing PSD. (With
+        # psd_wait=0, G2 may or may not get a preliminary sky map too,
+        # depending on whether its PSD has been read by the time it is
+        # localized; either way, it ends up with a sky map made with its PSD.)
+        alert_pipeline.submit('G2')
+        self.done['G2'].wait(self.timeout)
+        self.assertTrue(self.done['G2'].is_set())
+
+        # Once the PSD arrives, G1 is localized again and the refined sky map
+        # replaces the preliminary one without being labeled again.
+        self.upload('G1', 'psd.xml.gz')
+        alert_pipeline.stop()
+        self.assertEqual(alert_pipeline.status, {'G1': 'ok', 'G2': 'ok'})
+        self.assertEqual(self.published.count('G1'), 2)
+        self.assertEqual(self.published[-1], 'G1')
+        self.assertEqual([item for item in self.localized if item[0] == 'G1'], [
+            ('G1', 'G1 coinc.xml', None),
+            ('G1', 'G1 coinc.xml', 'G1 psd.xml.gz')])
+        self.assertPublished('G1', 'G1 psd.xml.gz')
+        self.assertPublished('G2', 'G2 psd.xml.gz')
+
+    def test_missing_files(self):
+        os.remove(os.path.join(self.root, 'G1', 'psd.xml.gz'))
+        os.remove(os.path.join(self.root, 'G2', 'coinc.xml'))
+        status = self.run_pipeline(['G1', 'G2', 'G3'],
+            download_timeout=0.5, psd_wait=self.timeout)
+
+        # A missing PSD is not fatal, but a missing coinc.xml is, and
+        # neither should affect the other events. Since psd_wait outlasts the
+        # download timeout, G1 is localized only once, with model PSDs, after
+        # its PSD is given up on.
+        self.assertEqual(status, {'G1': 'ok', 'G2': 'error', 'G3': 'ok'})
+        self.assertPublished('G1', None)
+        self.assertPublished('G3', 'G3 psd.xml.gz')
+        self.assertFalse(os.path.exists(os.path.join(self.root, 'G2', 'labels')))
+        self.assertEqual([item for item in self.localized if item[0] == 'G1'],
+            [('G1', 'G1 coinc.xml', None)])
+
+
+if __name__ == '__main__':
+    unittest.main()
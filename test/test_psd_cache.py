@@ -0,0 +1,81 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+"""
+Test cases for the eviction of least recently used entries from
+bayestar.psd_cache.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import os
+import shutil
+import tempfile
+import unittest
+import numpy as np
+from bayestar import psd_cache
+
+
+class TestPSDCacheEviction(unittest.TestCase):
+
+    def setUp(self):
+        self.cache_dir = tempfile.mkdtemp()
+        f = np.arange(1, 1025, dtype=float)
+
+        # Store three PSDs of equal size, and date them so that the first is
+        # the oldest and the last is the newest.
+        self.digests = [psd_cache.store(f, scale * np.ones_like(f),
+            self.cache_dir) for scale in (1., 2., 3.)]
+        for i, digest in enumerate(self.digests):
+            os.utime(self.path(digest), (1000 + i, 1000 + i))
+        self.size = os.path.getsize(self.path(self.digests[0]))
+
+    def tearDown(self):
+        shutil.rmtree(self.cache_dir)
+
+    def path(self, digest):
+        return os.path.join(self.cache_dir, digest + '.npy')
+
+    def remaining(self):
+        return [digest for digest in self.digests
+            if os.path.exists(self.path(digest))]
+
+    def test_within_bound(self):
+        psd_cache.evict(self.cache_dir, 3 * self.size)
+        self.assertEqual(self.remaining(), self.digests)
+
+    def test_least_recently_used(self):
+        # Using the oldest PSD makes the second one the least recently used.
+        self.assertTrue(psd_cache.touch(self.path(self.digests[0])))
+        psd_cache.evict(self.cache_dir, 2 * self.size)
+        self.assertEqual(self.remaining(),
+            [self.digests[0], self.digests[2]])
+
+    def test_touch_missing(self):
+        self.assertFalse(psd_cache.touch(self.path('0' * 40)))
+
+    def test_evicted_then_stored_again(self):
+        psd_cache.evict(self.cache_dir, 0)
+        self.assertEqual(self.remaining(), [])
+        f = np.arange(1, 1025, dtype=float)
+        self.assertEqual(psd_cache.store(f, np.ones_like(f), self.cache_dir),
+            self.digests[0])
+        np.testing.assert_array_equal(
+            psd_cache.load(self.digests[0], self.cache_dir).S, np.ones_like(f))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,118 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+"""
+Test cases for the down-sampling of sky maps by bayestar.sky_map.pyramid and
+bayestar.fits.write_sky_map, against healpy.ud_grade.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import os
+import shutil
+import tempfile
+import unittest
+import healpy as hp
+import numpy as np
+from bayestar import fits
+from bayestar import sky_map
+
+
+class TestPyramid(unittest.TestCase):
+
+    nside = 32
+    nsides = (16, 1, 32, 4)
+
+    def setUp(self):
+        rng = np.random.RandomState(0)
+        prob = rng.exponential(size=hp.nside2npix(self.nside)) ** 4
+        self.prob = prob / prob.sum()
+
+    def expected(self, prob, nside, order='RING'):
+        return hp.ud_grade(prob, nside, order_in=order, order_out=order,
+            power=-2)
+
+    def test_ud_grade(self):
+        levels = sky_map.pyramid(self.prob, self.nsides)
+        self.assertEqual(len(levels), len(self.nsides))
+        for nside, level in zip(self.nsides, levels):
+            self.assertEqual(level.dtype, np.float64)
+            self.assertEqual(len(level), hp.nside2npix(nside))
+            np.testing.assert_allclose(level, self.expected(self.prob, nside),
+                rtol=1e-12, err_msg="nside=%d" % nside)
+
+    def test_conservation(self):
+        for nside, level in zip(self.nsides,
+                sky_map.pyramid(self.prob, self.nsides)):
+            self.assertAlmostEqual(level.sum(), 1, places=12,
+                msg="nside=%d" % nside)
+
+    def test_ring_nested_round_trip(self):
+        # The output is in RING order, but the pixels are merged in NESTED
+        # order. At the input resolution, the map must come back unchanged,
+        # and at coarser resolutions, down-sampling in NESTED order and then
+        # reordering must give the same maps.
+        prob_nest = hp.reorder(self.prob, r2n=True)
+        for nside, level in zip(self.nsides,
+                sky_map.pyramid(self.prob, self.nsides)):
+            if nside == self.nside:
+                np.testing.assert_array_equal(level, self.prob)
+            np.testing.assert_allclose(hp.reorder(level, r2n=True),
+                self.expected(prob_nest, nside, 'NESTED'), rtol=1e-12,
+                err_msg="nside=%d" % nside)
+
+    def test_single(self):
+        for nside, level in zip(self.nsides,
+                sky_map.pyramid(self.prob, self.nsides, single=True)):
+            self.assertEqual(level.dtype, np.float32)
+            np.testing.assert_allclose(level, self.expected(self.prob, nside),
+                rtol=1e-6, err_msg="nside=%d" % nside)
+
+    def test_no_levels(self):
+        self.assertEqual(len(sky_map.pyramid(self.prob, ())), 0)
+
+    def test_invalid(self):
+        # The input nside is not a power of 2.
+        prob = np.ones(hp.nside2npix(3)) / hp.nside2npix(3)
+        self.assertRaises(ValueError, sky_map.pyramid, prob, (1,))
+        # The input is not a valid number of pixels.
+        self.assertRaises(ValueError, sky_map.pyramid, self.prob[:-1], (1,))
+        # An output nside is not a power of 2, or is finer than the input.
+        for nside in (3, 0, 2 * self.nside):
+            self.assertRaises(ValueError, sky_map.pyramid, self.prob,
+                (1, nside))
+
+    def test_write_sky_map(self):
+        tmpdir = tempfile.mkdtemp()
+        try:
+            filename = os.path.join(tmpdir, 'test.fits.gz')
+            fits.write_sky_map(filename, self.prob, nsides=self.nsides,
+                objid='test')
+            prob, metadata = fits.read_sky_map(filename)
+            np.testing.assert_allclose(prob, self.prob, rtol=1e-6)
+            for nside in self.nsides:
+                prob, metadata = fits.read_sky_map(
+                    fits.pyramid_filename(filename, nside))
+                self.assertEqual(metadata['objid'], 'test')
+                np.testing.assert_allclose(prob,
+                    self.expected(self.prob, nside), rtol=1e-6,
+                    err_msg="nside=%d" % nside)
+        finally:
+            shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,103 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Test cases for the interpolated horizon distances and timing uncertainties of
+bayestar.signal_model_table, and for the direct evaluation that stands in for
+them while the table is cold.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import os
+import shutil
+import tempfile
+import unittest
+import numpy as np
+import lalsimulation
+from bayestar import signal_model_table
+from bayestar import timing
+
+
+# Masses and SNRs that fall between the nodes of the grid.
+masses = ((1.45, 1.37), (5.3, 2.2), (13.7, 9.1))
+snrs = (5.3, 9.7, 23.)
+
+
+class TestSignalModelTable(unittest.TestCase):
+
+    def setUp(self):
+        self.cache_dir = tempfile.mkdtemp()
+        self.S = timing.get_noise_psd_func("H1")
+        self.table = signal_model_table.SignalModelTable(self.S, 40,
+            lalsimulation.TaylorF2, -1, -1, cache_dir=self.cache_dir)
+
+    def tearDown(self):
+        shutil.rmtree(self.cache_dir)
+
+    def signal_model(self, mass1, mass2):
+        return timing.SignalModel(mass1, mass2, self.S, 40,
+            lalsimulation.TaylorF2, -1, -1)
+
+    def test_cold(self):
+        # A cold table evaluates the signal model directly and does not
+        # compute or save any nodes until it is flushed.
+        for mass1, mass2 in masses:
+            signal_model = self.signal_model(mass1, mass2)
+            self.assertEqual(self.table.get_horizon_distance(mass1, mass2),
+                signal_model.get_horizon_distance())
+            for snr in snrs:
+                self.assertEqual(self.table.get_toa_uncert(mass1, mass2, snr),
+                    signal_model.get_toa_uncert(snr))
+        self.assertTrue(np.isnan(self.table.log_horizons).all())
+        self.assertFalse(os.path.exists(self.table.path))
+
+        self.table.flush()
+        self.assertTrue(os.path.exists(self.table.path))
+        self.assertTrue(np.isfinite(self.table.log_horizons).any())
+        self.assertTrue(np.isfinite(self.table.log_toa_uncerts).any())
+
+    def test_horizon_distance(self):
+        # The horizon distance is a smooth power law in the chirp mass, so
+        # log-linear interpolation on the mass grid is accurate to 1%.
+        for mass1, mass2 in masses:
+            self.table.get_horizon_distance(mass1, mass2)
+        self.table.flush()
+        for mass1, mass2 in masses:
+            expected = self.signal_model(mass1, mass2).get_horizon_distance()
+            result = self.table.get_horizon_distance(mass1, mass2)
+            np.testing.assert_allclose(result, expected, rtol=1e-2,
+                err_msg="masses=(%g, %g)" % (mass1, mass2))
+
+    def test_toa_uncert(self):
+        # The timing uncertainty bends away from a power law in the SNR near
+        # the threshold of the Barankin bound, so allow 5%.
+        for mass1, mass2 in masses:
+            for snr in snrs:
+                self.table.get_toa_uncert(mass1, mass2, snr)
+        self.table.flush()
+        for mass1, mass2 in masses:
+            signal_model = self.signal_model(mass1, mass2)
+            for snr in snrs:
+                expected = signal_model.get_toa_uncert(snr)
+                result = self.table.get_toa_uncert(mass1, mass2, snr)
+                np.testing.assert_allclose(result, expected, rtol=5e-2,
+                    err_msg="masses=(%g, %g), snr=%g" % (mass1, mass2, snr))
+
+
+if __name__ == '__main__':
+    unittest.main()
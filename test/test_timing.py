@@ -0,0 +1,45 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Test cases for the native implementation of the Barankin bound.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import unittest
+import numpy as np
+import lalsimulation
+from bayestar import timing
+
+
+class TestBarankinBound(unittest.TestCase):
+
+    def test_native_matches_numpy(self):
+        S = timing.get_noise_psd_func("H1")
+        for mass1, mass2 in ((1.4, 1.4), (1.4, 10.), (10., 10.)):
+            signal_model = timing.SignalModel(mass1, mass2, S, 40,
+                lalsimulation.TaylorF2, -1, -1)
+            for snr in (4., 8., 16., 32.):
+                expected = signal_model.get_brb_numpy(snr)
+                result = signal_model.get_brb(snr)
+                np.testing.assert_allclose(result, expected, rtol=1e-6,
+                    err_msg="masses=(%g, %g), snr=%g" % (mass1, mass2, snr))
+
+
+if __name__ == '__main__':
+    unittest.main()
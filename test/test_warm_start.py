@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013  Leo Singer
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+"""
+Test cases for warm-start re-localization with
+bayestar.ligolw_sky_map.WarmStart.
+"""
+__author__ = "Leo Singer <leo.singer@ligo.org>"
+
+import unittest
+import numpy as np
+import lalsimulation
+from bayestar import regression
+from bayestar import sky_map
+from bayestar.ligolw_sky_map import WarmStart
+
+
+ifos = ('H1', 'L1', 'V1')
+detectors = [lalsimulation.InstrumentNameToLALDetector(ifo) for ifo in ifos]
+responses = [det.response for det in detectors]
+locations = [det.location for det in detectors]
+prior = 'uniform in volume'
+
+
+def localize(event, warm_start=None, nifos=3, toas=None, snrs=None,
+        horizons=None, **kwargs):
+    """Localize an event, optionally with updated inputs, with or without a
+    warm start."""
+    if toas is None:
+        toas = event.toas
+    if snrs is None:
+        snrs = event.snrs
+    if horizons is None:
+        horizons = event.horizons
+    args = (event.gmst, toas[:nifos], snrs[:nifos], event.s2_toas[:nifos],
+        responses[:nifos], locations[:nifos], horizons[:nifos],
+        event.min_distance, event.max_distance, prior)
+    if warm_start is None:
+        return sky_map.tdoa_snr(*args, **kwargs)
+    else:
+        return warm_start.tdoa_snr(*args, detectors=ifos[:nifos], **kwargs)
+
+
+class TestWarmStart(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.events = regression.make_corpus(4)
+
+    def assert_update_reuses_antenna(self, nreused, before, after):
+        """Localize each event with the inputs before(event), then with the
+        inputs after(event), and check that the antenna factors of nreused
+        detectors were reused and that the result matches a cold start."""
+        for event in self.events:
+            warm_start = WarmStart()
+            localize(event, warm_start, **before(event))
+            warm = localize(event, warm_start, **after(event))
+            self.assertEqual(warm_start.antenna_reused, nreused)
+            cold = localize(event, **after(event))
+            self.assertEqual(len(warm), len(cold))
+            np.testing.assert_allclose(warm, cold, rtol=1e-12, atol=1e-300)
+
+    def test_snr_update(self):
+        self.assert_update_reuses_antenna(3, lambda event: {},
+            lambda event: dict(snrs=event.snrs * [1, 1.1, 1]))
+
+    def test_horizon_update(self):
+        self.assert_update_reuses_antenna(3, lambda event: {},
+            lambda event: dict(horizons=event.horizons * [1, 1, 0.9]))
+
+    def test_detector_joins(self):
+        # A new detector usually changes the adaptively selected resolution,
+        # so use a fixed one.
+        self.assert_update_reuses_antenna(2,
+            lambda event: dict(nifos=2, nside=64),
+            lambda event: dict(nifos=3, nside=64))
+
+    def test_resolution_matches_cold_start(self):
+        # The warm start tries the previous resolution first. Check that it
+        # settles on the same resolution as a cold start after the times of
+        # arrival have been refined.
+        random_state = np.random.RandomState(0)
+        for event in self.events:
+            warm_start = WarmStart()
+            localize(event, warm_start)
+            toas = event.toas + 0.5 * np.sqrt(event.s2_toas) * random_state.randn(3)
+            warm = localize(event, warm_start, toas=toas)
+            cold = localize(event, toas=toas)
+            self.assertEqual(len(warm), len(cold))
+            np.testing.assert_allclose(warm, cold, rtol=1e-12, atol=1e-300)
+
+
+if __name__ == '__main__':
+    unittest.main()